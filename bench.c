@@ -0,0 +1,527 @@
+// Micro-benchmarks for the sys-genmon collectors and formatters.
+// Built and run by `./build.sh bench [DIR]...`.
+//
+// sys-genmon.c is included with its main() left out, so the benchmarks
+// call the same static functions the binary does. Every fixture is a pair
+// of /proc/stat samples plus a /proc/meminfo, read through the normal
+// procfs readers with their paths pointed at the fixture files:
+//  - host: this machine's files, recorded at startup 100ms apart
+//  - DIR: recorded elsewhere; DIR/stat and DIR/meminfo, and optionally
+//    DIR/stat.prev for the earlier sample
+//  - synthetic: generated /proc/stat with 8, 64, 256 and 1024 CPUs
+// The process scanner runs once against the live /proc (or
+// SYS_GENMON_PROC_ROOT), reporting the processes it tracks. The disk and
+// network parsers run over a generated container host: two disks among
+// 500 loop devices, one NIC among 500 veths. The cgroup walker runs over a
+// generated tree of 3000 systemd scopes in two slices. /proc/stat parsing
+// is also timed against two baselines: the bytewise loop cpustat_parse
+// used before tokenize.h, and strtoul() with an errno check per field.
+// Nothing needs root, a GPU or a running daemon.
+
+#define SYS_GENMON_NO_MAIN
+#include "sys-genmon.c"
+
+#define BENCH_MIN_NS 200000000ull // Run each benchmark at least this long
+
+struct fixture {
+  char name[64];
+  char stat_prev[PATH_MAX];
+  char stat[PATH_MAX];
+  char meminfo[PATH_MAX];
+};
+
+static char bench_dir[64] = "/tmp/sys-genmon-bench-XXXXXX";
+static char *bench_buf;
+static struct cpu_record bench_prev, bench_parsed;
+static int bench_heatmap;
+static int bench_compile; // Cold M1 runs find no template file
+
+// Copy a procfs file into the fixture directory. Returns 0, or -1.
+static int record_file(const char *src, const char *dst) {
+  struct procfs_file in = PROCFS_FILE(src);
+  struct procfs_buf b = {0};
+  ssize_t n = procfs_read(&in, &b);
+  procfs_close(&in);
+  int fd = n > 0 ? open(dst, O_CREAT | O_WRONLY | O_TRUNC, 0644) : -1;
+  int ok = fd >= 0 && write(fd, b.data, n) == n;
+  if (fd >= 0)
+    close(fd);
+  procfs_buf_free(&b);
+  return ok ? 0 : -1;
+}
+
+static int file_exists(const char *path) { return access(path, R_OK) == 0; }
+
+// /proc/stat for num_cpus cores. Counters come from a fixed LCG so runs
+// are comparable; ticks is added to every counter of the later sample.
+static void write_synthetic_stat(const char *path, size_t num_cpus,
+                                 uint64_t ticks) {
+  FILE *f = fopen(path, "w");
+  if (!f)
+    puts("Failed to write a fixture."), exit(1);
+
+  uint64_t seed = 0x9E3779B97F4A7C15ull;
+  uint64_t sum[10] = {0}, core[10];
+  char *lines = NULL;
+  size_t lines_len = 0;
+  FILE *body = open_memstream(&lines, &lines_len);
+  for (size_t i = 0; i < num_cpus; i++) {
+    for (int k = 0; k < 10; k++) {
+      seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+      core[k] = (seed >> 33) % 5000000 + ticks * (k == 0 ? (i % 7) + 1 : k == 3 ? 8 : 0);
+      sum[k] += core[k];
+    }
+    fprintf(body, "cpu%zu %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64
+            " %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64 "\n",
+            i, core[0], core[1], core[2], core[3], core[4], core[5], core[6],
+            core[7], core[8], core[9]);
+  }
+  fclose(body);
+
+  fprintf(f, "cpu  %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64
+          " %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64 "\n",
+          sum[0], sum[1], sum[2], sum[3], sum[4], sum[5], sum[6], sum[7],
+          sum[8], sum[9]);
+  fwrite(lines, 1, lines_len, f);
+  free(lines);
+
+  // The tail a real /proc/stat has after the cores; the parser stops
+  // before it, but it is still read.
+  fputs("intr 123456789", f);
+  for (int i = 0; i < 512; i++)
+    fprintf(f, " %d", i * 37 % 1000);
+  fputs("\nctxt 987654321\nbtime 1700000000\nprocesses 424242\n"
+        "procs_running 3\nprocs_blocked 0\n"
+        "softirq 1234567 1 2 3 4 5 6 7 8 9 10\n", f);
+  fclose(f);
+}
+
+// /proc/diskstats and /proc/net/dev of a container host, in memory.
+static char *bench_diskstats, *bench_netdev;
+static size_t bench_diskstats_len, bench_netdev_len;
+
+static void write_synthetic_io(void) {
+  FILE *f = open_memstream(&bench_diskstats, &bench_diskstats_len);
+  for (int i = 0; i < 500; i++)
+    fprintf(f, "   7 %7d loop%d 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0\n", i, i);
+  static const char *const disks[] = {"nvme0n1", "nvme0n1p1", "nvme0n1p2", "sda", "sda1"};
+  for (int i = 0; i < 5; i++)
+    fprintf(f, " %3d %7d %s 123456 789 98765432 4321 234567 890 87654321 5432 0 "
+            "345678 9876 0 0 0 0 1234 56\n", i < 3 ? 259 : 8, i, disks[i]);
+  fclose(f);
+
+  f = open_memstream(&bench_netdev, &bench_netdev_len);
+  fputs("Inter-|   Receive                                                |  Transmit\n"
+        " face |bytes    packets errs drop fifo frame compressed multicast|bytes    packets errs drop fifo colls carrier compressed\n"
+        "    lo: 1234567 8901 0 0 0 0 0 0 1234567 8901 0 0 0 0 0 0\n"
+        "  eth0: 987654321 654321 0 12 0 0 0 345 123456789 456789 0 3 0 0 0 0\n", f);
+  for (int i = 0; i < 500; i++)
+    fprintf(f, "veth%07x: 1234 12 0 0 0 0 0 0 5678 34 0 0 0 0 0 0\n", i * 2654435761u >> 4);
+  fclose(f);
+  iostat_filter_parse(&disk_filter, IOSTAT_DEFAULT_DISKS);
+  iostat_filter_parse(&net_filter, IOSTAT_DEFAULT_NETS);
+}
+
+// A cgroup's directory with its cpu.stat and memory.current.
+static void write_cgroup(const char *dir, int usage_ms, int pages) {
+  char path[PATH_MAX];
+  mkdir(dir, 0700);
+  snprintf(path, sizeof(path), "%s/cpu.stat", dir);
+  FILE *f = fopen(path, "w");
+  if (!f)
+    puts("Failed to write the cgroup tree."), exit(1);
+  fprintf(f, "usage_usec %d000\nuser_usec %d000\nsystem_usec 0\n", usage_ms,
+          usage_ms);
+  fclose(f);
+  snprintf(path, sizeof(path), "%s/memory.current", dir);
+  if (!(f = fopen(path, "w")))
+    puts("Failed to write the cgroup tree."), exit(1);
+  fprintf(f, "%d\n", pages * 4096);
+  fclose(f);
+}
+
+// A cgroup2 tree as systemd leaves it on a busy host, under bench_dir.
+static void write_synthetic_cgroups(char *root, size_t n) {
+  char path[PATH_MAX];
+  snprintf(root, n, "%s/cgroup", bench_dir);
+  mkdir(root, 0700);
+  snprintf(path, sizeof(path), "%s/cgroup.controllers", root);
+  FILE *f = fopen(path, "w");
+  if (!f)
+    puts("Failed to write the cgroup tree."), exit(1);
+  fclose(f);
+  static const char *const slices[] = {"system.slice", "user.slice"};
+  for (int s = 0; s < 2; s++) {
+    snprintf(path, sizeof(path), "%s/%s", root, slices[s]);
+    write_cgroup(path, 1500 * 1500, 1500 * 1500);
+    for (int i = 0; i < 1500; i++) {
+      snprintf(path, sizeof(path), "%s/%s/run-%d.scope", root, slices[s], i);
+      write_cgroup(path, i, i);
+    }
+  }
+}
+
+// Point the collectors at a fixture and size the per-core state for it.
+static void load_fixture(const struct fixture *fx) {
+  procfs_close(&proc_stat);
+  procfs_close(&proc_meminfo);
+  proc_meminfo.path = fx->meminfo;
+
+  free(utilization);
+  cpustat_free(&info.cpu_info);
+  cpustat_free(&bench_prev);
+  cpustat_free(&bench_parsed);
+
+  proc_stat.path = fx->stat;
+  init_cpu_storage(cpustat_detect_cpus(&proc_stat, &stat_buf));
+  if (cpustat_alloc(&bench_prev, num_cpu_slots) ||
+      cpustat_alloc(&bench_parsed, num_cpu_slots))
+    puts("Out of memory."), exit(1);
+
+  proc_stat.path = fx->stat_prev;
+  get_cpu_info(&bench_prev);
+  procfs_close(&proc_stat);
+  proc_stat.path = fx->stat;
+  get_cpu_info(&info.cpu_info);
+  get_mem_info(&info.mem_info);
+  calculate_cpu_utilization(&bench_prev, &info.cpu_info);
+  memset(&info.gpu_info, 0, sizeof(info.gpu_info));
+
+  buf_cap = BUF_SIZE + num_cpu_slots * BUF_SIZE_PER_CPU;
+  free(bench_buf);
+  bench_buf = malloc(buf_cap);
+  if (!bench_buf)
+    puts("Out of memory."), exit(1);
+}
+
+// Each returns the bytes it read (collectors) or emitted (formatters).
+// measure is set on the untimed call whose byte count is reported.
+static size_t op_get_cpu_info(int measure) {
+  (void)measure;
+  get_cpu_info(&info.cpu_info);
+  return stat_buf.len;
+}
+
+static size_t op_get_mem_info(int measure) {
+  (void)measure;
+  get_mem_info(&info.mem_info);
+  return meminfo_buf.len;
+}
+
+static size_t op_calculate_cpu_utilization(int measure) {
+  (void)measure;
+  calculate_cpu_utilization(&bench_prev, &info.cpu_info);
+  return 0;
+}
+
+static size_t op_print_genmon(int measure) {
+  (void)measure;
+  return print_genmon(bench_buf, 0);
+}
+
+// Genmon text plus the SVG file it points at.
+static size_t op_print_svg(int measure) {
+  heatmap_opts.enabled = bench_heatmap;
+  if (measure)
+    unlink(tmp_svg); // Not skipped as unchanged
+  size_t bytes = print_svg(bench_buf, 0, 0);
+  struct stat st;
+  if (measure && stat(tmp_svg, &st) == 0)
+    bytes += st.st_size;
+  return bytes;
+}
+
+// The same in a fresh one-shot run: the template from bars_svgt, or
+// compiled from scratch without it.
+static size_t op_print_svg_cold(int measure) {
+  bars_svg.len = 0;
+  if (measure && bench_compile)
+    unlink(bars_svgt);
+  return op_print_svg(measure);
+}
+
+// The M1 template patched in memory, without publishing it.
+static size_t op_print_m1_chip_svg(int measure) {
+  (void)measure;
+  if (!print_m1_chip_svg())
+    puts("print_m1_chip_svg failed."), exit(1);
+  return m1_svg.len;
+}
+
+// The same in a fresh one-shot run: the template from m1_svgt, or compiled
+// from scratch without it.
+static size_t op_print_m1_chip_svg_cold(int measure) {
+  m1_svg.len = 0;
+  if (measure && bench_compile)
+    unlink(m1_svgt);
+  return op_print_m1_chip_svg(measure);
+}
+
+// One incremental sample of every process; bytes is the process count.
+static size_t op_procscan_sample(int measure) {
+  (void)measure;
+  procscan_sample(&procs, monotonic_ns());
+  return procs.num_procs;
+}
+
+// One incremental sample of the cgroup tree; bytes is the cgroup count.
+static size_t op_cgscan_sample(int measure) {
+  (void)measure;
+  cgscan_sample(&cgs, monotonic_ns());
+  return cgs.num_cgs;
+}
+
+// Both parsers over the generated files; bytes is the input size.
+static size_t op_iostat_parse(int measure) {
+  static struct iostat_sample sample;
+  diskstats_parse(&sample, bench_diskstats, bench_diskstats_len, &disk_filter);
+  netdev_parse(&sample, bench_netdev, bench_netdev_len, &net_filter);
+  if (measure && (sample.num_disks != 2 || sample.num_nets != 1))
+    puts("The generated devices were filtered wrong."), exit(1);
+  return bench_diskstats_len + bench_netdev_len;
+}
+
+// The /proc/stat cpuN lines without tokenize.h, field by field either
+// bytewise or with strtoul(). Same checks and results as cpustat_parse.
+// Kept out of line so GCC doesn't mistake the end pointer for a dangling
+// one once it is inlined.
+__attribute__((noinline)) static uint64_t baseline_strtoul(const char *p,
+                                                           size_t *used,
+                                                           int *err) {
+  char *next = NULL;
+  errno = 0;
+  uint64_t v = strtoull(p, &next, 10);
+  *used = next - p;
+  if (errno || !*used)
+    *err = 1;
+  return v;
+}
+
+static inline uint64_t baseline_field(const char **pp, const char *end,
+                                      int use_strtoul, int *err) {
+  const char *p = *pp;
+  if (use_strtoul) {
+    size_t used;
+    uint64_t v = baseline_strtoul(p, &used, err);
+    *pp = p + used;
+    return v;
+  }
+  while (p < end && *p == ' ')
+    p++;
+  if (p >= end || *p < '0' || *p > '9')
+    *err = 1;
+  uint64_t v = 0;
+  while (p < end && *p >= '0' && *p <= '9') {
+    uint64_t d = *p++ - '0';
+    if (v > (UINT64_MAX - d) / 10)
+      *err = 1;
+    v = v * 10 + d;
+  }
+  *pp = p;
+  return v;
+}
+
+static inline int baseline_cpustat_parse(struct cpu_record *cpu,
+                                         const char *buf, size_t len,
+                                         int use_strtoul) {
+  const char *p = buf, *end = buf + len;
+  cpu->num_cpus = 0;
+  p = memchr(p, '\n', end - p);
+  if (!p)
+    return CPUSTAT_ERR_PARSE;
+  p++;
+  while (end - p > 3 && p[0] == 'c' && p[1] == 'p' && p[2] == 'u') {
+    size_t n = cpu->num_cpus;
+    if (n >= cpu->capacity)
+      return CPUSTAT_ERR_TOO_MANY;
+    int err = 0;
+    p += 3;
+    uint64_t id = baseline_field(&p, end, use_strtoul, &err);
+    cpu->id[n] = (uint32_t)id;
+    cpu->user[n] = baseline_field(&p, end, use_strtoul, &err);
+    baseline_field(&p, end, use_strtoul, &err); // nice
+    cpu->system[n] = baseline_field(&p, end, use_strtoul, &err);
+    cpu->idle[n] = baseline_field(&p, end, use_strtoul, &err);
+    cpu->iowait[n] = baseline_field(&p, end, use_strtoul, &err);
+    cpu->irq[n] = baseline_field(&p, end, use_strtoul, &err);
+    cpu->softirq[n] = baseline_field(&p, end, use_strtoul, &err);
+    cpu->steal[n] = baseline_field(&p, end, use_strtoul, &err);
+    cpu->guest[n] = baseline_field(&p, end, use_strtoul, &err);
+    if (err || id > UINT32_MAX)
+      return CPUSTAT_ERR_PARSE;
+    const char *nl = memchr(p, '\n', end - p);
+    p = nl ? nl + 1 : end;
+    cpu->num_cpus++;
+  }
+  return 0;
+}
+
+// The parse alone, over the stat_buf get_cpu_info last filled.
+static size_t op_cpustat_parse(int measure) {
+  (void)measure;
+  if (cpustat_parse(&bench_parsed, stat_buf.data, stat_buf.len))
+    puts("cpustat_parse failed."), exit(1);
+  return stat_buf.len;
+}
+
+// The baselines must agree with get_cpu_info field for field.
+static void check_baseline(void) {
+  const struct cpu_record *a = &bench_parsed, *b = &info.cpu_info;
+  size_t n = b->num_cpus, bytes = n * sizeof(uint64_t);
+  int same = a->num_cpus == n && !memcmp(a->id, b->id, n * sizeof(uint32_t)) &&
+             !memcmp(a->user, b->user, bytes) && !memcmp(a->system, b->system, bytes) &&
+             !memcmp(a->idle, b->idle, bytes) && !memcmp(a->iowait, b->iowait, bytes) &&
+             !memcmp(a->irq, b->irq, bytes) && !memcmp(a->softirq, b->softirq, bytes) &&
+             !memcmp(a->steal, b->steal, bytes) && !memcmp(a->guest, b->guest, bytes);
+  if (!same)
+    puts("A baseline parse disagrees with cpustat_parse."), exit(1);
+}
+
+static size_t op_cpustat_parse_bytewise(int measure) {
+  if (baseline_cpustat_parse(&bench_parsed, stat_buf.data, stat_buf.len, 0))
+    puts("The bytewise parse failed."), exit(1);
+  if (measure)
+    check_baseline();
+  return stat_buf.len;
+}
+
+static size_t op_cpustat_parse_strtoul(int measure) {
+  if (baseline_cpustat_parse(&bench_parsed, stat_buf.data, stat_buf.len, 1))
+    puts("The strtoul parse failed."), exit(1);
+  if (measure)
+    check_baseline();
+  return stat_buf.len;
+}
+
+static void run(const char *fixture, const char *name, size_t (*op)(int)) {
+  size_t bytes = op(1); // Also warms up buffers and caches
+  uint64_t iters = 1, elapsed;
+  while (1) {
+    uint64_t start = monotonic_ns();
+    for (uint64_t i = 0; i < iters; i++)
+      op(0);
+    elapsed = monotonic_ns() - start;
+    if (elapsed >= BENCH_MIN_NS)
+      break;
+    iters *= elapsed < BENCH_MIN_NS / 16 ? 8 : 2;
+  }
+  printf("%-12s %-28s %12.1f ns/op %10zu bytes\n", fixture, name,
+         (double)elapsed / iters, bytes);
+  fflush(stdout);
+}
+
+static void run_fixture(const struct fixture *fx) {
+  load_fixture(fx);
+  run(fx->name, "get_cpu_info", op_get_cpu_info);
+  run(fx->name, "cpustat_parse", op_cpustat_parse);
+  run(fx->name, "cpustat_parse bytewise", op_cpustat_parse_bytewise);
+  run(fx->name, "cpustat_parse strtoul", op_cpustat_parse_strtoul);
+  run(fx->name, "get_mem_info", op_get_mem_info);
+  run(fx->name, "calculate_cpu_utilization", op_calculate_cpu_utilization);
+  run(fx->name, "print_genmon", op_print_genmon);
+  bench_heatmap = 0;
+  run(fx->name, "print_svg", op_print_svg);
+  bench_heatmap = 1;
+  run(fx->name, "print_svg --heatmap", op_print_svg);
+  bench_heatmap = 0;
+  bench_compile = 1;
+  run(fx->name, "print_svg compile", op_print_svg_cold);
+  bench_compile = 0;
+  run(fx->name, "print_svg cached", op_print_svg_cold);
+  run(fx->name, "print_m1_chip_svg", op_print_m1_chip_svg);
+  bench_compile = 1;
+  run(fx->name, "print_m1_chip_svg compile", op_print_m1_chip_svg_cold);
+  bench_compile = 0;
+  run(fx->name, "print_m1_chip_svg cached", op_print_m1_chip_svg_cold);
+}
+
+static void cleanup(void) {
+  char cmd[sizeof(bench_dir) + 16];
+  snprintf(cmd, sizeof(cmd), "rm -rf '%s'", bench_dir);
+  (void)!system(cmd);
+}
+
+int main(int argc, char **argv) {
+  if (!mkdtemp(bench_dir))
+    puts("Failed to create the fixture directory."), exit(1);
+  atexit(cleanup);
+  snprintf(tmp_svg, sizeof(tmp_svg), "%s/out.svg", bench_dir);
+  snprintf(bars_svgt, sizeof(bars_svgt), "%s/bars.svgt", bench_dir);
+  snprintf(m1_svgt, sizeof(m1_svgt), "%s/m1.svgt", bench_dir);
+
+  struct fixture fx;
+
+  // Host: two /proc/stat samples 100ms apart and /proc/meminfo.
+  char host_meminfo[sizeof(bench_dir) + 16];
+  snprintf(host_meminfo, sizeof(host_meminfo), "%s/meminfo", bench_dir);
+  snprintf(fx.name, sizeof(fx.name), "host");
+  snprintf(fx.stat_prev, sizeof(fx.stat_prev), "%s/stat.prev", bench_dir);
+  snprintf(fx.stat, sizeof(fx.stat), "%s/stat", bench_dir);
+  snprintf(fx.meminfo, sizeof(fx.meminfo), "%s", host_meminfo);
+  if (record_file("/proc/stat", fx.stat_prev) ||
+      record_file("/proc/meminfo", fx.meminfo))
+    puts("Failed to record the host fixture."), exit(1);
+  usleep(100000);
+  if (record_file("/proc/stat", fx.stat))
+    puts("Failed to record the host fixture."), exit(1);
+
+  printf("%-12s %-28s %18s %16s\n", "fixture", "benchmark", "time", "bytes");
+  if (procscan_init(&procs, proc_root()) == 0) {
+    // Read every process twice first, so all have a delta and an open
+    // stat file and only the busy ones stay in the hot set.
+    procscan_sample(&procs, monotonic_ns());
+    for (size_t i = 0; i < 2 * procs.num_procs / PROCSCAN_BUDGET + 2; i++)
+      procscan_sample(&procs, monotonic_ns());
+    run("procfs", "procscan_sample", op_procscan_sample);
+    procscan_free(&procs);
+  }
+  char cgroup_root[sizeof(bench_dir) + 16];
+  write_synthetic_cgroups(cgroup_root, sizeof(cgroup_root));
+  if (cgscan_init(&cgs, cgroup_root, CGSCAN_DEFAULT_DEPTH, 16384) == 0) {
+    // Walk the tree and read every cgroup twice first, as for processes.
+    for (size_t i = 0; i < 2 * 3000 / CGSCAN_BUDGET + 4; i++)
+      cgscan_sample(&cgs, monotonic_ns());
+    run("synth-cg", "cgscan_sample", op_cgscan_sample);
+    cgscan_free(&cgs);
+  }
+  write_synthetic_io();
+  run("synth-io", "diskstats + net/dev parse", op_iostat_parse);
+  run_fixture(&fx);
+
+  // Recorded elsewhere.
+  for (int i = 1; i < argc; i++) {
+    const char *base = strrchr(argv[i], '/');
+    snprintf(fx.name, sizeof(fx.name), "%s", base && base[1] ? base + 1 : argv[i]);
+    snprintf(fx.stat, sizeof(fx.stat), "%s/stat", argv[i]);
+    snprintf(fx.meminfo, sizeof(fx.meminfo), "%s/meminfo", argv[i]);
+    snprintf(fx.stat_prev, sizeof(fx.stat_prev), "%s/stat.prev", argv[i]);
+    if (!file_exists(fx.stat_prev))
+      snprintf(fx.stat_prev, sizeof(fx.stat_prev), "%s", fx.stat);
+    if (!file_exists(fx.stat) || !file_exists(fx.meminfo))
+      printf("Missing %s/stat or %s/meminfo.\n", argv[i], argv[i]), exit(1);
+    run_fixture(&fx);
+  }
+
+  // Synthetic many-core hosts, with the host's meminfo.
+  static const size_t sizes[] = {8, 64, 256, 1024};
+  for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+    snprintf(fx.name, sizeof(fx.name), "synth-%zu", sizes[i]);
+    snprintf(fx.stat_prev, sizeof(fx.stat_prev), "%s/stat.%zu.prev", bench_dir, sizes[i]);
+    snprintf(fx.stat, sizeof(fx.stat), "%s/stat.%zu", bench_dir, sizes[i]);
+    snprintf(fx.meminfo, sizeof(fx.meminfo), "%s", host_meminfo);
+    write_synthetic_stat(fx.stat_prev, sizes[i], 0);
+    write_synthetic_stat(fx.stat, sizes[i], 100);
+    run_fixture(&fx);
+  }
+
+  free(bench_buf);
+  free(utilization);
+  cpustat_free(&info.cpu_info);
+  cpustat_free(&bench_prev);
+  cpustat_free(&bench_parsed);
+  procfs_buf_free(&stat_buf);
+  procfs_buf_free(&meminfo_buf);
+  free(bench_diskstats);
+  free(bench_netdev);
+  return 0;
+}
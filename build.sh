@@ -33,6 +33,15 @@ elif [ "$1" = "cuda" ]; then
     cc sys-genmon.c -o $OUTPUT_FILE $FEATURE_FLAGS $LIB_FLAGS $WARNING_FLAGS $PERF_FLAGS
     exit 0
 
+elif [ "$1" = "bench" ]; then
+    # Collector and formatter micro-benchmarks, see bench.c.
+    # Extra arguments are directories of recorded fixtures.
+    echo "Built the benchmarks."
+    shift
+    cc bench.c -o sys-genmon-bench $FEATURE_FLAGS $LIB_FLAGS $WARNING_FLAGS $PERF_FLAGS || exit 1
+    ./sys-genmon-bench "$@"
+    exit $?
+
 else
     echo "Built in release mode."
     cc sys-genmon.c -o $OUTPUT_FILE $FEATURE_FLAGS $LIB_FLAGS $WARNING_FLAGS $PERF_FLAGS
@@ -0,0 +1,129 @@
+// Microbursts: per-core peak, p95 and time above a threshold between
+// display updates. Shared by sys-genmon and the Raccoon Monitor plugin.
+//
+// The display averages each core over its whole interval, so 200 ms at
+// 100% in a 2 s interval shows as 10%. Here /proc/stat is also sampled at
+// 10-100 Hz (one pread, the vectorized utilization kernel); every
+// sub-sample goes into a per-core histogram of whole percents. Taking the
+// window reads out the maximum, the 95th percentile and how long the core
+// spent at or above the threshold, then starts a new window. Memory is
+// fixed at setup; sub-samples allocate nothing.
+
+#ifndef BURST_H
+#define BURST_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cpustat.h"
+#include "procfs.h"
+
+#define BURST_BINS 101 // Whole percents 0-100
+#define BURST_DEFAULT_THRESHOLD 90.0f
+
+struct burst {
+  struct cpu_record prev, cur; // Last two sub-samples
+  float *util;                 // Per core, the last sub-sample
+  uint16_t *hist;              // Per core, BURST_BINS sub-sample counts
+  float *max;
+  uint64_t *above_ns;
+  uint32_t samples;            // In this window
+  uint64_t last_ns;            // Time of prev, 0 before the first
+  float threshold;
+  size_t capacity;
+  const struct cpustat_mask *mask; // Cores to sample, NULL for all
+};
+
+// Results of one window, per core.
+struct burst_stats {
+  uint32_t *max;      // Percent
+  uint32_t *p95;      // Percent
+  uint32_t *above_ms; // Time at or above the threshold
+};
+
+static inline void burst_free(struct burst *b) {
+  cpustat_free(&b->prev);
+  cpustat_free(&b->cur);
+  free(b->util);
+  free(b->hist);
+  free(b->max);
+  free(b->above_ns);
+  memset(b, 0, sizeof(*b));
+}
+
+// Returns 0, or -1 if out of memory.
+static inline int burst_init(struct burst *b, size_t capacity, float threshold) {
+  memset(b, 0, sizeof(*b));
+  b->capacity = capacity;
+  b->threshold = threshold;
+  b->util = calloc(capacity, sizeof(*b->util));
+  b->hist = calloc(capacity * BURST_BINS, sizeof(*b->hist));
+  b->max = calloc(capacity, sizeof(*b->max));
+  b->above_ns = calloc(capacity, sizeof(*b->above_ns));
+  if (cpustat_alloc(&b->prev, capacity) || cpustat_alloc(&b->cur, capacity) ||
+      !b->util || !b->hist || !b->max || !b->above_ns) {
+    burst_free(b);
+    return -1;
+  }
+  return 0;
+}
+
+// Take one sub-sample at now_ns. A change in the set of cores (hotplug, a
+// new cpuset) restarts from this sample.
+static inline void burst_sample(struct burst *b, struct procfs_file *stat_file,
+                                struct procfs_buf *stat_buf, uint64_t now_ns) {
+  ssize_t len = procfs_read(stat_file, stat_buf);
+  if (len <= 0 || cpustat_parse_mask(&b->cur, stat_buf->data, len, b->mask) != 0)
+    return;
+
+  if (b->last_ns && b->prev.num_cpus == b->cur.num_cpus &&
+      !memcmp(b->prev.id, b->cur.id, b->cur.num_cpus * sizeof(*b->cur.id))) {
+    size_t n = b->cur.num_cpus;
+    uint64_t dt = now_ns - b->last_ns;
+    cpustat_utilization(&b->prev, &b->cur, b->util);
+    for (size_t i = 0; i < n; i++) {
+      float u = b->util[i];
+      int bin = u <= 0 ? 0 : u >= 100 ? 100 : (int)(u + 0.5f);
+      uint16_t *count = &b->hist[i * BURST_BINS + bin];
+      *count += *count < UINT16_MAX;
+      b->max[i] = u > b->max[i] ? u : b->max[i];
+      b->above_ns[i] += u >= b->threshold ? dt : 0;
+    }
+    b->samples++;
+  }
+
+  struct cpu_record swap = b->prev;
+  b->prev = b->cur;
+  b->cur = swap;
+  b->last_ns = now_ns;
+}
+
+// Read out the window into out (n cores) and start a new one. Returns the
+// number of sub-samples it held; with none, out is left alone.
+static inline uint32_t burst_take(struct burst *b, struct burst_stats *out,
+                                  size_t n) {
+  uint32_t samples = b->samples;
+  n = n < b->capacity ? n : b->capacity;
+  for (size_t i = 0; samples && i < n; i++) {
+    const uint16_t *hist = &b->hist[i * BURST_BINS];
+    uint32_t total = 0, below = 0;
+    for (int k = 0; k < BURST_BINS; k++)
+      total += hist[k];
+    uint32_t rank = total - total / 20; // 95% of sub-samples at or below
+    int k = 0;
+    while (k < BURST_BINS - 1 && (below += hist[k]) < rank)
+      k++;
+    out->max[i] = (uint32_t)(b->max[i] + 0.5f);
+    out->p95[i] = (uint32_t)k;
+    out->above_ms[i] = (uint32_t)(b->above_ns[i] / 1000000);
+  }
+
+  memset(b->hist, 0, b->capacity * BURST_BINS * sizeof(*b->hist));
+  memset(b->max, 0, b->capacity * sizeof(*b->max));
+  memset(b->above_ns, 0, b->capacity * sizeof(*b->above_ns));
+  b->samples = 0;
+  return samples;
+}
+
+#endif // BURST_H
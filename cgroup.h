@@ -0,0 +1,235 @@
+// Our own cgroup v2: the CPU quota and memory limit it runs under, its
+// usage against them, and the cores it may run on. Used by sys-genmon
+// (--cgroup).
+//
+// In a container or systemd slice the host-wide /proc/stat and
+// /proc/meminfo say little: the bars can read 5% while the cgroup is being
+// throttled at its cpu.max quota. cpu.stat gives the cgroup's usage and
+// throttling as counters (microseconds), kept in a caller-provided
+// baseline like the PSI totals; memory.current and memory.stat are read
+// as they are. The cores come back as a cpustat_mask, so /proc/stat lines
+// of the others aren't parsed at all.
+
+#ifndef CGROUP_H
+#define CGROUP_H
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "cpustat.h"
+#include "procfs.h"
+#include "psi.h"
+#include "tokenize.h"
+
+enum cgroup_file {
+  CGROUP_CPU_MAX,
+  CGROUP_CPU_STAT,
+  CGROUP_MEM_CURRENT,
+  CGROUP_MEM_MAX,
+  CGROUP_MEM_STAT,
+  CGROUP_CPUSET,
+  CGROUP_FILES
+};
+
+static const char *const cgroup_files[CGROUP_FILES] = {
+    "cpu.max",    "cpu.stat",    "memory.current",
+    "memory.max", "memory.stat", "cpuset.cpus.effective"};
+
+struct cgroup_reader {
+  struct procfs_file file[CGROUP_FILES];
+  char path[CGROUP_FILES][PSI_PATH_MAX];
+  struct procfs_buf buf;
+};
+
+// Counters of the previous read, 0 before the first.
+struct cgroup_baseline {
+  uint64_t ns;
+  uint64_t usage_us, nr_throttled, throttled_us;
+};
+
+struct cgroup_record {
+  uint8_t have_cpu, have_mem; // Whether the controller's files could be read
+  uint8_t quota;              // Whether cpu.max sets one
+  float limit_cpus;    // Quota over period, capped at the cores we may use
+  float cpu_percent;   // Usage over the last interval, of limit_cpus
+  uint32_t throttled;  // Periods throttled in the last interval
+  float throttled_ms;  // Time throttled in the last interval
+  uint64_t mem_current, mem_max; // Bytes; mem_max 0 if unlimited
+  uint64_t mem_anon, mem_file;
+};
+
+// proc and sys_cgroup are the procfs and cgroup2 mounts. Returns -1 in the
+// root cgroup or on cgroup v1, where there is nothing of our own to read.
+static inline int cgroup_init(struct cgroup_reader *r, const char *proc,
+                              const char *sys_cgroup) {
+  memset(r, 0, sizeof(*r));
+  char dir[PSI_PATH_MAX - 32];
+  psi_cgroup_dir(proc, sys_cgroup, dir, sizeof(dir));
+  for (int k = 0; k < CGROUP_FILES; k++) {
+    if (*dir)
+      snprintf(r->path[k], PSI_PATH_MAX, "%s/%s", dir, cgroup_files[k]);
+    r->file[k] = (struct procfs_file)PROCFS_FILE(r->path[k]);
+  }
+  return *dir ? 0 : -1;
+}
+
+static inline void cgroup_free(struct cgroup_reader *r) {
+  for (int k = 0; k < CGROUP_FILES; k++)
+    procfs_close(&r->file[k]);
+  procfs_buf_free(&r->buf);
+}
+
+static inline ssize_t cgroup_read(struct cgroup_reader *r, enum cgroup_file k) {
+  return *r->path[k] ? procfs_read(&r->file[k], &r->buf) : -1;
+}
+
+// Values of the "key value" lines of a flat-keyed file (cpu.stat,
+// memory.stat) named in keys; the others are left alone.
+static inline void cgroup_keyed(const char *p, const char *end,
+                                const char *const *keys, uint64_t *out,
+                                int n) {
+  while (p < end) {
+    const char *sp = tok_find(p, end, ' ');
+    for (int k = 0; k < n; k++) {
+      size_t len = strlen(keys[k]);
+      if ((size_t)(sp - p) == len && !memcmp(p, keys[k], len)) {
+        const char *v = sp + 1;
+        int err = 0;
+        out[k] = tok_u64(&v, end, &err);
+        break;
+      }
+    }
+    p = tok_next_line(sp, end);
+  }
+}
+
+// A single value, or "max". Returns 1 if it was a number.
+static inline int cgroup_limit(const char *p, const char *end, uint64_t *v) {
+  int err = 0;
+  *v = tok_u64(&p, end, &err);
+  return !err;
+}
+
+// Set the ids of a cpu list ("0-3,8-11") in bits, up to num_ids.
+static inline void cgroup_cpulist(const char *p, const char *end,
+                                  uint64_t *bits, size_t num_ids) {
+  while (p < end && *p >= '0' && *p <= '9') {
+    int err = 0;
+    uint64_t lo = tok_u64(&p, end, &err), hi = lo;
+    if (p < end && *p == '-') {
+      p++;
+      hi = tok_u64(&p, end, &err);
+    }
+    for (uint64_t id = lo; id <= hi && id < num_ids; id++)
+      bits[id / 64] |= 1ull << (id % 64);
+    if (err || p >= end || *p != ',')
+      break;
+    p++;
+  }
+}
+
+// The cores we may run on: our affinity, narrowed by cpuset.cpus.effective
+// when the cpuset controller is on. The raw syscall fills a bitmap of longs,
+// which on little-endian hosts is the same bytes as one of uint64_t.
+// Returns 0, or -1 if the mask couldn't be had.
+static inline int cgroup_cpu_mask(struct cgroup_reader *r,
+                                  struct cpustat_mask *m) {
+  size_t bytes = 128;
+  for (;;) {
+    uint64_t *bits = calloc(1, bytes);
+    if (!bits)
+      return -1;
+    long got = syscall(SYS_sched_getaffinity, 0, bytes, bits);
+    if (got > 0) {
+      free(m->bits);
+      m->bits = bits;
+      m->num_ids = (size_t)got * 8;
+      break;
+    }
+    free(bits);
+    if (errno != EINVAL || bytes >= 1 << 20)
+      return -1;
+    bytes *= 2; // The kernel has more ids than fit
+  }
+
+  ssize_t len = cgroup_read(r, CGROUP_CPUSET);
+  if (len > 0) {
+    size_t words = (m->num_ids + 63) / 64;
+    uint64_t *cpuset = calloc(words, sizeof(*cpuset));
+    if (!cpuset)
+      return -1;
+    cgroup_cpulist(r->buf.data, r->buf.data + len, cpuset, m->num_ids);
+    for (size_t w = 0; w < words; w++)
+      m->bits[w] &= cpuset[w];
+    free(cpuset);
+  }
+  return 0;
+}
+
+// Read the CPU and memory files into out, computing the usage of the
+// num_cpus cores we may use against base and then making this read the
+// new base.
+static inline void cgroup_sample(struct cgroup_reader *r,
+                                 struct cgroup_baseline *base,
+                                 struct cgroup_record *out, size_t num_cpus,
+                                 uint64_t now_ns) {
+  memset(out, 0, sizeof(*out));
+  out->limit_cpus = num_cpus;
+
+  ssize_t len = cgroup_read(r, CGROUP_CPU_MAX);
+  uint64_t quota, period;
+  if (len > 0 && cgroup_limit(r->buf.data, r->buf.data + len, &quota)) {
+    const char *p = tok_skip_blanks(tok_find(r->buf.data, r->buf.data + len, ' '),
+                                    r->buf.data + len);
+    int err = 0;
+    period = tok_u64(&p, r->buf.data + len, &err);
+    if (!err && period && (float)quota / period < num_cpus) {
+      out->quota = 1;
+      out->limit_cpus = (float)quota / period;
+    }
+  }
+
+  static const char *const cpu_keys[] = {"usage_usec", "nr_throttled",
+                                         "throttled_usec"};
+  uint64_t cpu[3] = {0};
+  len = cgroup_read(r, CGROUP_CPU_STAT);
+  if (len > 0) {
+    cgroup_keyed(r->buf.data, r->buf.data + len, cpu_keys, cpu, 3);
+    uint64_t dt = base->ns && now_ns > base->ns ? now_ns - base->ns : 0;
+    if (dt && cpu[0] >= base->usage_us && out->limit_cpus > 0) {
+      float busy = (cpu[0] - base->usage_us) * 1000.0f / dt;
+      out->cpu_percent = busy / out->limit_cpus * 100.0f;
+    }
+    if (base->ns && cpu[1] >= base->nr_throttled && cpu[2] >= base->throttled_us) {
+      out->throttled = (uint32_t)(cpu[1] - base->nr_throttled);
+      out->throttled_ms = (cpu[2] - base->throttled_us) / 1000.0f;
+    }
+    out->have_cpu = 1;
+    base->usage_us = cpu[0];
+    base->nr_throttled = cpu[1];
+    base->throttled_us = cpu[2];
+    base->ns = now_ns;
+  }
+
+  len = cgroup_read(r, CGROUP_MEM_CURRENT);
+  if (len > 0 && cgroup_limit(r->buf.data, r->buf.data + len, &out->mem_current)) {
+    out->have_mem = 1;
+    len = cgroup_read(r, CGROUP_MEM_MAX);
+    if (len <= 0 || !cgroup_limit(r->buf.data, r->buf.data + len, &out->mem_max))
+      out->mem_max = 0;
+    static const char *const mem_keys[] = {"anon", "file"};
+    uint64_t mem[2] = {0};
+    len = cgroup_read(r, CGROUP_MEM_STAT);
+    if (len > 0)
+      cgroup_keyed(r->buf.data, r->buf.data + len, mem_keys, mem, 2);
+    out->mem_anon = mem[0];
+    out->mem_file = mem[1];
+  }
+}
+
+#endif // CGROUP_H
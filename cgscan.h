@@ -0,0 +1,438 @@
+// Top cgroups by CPU and memory, from a walk of the cgroup v2 tree.
+// Used by sys-genmon.
+//
+// On shared hosts the question is which service is hot, and systemd alone
+// can leave thousands of scopes, so the walker is incremental like the
+// process scanner:
+//  - A path-sorted table holds every cgroup down to the configured depth,
+//    with its directory open. Only cpu.stat and memory.current are read,
+//    each opened once (openat on the directory) and re-read with pread,
+//    while there are fds to spare.
+//  - Creating or removing a child cgroup updates its parent's mtime, so a
+//    sample fstats the directories that can have children and lists only
+//    those whose mtime moved. A cgroup whose files stop reading is gone.
+//  - A sample fstats at most CGSCAN_DIRS directories and reads at most
+//    CGSCAN_BUDGET cgroups: new ones and ones that used CPU last time
+//    first, then the idle rest round-robin.
+// Parents count their children's usage, so only the leaves of the walk
+// are ranked. root is the cgroup2 mount, so a fake tree can stand in.
+
+#ifndef CGSCAN_H
+#define CGSCAN_H
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "tokenize.h"
+
+#define CGSCAN_BUDGET 128 // cgroups read per sample
+#define CGSCAN_DIRS 64    // Directories checked for new children per sample
+#define CGSCAN_TOP 5
+#define CGSCAN_DEFAULT_DEPTH 2
+#define CGSCAN_MAX_DEPTH 8
+#define CGSCAN_PATH_LEN 256
+#define CGSCAN_NAME_LEN 40
+
+struct cg_entry {
+  int dir_fd;             // Open on the directory
+  int stat_fd, mem_fd;    // cpu.stat and memory.current, or -1
+  uint64_t mtime_ns;      // Directory mtime at the last listing, 0 before
+  uint64_t usage_us;      // cpu.stat usage_usec at the last read
+  uint64_t read_ns;       // Time of the last read, 0 before the first
+  uint64_t mem;           // memory.current, bytes
+  float cpu;              // Percent of one CPU over the last read's interval
+  uint32_t read_seq;      // Sample that last read it
+  uint8_t depth;          // 0 for the root
+  uint8_t leaf;           // At the depth limit, or had no children listed
+  uint8_t hot;            // Used CPU last time, or has no delta yet
+  uint8_t gone;           // Unreadable; dropped at the start of the next sample
+  char path[CGSCAN_PATH_LEN]; // Relative to the root, "" for the root
+};
+
+struct top_cgroup {
+  float cpu;
+  uint64_t mem;
+  char name[CGSCAN_NAME_LEN]; // The end of the path if it is longer
+};
+
+struct cgroup_scanner {
+  int root_fd;
+  unsigned max_depth;
+  struct cg_entry *cgs;     // Sorted by path
+  size_t num_cgs, cap;
+  size_t num_gone;
+  size_t open_fds, max_fds;
+  size_t dir_cursor, cursor; // Where the round-robins resume
+  uint32_t seq;
+};
+
+// root must be a cgroup2 mount (it has cgroup.controllers); max_fds bounds
+// the files kept open. Returns 0, or -1.
+static inline int cgscan_init(struct cgroup_scanner *s, const char *root,
+                              unsigned max_depth, size_t max_fds) {
+  memset(s, 0, sizeof(*s));
+  s->root_fd = open(root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (s->root_fd < 0 || faccessat(s->root_fd, "cgroup.controllers", F_OK, 0)) {
+    if (s->root_fd >= 0)
+      close(s->root_fd);
+    s->root_fd = -1;
+    return -1;
+  }
+  s->max_depth = max_depth < CGSCAN_MAX_DEPTH ? max_depth : CGSCAN_MAX_DEPTH;
+  s->max_fds = max_fds;
+  s->cgs = calloc(1, sizeof(*s->cgs));
+  if (!s->cgs) {
+    close(s->root_fd);
+    s->root_fd = -1;
+    return -1;
+  }
+  s->cap = s->num_cgs = 1;
+  s->cgs[0] = (struct cg_entry){.dir_fd = -1, .stat_fd = -1, .mem_fd = -1,
+                                .leaf = !s->max_depth};
+  return 0;
+}
+
+static inline void cgscan_close(struct cgroup_scanner *s, int *fd) {
+  if (*fd >= 0) {
+    close(*fd);
+    s->open_fds--;
+  }
+  *fd = -1;
+}
+
+static inline void cgscan_drop(struct cgroup_scanner *s, struct cg_entry *c) {
+  cgscan_close(s, &c->dir_fd);
+  cgscan_close(s, &c->stat_fd);
+  cgscan_close(s, &c->mem_fd);
+}
+
+static inline void cgscan_free(struct cgroup_scanner *s) {
+  for (size_t i = 0; i < s->num_cgs; i++)
+    cgscan_drop(s, &s->cgs[i]);
+  free(s->cgs);
+  if (s->root_fd >= 0)
+    close(s->root_fd);
+  memset(s, 0, sizeof(*s));
+  s->root_fd = -1;
+}
+
+// Paths compared a component at a time: '/' sorts before any other byte, so
+// a cgroup's descendants follow it with no sibling ("foo-bar" after
+// "foo/child") in between.
+static inline int cgscan_strcmp(const char *a, const char *b) {
+  while (*a && *a == *b)
+    a++, b++;
+  int x = *a == '/' ? 1 : *a ? (unsigned char)*a + 2 : 0;
+  int y = *b == '/' ? 1 : *b ? (unsigned char)*b + 2 : 0;
+  return x - y;
+}
+
+static inline int cgscan_cmp_path(const void *a, const void *b) {
+  return cgscan_strcmp(((const struct cg_entry *)a)->path,
+                       ((const struct cg_entry *)b)->path);
+}
+
+static inline int cgscan_grow(struct cgroup_scanner *s, size_t n) {
+  if (n <= s->cap)
+    return 0;
+  size_t cap = s->cap > 64 ? s->cap : 64;
+  while (cap < n)
+    cap *= 2;
+  struct cg_entry *grown = realloc(s->cgs, cap * sizeof(*grown));
+  if (!grown)
+    return -1;
+  s->cgs = grown;
+  s->cap = cap;
+  return 0;
+}
+
+// The directory of c, opened on first use; kept open while fds allow.
+// The root's is root_fd itself.
+static inline int cgscan_dir(struct cgroup_scanner *s, struct cg_entry *c) {
+  if (!c->depth)
+    return s->root_fd;
+  if (c->dir_fd >= 0)
+    return c->dir_fd;
+  int fd = openat(s->root_fd, c->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd >= 0 && s->open_fds < s->max_fds) {
+    c->dir_fd = fd;
+    s->open_fds++;
+  }
+  return fd;
+}
+
+static inline void cgscan_done(struct cg_entry *c, int fd) {
+  if (fd >= 0 && fd != c->dir_fd && c->depth)
+    close(fd);
+}
+
+// Drop the entries that went away since the last sample.
+static inline void cgscan_compact(struct cgroup_scanner *s) {
+  if (!s->num_gone)
+    return;
+  size_t kept = 0;
+  for (size_t i = 0; i < s->num_cgs; i++) {
+    if (s->cgs[i].gone)
+      cgscan_drop(s, &s->cgs[i]);
+    else
+      s->cgs[kept++] = s->cgs[i];
+  }
+  s->num_cgs = kept;
+  s->num_gone = 0;
+}
+
+// Index of the entry for path among the first n, which are sorted, or n.
+static inline size_t cgscan_find(const struct cgroup_scanner *s,
+                                 const char *path, size_t n) {
+  size_t lo = 0, hi = n;
+  while (lo < hi) {
+    size_t mid = (lo + hi) / 2;
+    int cmp = cgscan_strcmp(s->cgs[mid].path, path);
+    if (!cmp)
+      return mid;
+    if (cmp < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return n;
+}
+
+// Re-list entry i's directory: add the child cgroups not in the table and
+// mark the ones no longer there gone. Returns 0, or -1 if it couldn't be
+// listed (the entry is marked gone unless it is the root). The first
+// sorted entries are in path order; new ones are appended after them and
+// the caller sorts.
+static inline int cgscan_list(struct cgroup_scanner *s, size_t i,
+                              uint64_t mtime_ns, size_t sorted) {
+  struct cg_entry *c = &s->cgs[i];
+  int fd = cgscan_dir(s, c);
+  int list_fd = fd >= 0 ? openat(fd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC) : -1;
+  cgscan_done(c, fd);
+  DIR *dir = list_fd >= 0 ? fdopendir(list_fd) : NULL;
+  if (!dir) {
+    if (list_fd >= 0)
+      close(list_fd);
+    if (c->depth && !c->gone)
+      c->gone = 1, s->num_gone++;
+    return -1;
+  }
+
+  // The children are contiguous after the parent in path order; mark them
+  // all, then clear the mark of each one listed.
+  char prefix[CGSCAN_PATH_LEN];
+  int prefix_len = snprintf(prefix, sizeof(prefix), "%s%s", c->path,
+                            c->depth ? "/" : "");
+  uint8_t depth = c->depth + 1;
+  for (size_t j = i + 1; j < sorted &&
+                         !strncmp(s->cgs[j].path, prefix, prefix_len); j++)
+    if (s->cgs[j].depth == depth && !s->cgs[j].gone)
+      s->cgs[j].gone = 2; // Not listed (yet)
+
+  int children = 0;
+  struct dirent *de;
+  while ((de = readdir(dir))) {
+    if (de->d_type != DT_DIR || de->d_name[0] == '.')
+      continue;
+    char path[CGSCAN_PATH_LEN];
+    if (snprintf(path, sizeof(path), "%s%s", prefix, de->d_name) >=
+        (int)sizeof(path))
+      continue;
+    children = 1;
+    size_t k = cgscan_find(s, path, sorted);
+    if (k < sorted && s->cgs[k].gone != 1) {
+      s->cgs[k].gone = 0;
+      continue;
+    }
+    if (k < sorted) {
+      // Removed and made again under the same name: start over.
+      struct cg_entry *old = &s->cgs[k];
+      cgscan_drop(s, old);
+      *old = (struct cg_entry){.dir_fd = -1, .stat_fd = -1, .mem_fd = -1,
+                               .depth = depth, .leaf = depth >= s->max_depth,
+                               .hot = 1};
+      memcpy(old->path, path, sizeof(path));
+      s->num_gone--;
+      continue;
+    }
+    if (cgscan_grow(s, s->num_cgs + 1))
+      break;
+    struct cg_entry *n = &s->cgs[s->num_cgs++];
+    *n = (struct cg_entry){.dir_fd = -1, .stat_fd = -1, .mem_fd = -1,
+                           .depth = depth, .leaf = depth >= s->max_depth,
+                           .hot = 1};
+    memcpy(n->path, path, sizeof(path));
+  }
+  closedir(dir);
+
+  c = &s->cgs[i];
+  for (size_t j = i + 1; j < sorted &&
+                         !strncmp(s->cgs[j].path, prefix, prefix_len); j++)
+    if (s->cgs[j].gone == 2)
+      s->cgs[j].gone = 1, s->num_gone++;
+  c->leaf = !children;
+  c->mtime_ns = mtime_ns;
+  return 0;
+}
+
+// Check up to CGSCAN_DIRS directories that can have children, round-robin,
+// and re-list those whose mtime moved.
+static inline void cgscan_walk(struct cgroup_scanner *s) {
+  size_t old = s->num_cgs, budget = CGSCAN_DIRS;
+  size_t start = s->dir_cursor < old ? s->dir_cursor : 0;
+  for (size_t k = 0; k < old && budget; k++) {
+    size_t i = (start + k) % old;
+    struct cg_entry *c = &s->cgs[i];
+    if (c->depth >= s->max_depth || c->gone)
+      continue;
+    budget--;
+    struct stat st;
+    int fd = cgscan_dir(s, c);
+    int ok = fd >= 0 && fstat(fd, &st) == 0;
+    cgscan_done(c, fd);
+    if (!ok) {
+      if (c->depth && !c->gone)
+        c->gone = 1, s->num_gone++;
+      continue;
+    }
+    uint64_t mtime_ns = st.st_mtim.tv_sec * 1000000000ull + st.st_mtim.tv_nsec;
+    if (mtime_ns != c->mtime_ns)
+      cgscan_list(s, i, mtime_ns, old);
+    s->dir_cursor = i + 1;
+  }
+  if (s->num_cgs != old)
+    qsort(s->cgs, s->num_cgs, sizeof(*s->cgs), cgscan_cmp_path);
+}
+
+// pread a small file of c's through *fd, opening it on first use.
+// Returns the length, or -1.
+static inline ssize_t cgscan_pread(struct cgroup_scanner *s,
+                                   struct cg_entry *c, int *fd,
+                                   const char *name, char *buf, size_t n) {
+  int f = *fd;
+  if (f < 0) {
+    int dir = cgscan_dir(s, c);
+    f = dir >= 0 ? openat(dir, name, O_RDONLY | O_CLOEXEC) : -1;
+    cgscan_done(c, dir);
+    if (f < 0)
+      return -1;
+    if (s->open_fds < s->max_fds) {
+      *fd = f;
+      s->open_fds++;
+    }
+  }
+  ssize_t len = pread(f, buf, n - 1, 0);
+  if (f != *fd)
+    close(f);
+  if (len >= 0)
+    buf[len] = '\0';
+  return len;
+}
+
+// Read one cgroup's usage. Returns 0, or -1 if it went away.
+static inline int cgscan_read(struct cgroup_scanner *s, struct cg_entry *c,
+                              uint64_t now_ns) {
+  char buf[512];
+  ssize_t len = cgscan_pread(s, c, &c->stat_fd, "cpu.stat", buf, sizeof(buf));
+  if (len <= 0 || strncmp(buf, "usage_usec ", 11))
+    return -1;
+  const char *p = buf + 11;
+  int err = 0;
+  uint64_t usage_us = tok_u64(&p, buf + len, &err);
+
+  if (c->read_ns && now_ns > c->read_ns && usage_us >= c->usage_us) {
+    c->cpu = (usage_us - c->usage_us) * 1000.0f / (now_ns - c->read_ns) * 100.0f;
+    c->hot = usage_us != c->usage_us;
+  } else {
+    c->cpu = 0;
+    c->hot = 1; // Read again next time to get a delta
+  }
+  c->usage_us = usage_us;
+  c->read_ns = now_ns;
+  c->read_seq = s->seq;
+
+  // Without the memory controller there is no memory.current.
+  len = cgscan_pread(s, c, &c->mem_fd, "memory.current", buf, sizeof(buf));
+  p = buf;
+  c->mem = len > 0 ? tok_u64(&p, buf + len, &err) : 0;
+  return 0;
+}
+
+// Refresh the table, reading at most CGSCAN_BUDGET cgroups.
+static inline void cgscan_sample(struct cgroup_scanner *s, uint64_t now_ns) {
+  if (s->root_fd < 0)
+    return;
+  cgscan_compact(s);
+  cgscan_walk(s);
+  s->seq++;
+  size_t budget = CGSCAN_BUDGET;
+
+  // The root's cpu.stat holds the whole machine; it isn't ranked.
+  for (size_t i = 1; i < s->num_cgs && budget; i++) {
+    struct cg_entry *c = &s->cgs[i];
+    if (c->hot && !c->gone) {
+      if (cgscan_read(s, c, now_ns))
+        c->gone = 1, s->num_gone++;
+      budget--;
+    }
+  }
+
+  // The rest, round-robin from where the last sample stopped.
+  if (s->num_cgs < 2)
+    return;
+  size_t n = s->num_cgs - 1, start = s->cursor;
+  for (size_t k = 0; k < n && budget; k++) {
+    size_t i = 1 + (start + k) % n;
+    struct cg_entry *c = &s->cgs[i];
+    if (c->read_seq == s->seq || c->gone)
+      continue;
+    if (cgscan_read(s, c, now_ns))
+      c->gone = 1, s->num_gone++;
+    s->cursor = i;
+    budget--;
+  }
+}
+
+// Insert c into top (sorted by key, at most CGSCAN_TOP) if it ranks.
+static inline void cgscan_rank(struct top_cgroup *top, size_t *n,
+                               const struct cg_entry *c, int by_mem) {
+  float key = by_mem ? (float)c->mem : c->cpu;
+  size_t at = *n;
+  while (at > 0 && key > (by_mem ? (float)top[at - 1].mem : top[at - 1].cpu))
+    at--;
+  if (at >= CGSCAN_TOP)
+    return;
+  size_t last = *n < CGSCAN_TOP ? *n : CGSCAN_TOP - 1;
+  memmove(&top[at + 1], &top[at], (last - at) * sizeof(*top));
+  top[at].cpu = c->cpu;
+  top[at].mem = c->mem;
+  size_t len = strlen(c->path), keep = CGSCAN_NAME_LEN - 1;
+  memcpy(top[at].name, c->path + (len > keep ? len - keep : 0),
+         (len > keep ? keep : len) + 1);
+  *n = last + 1;
+}
+
+// The busiest leaf cgroups by CPU (those that used any), and the largest
+// by memory.
+static inline void cgscan_top(const struct cgroup_scanner *s,
+                              struct top_cgroup *by_cpu, size_t *num_cpu,
+                              struct top_cgroup *by_mem, size_t *num_mem) {
+  *num_cpu = *num_mem = 0;
+  for (size_t i = 1; i < s->num_cgs; i++) {
+    const struct cg_entry *c = &s->cgs[i];
+    if (!c->leaf || !c->read_ns || c->gone)
+      continue;
+    if (c->cpu > 0)
+      cgscan_rank(by_cpu, num_cpu, c, 0);
+    if (c->mem)
+      cgscan_rank(by_mem, num_mem, c, 1);
+  }
+}
+
+#endif // CGSCAN_H
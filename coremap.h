@@ -0,0 +1,334 @@
+// Chip diagram layout: core tiers and clusters from sysfs, and the tile
+// rectangles they get on a panel of a given size.
+// Shared by sys-genmon (--arch-diagram) and the Raccoon Monitor plugin.
+//
+// Cores are classified once. Each gets a capacity from the first source
+// the kernel offers (Intel hybrid PMUs, cpu_capacity, acpi_cppc
+// highest_perf, cpuinfo_max_freq), and the capacities are split into tiers
+// wherever one drops by more than COREMAP_TIER_DROP percent from the next
+// bigger, so boost rankings of otherwise equal cores (preferred cores,
+// Turbo Boost Max) stay in one tier. Package and cluster come from
+// topology/. The layout gives every tier of a package a band, the biggest
+// cores on top and taller, and lines its clusters up side by side in the
+// band, wrapped into the row count that gives the largest tiles. It is
+// worked out once per panel size; each tick the renderers only fill the
+// rectangles.
+
+#ifndef COREMAP_H
+#define COREMAP_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "procfs.h"
+
+#define COREMAP_GAP 5        // Between tiles of few-core bands, in pixels
+#define COREMAP_TIER_DROP 15 // Percent below the next capacity up for a new tier
+#define COREMAP_UNKNOWN UINT32_MAX
+
+struct coremap_core {
+  uint32_t capacity;         // Relative; 0 if the kernel doesn't say
+  uint32_t package, cluster; // COREMAP_UNKNOWN if the kernel doesn't say
+  uint8_t tier;              // 0 for the biggest cores
+  char cls;                  // 'P', 'E', or 0 on a single-tier part
+  uint8_t pad[2];
+};
+
+struct coremap_tile {
+  uint16_t x, y, w, h;
+  uint32_t core; // Index into the cpu_record arrays
+  uint8_t tier;
+  char cls;
+  char label[12]; // "P0", "E3", or "C5" on a single-tier part
+};
+
+struct coremap_cluster {
+  uint32_t first, count; // Tiles
+  uint32_t band;
+};
+
+struct coremap {
+  struct coremap_tile *tile; // By package, tier, cluster, then core
+  size_t num_tiles;
+  struct coremap_cluster *cluster;
+  size_t num_clusters;
+  uint32_t num_bands;
+  uint8_t num_tiers;
+  size_t num_placed; // Tiles with rectangles: num_tiles, or 0 if none fit
+  uint32_t width, height, top, margin, min_px; // Panel laid out for
+};
+
+static inline void coremap_free(struct coremap *cm) {
+  free(cm->tile);
+  free(cm->cluster);
+  memset(cm, 0, sizeof(*cm));
+}
+
+// A sysfs value, COREMAP_UNKNOWN if unreadable.
+static inline uint32_t coremap_read(const char *sys, uint32_t id,
+                                    const char *file) {
+  char path[192], value[32];
+  snprintf(path, sizeof(path), "%s/devices/system/cpu/cpu%u/%s", sys, id, file);
+  struct procfs_file f = PROCFS_FILE(path);
+  ssize_t got = procfs_read_head(&f, value, sizeof(value));
+  procfs_close(&f);
+  if (got <= 0 || value[0] < '0' || value[0] > '9')
+    return COREMAP_UNKNOWN;
+  return (uint32_t)strtoul(value, NULL, 10);
+}
+
+// Give every core of a cpu list ("0-3,8-11") the capacity cap.
+static inline void coremap_mark_list(const char *s, const int32_t *index_of,
+                                     uint32_t max_id, struct coremap_core *out,
+                                     uint32_t cap) {
+  while (*s >= '0' && *s <= '9') {
+    char *end;
+    unsigned long lo = strtoul(s, &end, 10);
+    unsigned long hi = lo;
+    if (*end == '-')
+      hi = strtoul(end + 1, &end, 10);
+    for (unsigned long id = lo; id <= hi && id <= max_id; id++)
+      if (index_of[id] >= 0)
+        out[index_of[id]].capacity = cap;
+    s = *end == ',' ? end + 1 : end;
+  }
+}
+
+static inline int coremap_cmp_desc(const void *a, const void *b) {
+  uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+  return x < y ? 1 : x > y ? -1 : 0;
+}
+
+// Classify n cores, ids[i] being the N of "cpuN" (NULL: core i is cpuN i),
+// from the sysfs mounted at sys. Cores no source names stay in tier 0
+// without a class. Returns the tier count, or -1 if out of memory.
+static inline int coremap_probe(const char *sys, const uint32_t *ids,
+                                size_t n, struct coremap_core *out) {
+  uint32_t max_id = 0;
+  for (size_t i = 0; i < n; i++) {
+    uint32_t id = ids ? ids[i] : (uint32_t)i;
+    max_id = id > max_id ? id : max_id;
+    uint32_t package = coremap_read(sys, id, "topology/physical_package_id");
+    uint32_t cluster = coremap_read(sys, id, "topology/cluster_id");
+    out[i] = (struct coremap_core){.package = package, .cluster = cluster};
+  }
+  if (!n)
+    return 1;
+
+  // Intel hybrid parts list each core type under its PMU.
+  int32_t *index_of = malloc((max_id + 1) * sizeof(*index_of));
+  uint32_t *caps = malloc(n * sizeof(*caps));
+  if (!index_of || !caps) {
+    free(index_of);
+    free(caps);
+    return -1;
+  }
+  for (uint32_t id = 0; id <= max_id; id++)
+    index_of[id] = -1;
+  for (size_t i = 0; i < n; i++)
+    index_of[ids ? ids[i] : i] = (int32_t)i;
+  static const char *const pmus[2] = {"cpu_core", "cpu_atom"};
+  int found = 0;
+  for (int k = 0; k < 2; k++) {
+    char path[192], list[4096];
+    snprintf(path, sizeof(path), "%s/devices/%s/cpus", sys, pmus[k]);
+    struct procfs_file f = PROCFS_FILE(path);
+    if (procfs_read_head(&f, list, sizeof(list)) > 0) {
+      coremap_mark_list(list, index_of, max_id, out, 2 - k);
+      found = 1;
+    }
+    procfs_close(&f);
+  }
+  free(index_of);
+
+  // Otherwise the first per-core source that names any core.
+  static const char *const sources[3] = {
+      "cpu_capacity", "acpi_cppc/highest_perf", "cpufreq/cpuinfo_max_freq"};
+  for (int k = 0; k < 3 && !found; k++) {
+    for (size_t i = 0; i < n; i++) {
+      uint32_t cap = coremap_read(sys, ids ? ids[i] : (uint32_t)i, sources[k]);
+      out[i].capacity = cap == COREMAP_UNKNOWN ? 0 : cap;
+      found |= out[i].capacity != 0;
+    }
+  }
+
+  // Tiers: distinct capacities, biggest first, split at the drops.
+  size_t num_caps = 0;
+  for (size_t i = 0; i < n; i++)
+    if (out[i].capacity)
+      caps[num_caps++] = out[i].capacity;
+  qsort(caps, num_caps, sizeof(*caps), coremap_cmp_desc);
+  uint8_t *tier_of = calloc(num_caps ? num_caps : 1, 1);
+  if (!tier_of) {
+    free(caps);
+    return -1;
+  }
+  int num_tiers = 1;
+  for (size_t j = 1; j < num_caps; j++) {
+    uint64_t next = caps[j], prev = caps[j - 1];
+    if (next * 100 < prev * (100 - COREMAP_TIER_DROP) && num_tiers < 255)
+      num_tiers++;
+    tier_of[j] = (uint8_t)(num_tiers - 1);
+  }
+  for (size_t i = 0; i < n; i++) {
+    if (!out[i].capacity)
+      continue;
+    // The sorted list is short next to the sysfs reads; find by bisection.
+    size_t lo = 0, hi = num_caps;
+    while (lo + 1 < hi) {
+      size_t mid = (lo + hi) / 2;
+      if (caps[mid] < out[i].capacity)
+        hi = mid;
+      else
+        lo = mid;
+    }
+    out[i].tier = tier_of[lo];
+    if (num_tiers > 1)
+      out[i].cls = out[i].tier == num_tiers - 1 ? 'E' : 'P';
+  }
+  free(tier_of);
+  free(caps);
+  return num_tiers;
+}
+
+static inline int coremap_cmp_tile(const void *a, const void *b) {
+  const uint32_t *x = a, *y = b; // package, tier, cluster, core
+  for (int k = 0; k < 4; k++)
+    if (x[k] != y[k])
+      return x[k] < y[k] ? -1 : 1;
+  return 0;
+}
+
+// Order the n cores described by core[] into tiles grouped by cluster.
+// Any earlier layout is dropped. Returns 0, or -1 if out of memory.
+static inline int coremap_build(struct coremap *cm,
+                                const struct coremap_core *core, size_t n) {
+  coremap_free(cm);
+  uint32_t(*key)[4] = malloc((n ? n : 1) * sizeof(*key));
+  cm->tile = calloc(n ? n : 1, sizeof(*cm->tile));
+  cm->cluster = calloc(n ? n : 1, sizeof(*cm->cluster));
+  if (!key || !cm->tile || !cm->cluster) {
+    free(key);
+    coremap_free(cm);
+    return -1;
+  }
+  for (size_t i = 0; i < n; i++) {
+    key[i][0] = core[i].package;
+    key[i][1] = core[i].tier;
+    key[i][2] = core[i].cluster;
+    key[i][3] = (uint32_t)i;
+    cm->num_tiers = core[i].tier + 1u > cm->num_tiers ? core[i].tier + 1u
+                                                       : cm->num_tiers;
+  }
+  qsort(key, n, sizeof(*key), coremap_cmp_tile);
+
+  uint32_t count[256] = {0}; // Label numbers, by tier
+  for (size_t k = 0; k < n; k++) {
+    const struct coremap_core *c = &core[key[k][3]];
+    struct coremap_tile *t = &cm->tile[k];
+    t->core = key[k][3];
+    t->tier = c->tier;
+    t->cls = c->cls;
+    snprintf(t->label, sizeof(t->label), "%c%u", c->cls ? c->cls : 'C',
+             count[c->tier]++);
+
+    int new_band = !k || key[k][0] != key[k - 1][0] || key[k][1] != key[k - 1][1];
+    if (new_band || key[k][2] != key[k - 1][2]) {
+      cm->num_bands += new_band;
+      cm->cluster[cm->num_clusters++] =
+          (struct coremap_cluster){(uint32_t)k, 0, cm->num_bands - 1};
+    }
+    cm->cluster[cm->num_clusters - 1].count++;
+  }
+  cm->num_tiles = n;
+  free(key);
+  return 0;
+}
+
+// Lay the tiles out in a width x height panel below a header top pixels
+// tall, margin pixels from the edges and between bands. Bands are as tall
+// as their tier's weight: 3:2 for a big.LITTLE pair. Returns 0, or -1 if
+// some tile would be under min_px on a side; then none are placed. Asking
+// for the same panel again costs nothing.
+static inline int coremap_layout(struct coremap *cm, uint32_t width,
+                                 uint32_t height, uint32_t top,
+                                 uint32_t margin, uint32_t min_px) {
+  if (cm->width == width && cm->height == height && cm->top == top &&
+      cm->margin == margin && cm->min_px == min_px && width)
+    return cm->num_placed || !cm->num_tiles ? 0 : -1;
+  cm->width = width;
+  cm->height = height;
+  cm->top = top;
+  cm->margin = margin;
+  cm->min_px = min_px;
+  cm->num_placed = 0;
+  if (!cm->num_tiles)
+    return 0;
+  if (min_px < 1)
+    min_px = 1;
+
+  uint64_t weights = 0;
+  for (size_t c = 0; c < cm->num_clusters; c++)
+    if (!c || cm->cluster[c].band != cm->cluster[c - 1].band)
+      weights += cm->num_tiers - cm->tile[cm->cluster[c].first].tier + 1u;
+  int64_t avail = (int64_t)height - top - (int64_t)margin * (cm->num_bands + 1);
+  if (avail < (int64_t)min_px * cm->num_bands || width < 2 * margin + min_px)
+    return -1;
+
+  uint32_t y = top + margin;
+  for (size_t first = 0, last; first < cm->num_clusters; first = last) {
+    const struct coremap_cluster *cl = cm->cluster;
+    uint32_t n = 0;
+    for (last = first; last < cm->num_clusters && cl[last].band == cl[first].band; last++)
+      n += cl[last].count;
+    uint32_t weight = cm->num_tiers - cm->tile[cl[first].first].tier + 1u;
+    uint32_t band_h = (uint32_t)(avail * weight / weights);
+
+    // The row count giving the largest tiles, counting a tile as wide as
+    // twice its height: the diagram's tiles are landscape.
+    uint32_t best_rows = 0, best_w = 0, best_h = 0, best_gap = 0, best_score = 0;
+    for (uint32_t rows = 1; rows <= n; rows++) {
+      if (band_h < rows * min_px + (rows - 1) * margin)
+        break;
+      uint32_t cols = 0, splits = 0;
+      for (size_t c = first; c < last; c++) {
+        cols += (cl[c].count + rows - 1) / rows;
+        splits += c > first && (cl[c].count > 1 || cl[c - 1].count > 1);
+      }
+      uint32_t gap = cols <= 8 ? COREMAP_GAP : cols <= 16 ? 2 : 1;
+      int64_t room = (int64_t)width - 2 * margin - (int64_t)(cols - 1 + splits) * gap;
+      uint32_t w = room > 0 ? (uint32_t)(room / cols) : 0;
+      uint32_t h = (band_h - (rows - 1) * margin) / rows;
+      uint32_t score = w < 2 * h ? w : 2 * h;
+      if (w >= min_px && score > best_score) {
+        best_rows = rows, best_w = w, best_h = h, best_gap = gap;
+        best_score = score;
+      }
+    }
+    if (!best_rows)
+      return -1;
+
+    // Clusters left to right, each filled row by row.
+    uint32_t x = margin;
+    for (size_t c = first; c < last; c++) {
+      if (c > first && (cl[c].count > 1 || cl[c - 1].count > 1))
+        x += best_gap; // A wider gap between clusters
+      uint32_t cols = (cl[c].count + best_rows - 1) / best_rows;
+      for (uint32_t k = 0; k < cl[c].count; k++) {
+        struct coremap_tile *t = &cm->tile[cl[c].first + k];
+        t->x = (uint16_t)(x + k % cols * (best_w + best_gap));
+        t->y = (uint16_t)(y + k / cols * (best_h + margin));
+        t->w = (uint16_t)best_w;
+        t->h = (uint16_t)best_h;
+      }
+      x += cols * (best_w + best_gap);
+    }
+    y += band_h + margin;
+  }
+  cm->num_placed = cm->num_tiles;
+  return 0;
+}
+
+#endif // COREMAP_H
@@ -0,0 +1,132 @@
+// Per-core current frequency from cpufreq sysfs.
+// Shared by sys-genmon and the Raccoon Monitor plugin.
+//
+// Every core's scaling_cur_freq (or cpuinfo_cur_freq where the governor
+// doesn't expose it) is opened once and re-read with one pread per core,
+// all in a single pass per sample. Cores without cpufreq (most VMs) are
+// remembered as such, so they cost nothing after the first sample.
+// cpuinfo_max_freq is read once per core, for scaling the tint, unless the
+// caller has it cached (max_by_id).
+
+#ifndef CPUFREQ_H
+#define CPUFREQ_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cpustat.h"
+#include "procfs.h"
+#include "tokenize.h"
+
+#define CPUFREQ_PATH_LEN 80
+
+#define CPUFREQ_UNTRIED 0
+#define CPUFREQ_OPEN 1
+#define CPUFREQ_MISSING 2
+
+struct cpufreq {
+  struct procfs_file *cur; // Per slot, open on the core in id[slot]
+  char *paths;             // CPUFREQ_PATH_LEN bytes per slot
+  uint32_t *id;
+  uint32_t *max_khz;
+  uint8_t *state;
+  size_t capacity;
+  const uint32_t *max_by_id; // cpuinfo_max_freq by core id, or NULL to read it
+  size_t num_ids;
+};
+
+static inline void cpufreq_free(struct cpufreq *cf) {
+  for (size_t i = 0; cf->cur && i < cf->capacity; i++)
+    procfs_close(&cf->cur[i]);
+  free(cf->cur);
+  free(cf->paths);
+  free(cf->id);
+  free(cf->max_khz);
+  free(cf->state);
+  memset(cf, 0, sizeof(*cf));
+}
+
+// Returns 0, or -1 if out of memory.
+static inline int cpufreq_init(struct cpufreq *cf, size_t capacity) {
+  memset(cf, 0, sizeof(*cf));
+  cf->cur = malloc(capacity * sizeof(*cf->cur));
+  cf->paths = malloc(capacity * CPUFREQ_PATH_LEN);
+  cf->id = calloc(capacity, sizeof(*cf->id));
+  cf->max_khz = calloc(capacity, sizeof(*cf->max_khz));
+  cf->state = calloc(capacity, sizeof(*cf->state));
+  cf->capacity = capacity;
+  if (!cf->cur || !cf->paths || !cf->id || !cf->max_khz || !cf->state) {
+    cpufreq_free(cf);
+    return -1;
+  }
+  for (size_t i = 0; i < capacity; i++)
+    cf->cur[i] = (struct procfs_file)PROCFS_FILE(cf->paths + i * CPUFREQ_PATH_LEN);
+  return 0;
+}
+
+// kHz in a sysfs value of len bytes, 0 if it isn't a number.
+static inline uint32_t cpufreq_parse(const char *s, ssize_t len) {
+  int err = 0;
+  uint32_t v = tok_u32(&s, s + (len > 0 ? len : 0), &err);
+  return err ? 0 : v;
+}
+
+// Point slot i at core id, trying scaling_cur_freq then cpuinfo_cur_freq.
+static inline void cpufreq_attach(struct cpufreq *cf, size_t i, uint32_t id) {
+  static const char *const sources[] = {"scaling_cur_freq", "cpuinfo_cur_freq"};
+  char *path = cf->paths + i * CPUFREQ_PATH_LEN;
+  procfs_close(&cf->cur[i]);
+  cf->id[i] = id;
+  cf->state[i] = CPUFREQ_MISSING;
+  for (size_t k = 0; k < sizeof(sources) / sizeof(sources[0]); k++) {
+    snprintf(path, CPUFREQ_PATH_LEN, "/sys/devices/system/cpu/cpu%u/cpufreq/%s",
+             id, sources[k]);
+    if (procfs_open(&cf->cur[i]) >= 0) {
+      cf->state[i] = CPUFREQ_OPEN;
+      break;
+    }
+  }
+
+  if (cf->max_by_id) {
+    cf->max_khz[i] = id < cf->num_ids ? cf->max_by_id[id] : 0;
+    return;
+  }
+  char max_path[CPUFREQ_PATH_LEN], value[32];
+  snprintf(max_path, sizeof(max_path),
+           "/sys/devices/system/cpu/cpu%u/cpufreq/cpuinfo_max_freq", id);
+  struct procfs_file max = PROCFS_FILE(max_path);
+  cf->max_khz[i] = cpufreq_parse(value, procfs_read_head(&max, value, sizeof(value)));
+  procfs_close(&max);
+}
+
+// Fill cpu->freq_khz and cpu->freq_max_khz for the cores in the last
+// /proc/stat sample. 0 means unknown.
+static inline void cpufreq_read(struct cpufreq *cf, struct cpu_record *cpu) {
+  char value[32];
+  size_t n = cpu->num_cpus < cf->capacity ? cpu->num_cpus : cf->capacity;
+  for (size_t i = 0; i < n; i++) {
+    if (cf->state[i] == CPUFREQ_UNTRIED || cf->id[i] != cpu->id[i])
+      cpufreq_attach(cf, i, cpu->id[i]);
+    cpu->freq_khz[i] = 0;
+    cpu->freq_max_khz[i] = cf->max_khz[i];
+    if (cf->state[i] != CPUFREQ_OPEN)
+      continue;
+    ssize_t len = procfs_read_head(&cf->cur[i], value, sizeof(value));
+    if (len > 0)
+      cpu->freq_khz[i] = cpufreq_parse(value, len);
+    else
+      cf->state[i] = CPUFREQ_UNTRIED; // Core went offline; retry next time
+  }
+}
+
+// Current / max frequency as 0-1, or -1 if unknown.
+static inline float cpufreq_fraction(const struct cpu_record *cpu, size_t i) {
+  if (!cpu->freq_khz[i] || !cpu->freq_max_khz[i])
+    return -1.0f;
+  float f = (float)cpu->freq_khz[i] / (float)cpu->freq_max_khz[i];
+  return f > 1.0f ? 1.0f : f;
+}
+
+#endif // CPUFREQ_H
@@ -0,0 +1,281 @@
+// Per-core /proc/stat counters and the utilization kernel.
+// Shared by sys-genmon and the Raccoon Monitor plugin.
+//
+// Counters are stored structure-of-arrays: one contiguous uint64_t array
+// per field. The kernel then walks every core in a single branch-free pass
+// that the compiler vectorizes, producing the utilization array and the
+// average together. 64-bit counters don't wrap on long-uptime hosts.
+//
+// The arrays are sized once at startup from the detected topology
+// (cpustat_detect_cpus), and can live on the heap (cpustat_alloc) or in
+// shared memory (cpustat_bind).
+
+#ifndef CPUSTAT_H
+#define CPUSTAT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "procfs.h"
+#include "tokenize.h"
+
+struct cpu_record {
+  uint32_t *id; // N in "cpuN"
+
+  uint64_t *user;
+  uint64_t *system;
+
+  uint64_t *idle;
+  uint64_t *iowait;
+  uint64_t *irq;
+  uint64_t *softirq;
+
+  uint64_t *steal;
+  uint64_t *guest;
+
+  uint32_t *freq_khz;     // Current frequency, 0 if unknown (cpufreq.h)
+  uint32_t *freq_max_khz; // cpuinfo_max_freq, 0 if unknown
+
+  size_t num_cpus; // Cores in the last sample
+  size_t capacity; // Cores the arrays can hold
+};
+
+#define CPUSTAT_NUM_COUNTERS 8
+#define CPUSTAT_ALIGN 64
+
+// Core ids a parse keeps, one bit each; ids past num_ids are left out.
+struct cpustat_mask {
+  uint64_t *bits;
+  size_t num_ids;
+};
+
+static inline int cpustat_mask_has(const struct cpustat_mask *m, uint64_t id) {
+  return id < m->num_ids && (m->bits[id / 64] >> (id % 64) & 1);
+}
+
+static inline size_t cpustat_align(size_t n) {
+  return (n + CPUSTAT_ALIGN - 1) & ~(size_t)(CPUSTAT_ALIGN - 1);
+}
+
+// Bytes needed for the arrays of a record holding capacity cores.
+static inline size_t cpustat_bytes(size_t capacity) {
+  return 3 * cpustat_align(capacity * sizeof(uint32_t)) +
+         CPUSTAT_NUM_COUNTERS * cpustat_align(capacity * sizeof(uint64_t));
+}
+
+// Point the arrays into mem (cpustat_bytes(capacity), 64-byte aligned).
+static inline void cpustat_bind(struct cpu_record *cpu, void *mem, size_t capacity) {
+  char *p = mem;
+  size_t stride = cpustat_align(capacity * sizeof(uint64_t));
+  cpu->id = (uint32_t *)p;
+  p += cpustat_align(capacity * sizeof(uint32_t));
+  uint64_t **fields[CPUSTAT_NUM_COUNTERS] = {
+      &cpu->user, &cpu->system, &cpu->idle,  &cpu->iowait,
+      &cpu->irq,  &cpu->softirq, &cpu->steal, &cpu->guest,
+  };
+  for (size_t i = 0; i < CPUSTAT_NUM_COUNTERS; i++, p += stride)
+    *fields[i] = (uint64_t *)p;
+  cpu->freq_khz = (uint32_t *)p;
+  p += cpustat_align(capacity * sizeof(uint32_t));
+  cpu->freq_max_khz = (uint32_t *)p;
+  cpu->capacity = capacity;
+  cpu->num_cpus = 0;
+}
+
+// Heap-backed record. Returns 0, or -1 if out of memory.
+static inline int cpustat_alloc(struct cpu_record *cpu, size_t capacity) {
+  void *mem = aligned_alloc(CPUSTAT_ALIGN, cpustat_bytes(capacity));
+  if (!mem)
+    return -1;
+  memset(mem, 0, cpustat_bytes(capacity));
+  cpustat_bind(cpu, mem, capacity);
+  return 0;
+}
+
+// Only for records from cpustat_alloc.
+static inline void cpustat_free(struct cpu_record *cpu) {
+  free(cpu->id);
+  memset(cpu, 0, sizeof(*cpu));
+}
+
+// Copy the last sample between records of equal capacity.
+static inline void cpustat_copy(struct cpu_record *dst, const struct cpu_record *src) {
+  memcpy(dst->id, src->id, cpustat_bytes(src->capacity));
+  dst->num_cpus = src->num_cpus;
+}
+
+// Number of CPU ids in a sysfs cpu list such as "0-3,8-11".
+static inline size_t cpustat_count_list(const char *s) {
+  size_t count = 0;
+  while (*s >= '0' && *s <= '9') {
+    char *end;
+    unsigned long lo = strtoul(s, &end, 10);
+    unsigned long hi = lo;
+    if (*end == '-')
+      hi = strtoul(end + 1, &end, 10);
+    if (hi >= lo)
+      count += hi - lo + 1;
+    s = *end == ',' ? end + 1 : end;
+  }
+  return count;
+}
+
+// How many per-core slots to allocate: every possible CPU (so hotplug never
+// overflows), or the number of cpuN lines in /proc/stat if that's larger
+// or sysfs isn't mounted. stat_buf is left holding /proc/stat.
+static inline size_t cpustat_detect_cpus(struct procfs_file *stat_file,
+                                         struct procfs_buf *stat_buf) {
+  char possible[4096];
+  struct procfs_file f = PROCFS_FILE("/sys/devices/system/cpu/possible");
+  size_t n_possible = 0;
+  if (procfs_read_head(&f, possible, sizeof(possible)) > 0)
+    n_possible = cpustat_count_list(possible);
+  procfs_close(&f);
+
+  size_t n_stat = 0;
+  ssize_t len = procfs_read(stat_file, stat_buf);
+  char *p = len > 0 ? stat_buf->data : NULL;
+  char *end = p + (len > 0 ? len : 0);
+  while (p && end - p > 3) {
+    if (p[0] == 'c' && p[1] == 'p' && p[2] == 'u' && p[3] >= '0' && p[3] <= '9')
+      n_stat++;
+    p = memchr(p, '\n', end - p);
+    if (p)
+      p++;
+  }
+
+  size_t n = n_possible > n_stat ? n_possible : n_stat;
+  return n ? n : 1;
+}
+
+#define CPUSTAT_ERR_PARSE -1
+#define CPUSTAT_ERR_TOO_MANY -2
+
+// Parse the cpuN lines of /proc/stat (contents in buf, len bytes), only
+// those of cores in mask unless it is NULL. Returns 0, or one of the
+// CPUSTAT_ERR_* codes.
+static inline int cpustat_parse_mask(struct cpu_record *cpu, const char *buf,
+                                     size_t len,
+                                     const struct cpustat_mask *mask) {
+  const char *p = buf;
+  const char *end = buf + len;
+  cpu->num_cpus = 0;
+
+  // Pass over the aggregate "cpu" line.
+  p = tok_find(p, end, '\n');
+  if (p == end)
+    return CPUSTAT_ERR_PARSE;
+  p++;
+
+  // The per-core lines come next, the first other line ends them.
+  while (end - p > 3 && p[0] == 'c' && p[1] == 'p' && p[2] == 'u') {
+    size_t n = cpu->num_cpus;
+    if (n >= cpu->capacity)
+      return CPUSTAT_ERR_TOO_MANY;
+    p += 3;
+
+    // A core we can't run on costs its id and a newline search.
+    if (mask) {
+      const char *q = p;
+      int err = 0;
+      if (!cpustat_mask_has(mask, tok_u64(&q, end, &err)) && !err) {
+        p = tok_next_line(q, end);
+        continue;
+      }
+    }
+
+    // id user nice system idle iowait irq softirq steal guest; nice isn't
+    // used in the calculation.
+    int err = 0;
+    uint64_t v[10];
+    tok_u64s(&p, end, v, 10, &err);
+    if (err || v[0] > UINT32_MAX)
+      return CPUSTAT_ERR_PARSE;
+    cpu->id[n] = (uint32_t)v[0];
+    cpu->user[n] = v[1];
+    cpu->system[n] = v[3];
+    cpu->idle[n] = v[4];
+    cpu->iowait[n] = v[5];
+    cpu->irq[n] = v[6];
+    cpu->softirq[n] = v[7];
+    cpu->steal[n] = v[8];
+    cpu->guest[n] = v[9];
+
+    // Skip guest_nice and anything newer kernels append.
+    p = tok_next_line(p, end);
+    cpu->num_cpus++;
+  }
+
+  return 0;
+}
+
+static inline int cpustat_parse(struct cpu_record *cpu, const char *buf,
+                                size_t len) {
+  return cpustat_parse_mask(cpu, buf, len, NULL);
+}
+
+// Utilization (0-100) of core i between two samples of the same CPUs.
+// A core whose counters went backwards (hotplug) reads 0.
+static inline float cpustat_core(const struct cpu_record *restrict prev,
+                                 const struct cpu_record *restrict cur,
+                                 size_t i) {
+  uint64_t prev_idle = prev->idle[i] + prev->iowait[i];
+  uint64_t cur_idle = cur->idle[i] + cur->iowait[i];
+
+  uint64_t prev_total = prev_idle + prev->user[i] + prev->system[i] +
+                        prev->irq[i] + prev->softirq[i] + prev->steal[i] +
+                        prev->guest[i];
+  uint64_t cur_total = cur_idle + cur->user[i] + cur->system[i] +
+                       cur->irq[i] + cur->softirq[i] + cur->steal[i] +
+                       cur->guest[i];
+
+  // A backwards step shows up as a negative delta.
+  int64_t idle_diff = (int64_t)(cur_idle - prev_idle);
+  int64_t total_diff = (int64_t)(cur_total - prev_total);
+  int64_t busy_diff = total_diff - idle_diff;
+
+  // Masks rather than branches, so the whole body if-converts: an invalid
+  // core becomes 0 / 1. Deltas over one interval fit in 32 bits (that's
+  // months of jiffies), and int32 -> float converts in SIMD everywhere.
+  int32_t valid = -(int32_t)((idle_diff >= 0) & (busy_diff >= 0) &
+                             (total_diff > 0) & (total_diff <= INT32_MAX));
+  int32_t busy = (int32_t)busy_diff & valid;
+  int32_t total = ((int32_t)total_diff & valid) | (~valid & 1);
+  return (float)busy * 100.0f / (float)total;
+}
+
+// Per-core utilization written to util[0..num_cpus). Returns the average.
+// Cores are processed in blocks of CPUSTAT_LANES with one partial sum per
+// lane, so the block body maps onto SIMD registers (SSE/AVX/NEON) without
+// needing -ffast-math to reorder the float sum.
+#define CPUSTAT_LANES 8
+
+static inline float cpustat_utilization(const struct cpu_record *restrict prev,
+                                        const struct cpu_record *restrict cur,
+                                        float *restrict util) {
+  size_t n = cur->num_cpus;
+  float lanes[CPUSTAT_LANES] = {0};
+
+  size_t i = 0;
+  for (; i + CPUSTAT_LANES <= n; i += CPUSTAT_LANES) {
+    for (size_t j = 0; j < CPUSTAT_LANES; j++) {
+      float u = cpustat_core(prev, cur, i + j);
+      util[i + j] = u;
+      lanes[j] += u;
+    }
+  }
+  for (; i < n; i++) {
+    float u = cpustat_core(prev, cur, i);
+    util[i] = u;
+    lanes[0] += u;
+  }
+
+  float sum = 0;
+  for (size_t j = 0; j < CPUSTAT_LANES; j++)
+    sum += lanes[j];
+  return n ? sum / n : 0.0f;
+}
+
+#endif // CPUSTAT_H
@@ -0,0 +1,447 @@
+// GPU utilization from DRM fdinfo (/proc/[pid]/fdinfo/[fd]).
+// Works for any driver implementing the DRM client usage stats: asahi,
+// amdgpu, i915, xe, msm, panfrost, v3d, ...
+//
+// Scanning every fd of every process each sample is too slow on desktops
+// with thousands of fds, so the scanner is incremental:
+//  - The pid list is re-read each sample; only new pids get their fd
+//    directory listed (one readlink per fd, keeping /dev/dri/ ones).
+//  - A known pid is listed again only when its fd count changes (the
+//    st_size of /proc/[pid]/fd, Linux 6.2+), or every
+//    DRMSCAN_RESCAN_SAMPLES samples on kernels that report 0 there.
+//  - The fdinfo of each DRM fd is kept open and re-read with one pread.
+// drm-engine-<name> busy nanoseconds (or xe's drm-cycles-<name> over
+// drm-total-cycles-<name>) become utilization from the delta between
+// samples. Each client is counted once per device even when several fds
+// share it (drm-client-id).
+//
+// root is the procfs mount, so a fake tree can stand in for /proc.
+
+#ifndef DRMSCAN_H
+#define DRMSCAN_H
+
+#include <dirent.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "procfs.h"
+#include "tokenize.h"
+
+#define DRMSCAN_MAX_DEVICES 8
+#define DRMSCAN_MAX_ENGINES 8
+#define DRMSCAN_RESCAN_SAMPLES 16
+
+struct drm_client {
+  int fd;                     // Number in the process' fd table
+  struct procfs_file fdinfo;  // Open on /proc/[pid]/fdinfo/[fd]
+  uint64_t engine_ns[DRMSCAN_MAX_ENGINES]; // Last read, by device engine
+  uint64_t cycles[DRMSCAN_MAX_ENGINES];    // xe: drm-cycles-<name>
+  uint64_t total_cycles[DRMSCAN_MAX_ENGINES]; // xe: drm-total-cycles-<name>
+  uint64_t client_id;
+  int device;                 // -1 until its fdinfo has been read
+  int has_prev;
+};
+
+struct drm_proc {
+  int pid;
+  int denied;          // fd directory not readable, not retried
+  int64_t fd_count;    // st_size of /proc/[pid]/fd at the last listing
+  unsigned since_scan; // Samples since the last listing
+  struct drm_client *clients;
+  size_t num_clients;
+};
+
+struct drm_device {
+  char driver[32];
+  char pdev[32];
+  char engine[DRMSCAN_MAX_ENGINES][32];
+  uint32_t capacity[DRMSCAN_MAX_ENGINES]; // drm-engine-capacity-<name>
+  size_t num_engines;
+  uint64_t busy_ns[DRMSCAN_MAX_ENGINES];  // This sample, all clients
+  float cycles_busy[DRMSCAN_MAX_ENGINES]; // Same from cycle counts, 0-100
+  uint64_t resident_bytes;                // This sample, all clients
+  float utilization;                      // Busiest engine, 0-100
+};
+
+struct drm_scanner {
+  const char *root;
+  struct drm_proc *procs; // Sorted by pid
+  size_t num_procs;
+  struct drm_device devices[DRMSCAN_MAX_DEVICES];
+  size_t num_devices;
+  uint64_t last_ns;
+};
+
+static inline uint64_t drmscan_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static inline void drmscan_drop_clients(struct drm_proc *proc) {
+  for (size_t i = 0; i < proc->num_clients; i++) {
+    procfs_close(&proc->clients[i].fdinfo);
+    free((char *)proc->clients[i].fdinfo.path);
+  }
+  free(proc->clients);
+  proc->clients = NULL;
+  proc->num_clients = 0;
+}
+
+static inline void drmscan_free(struct drm_scanner *s) {
+  for (size_t i = 0; i < s->num_procs; i++)
+    drmscan_drop_clients(&s->procs[i]);
+  free(s->procs);
+  s->procs = NULL;
+  s->num_procs = 0;
+}
+
+static inline int64_t drmscan_fd_count(const struct drm_scanner *s, int pid) {
+  char path[PATH_MAX];
+  struct stat st;
+  snprintf(path, sizeof(path), "%s/%d/fd", s->root, pid);
+  return stat(path, &st) == 0 ? (int64_t)st.st_size : -1;
+}
+
+// List the fds of a process and keep the DRM ones. Clients that are still
+// open keep their previous engine counters.
+static inline void drmscan_list(struct drm_scanner *s, struct drm_proc *proc) {
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s/%d/fd", s->root, proc->pid);
+  proc->since_scan = 0;
+  proc->fd_count = drmscan_fd_count(s, proc->pid);
+
+  DIR *dir = opendir(path);
+  if (!dir) {
+    proc->denied = 1;
+    drmscan_drop_clients(proc);
+    return;
+  }
+
+  struct drm_client *clients = NULL;
+  size_t num_clients = 0, cap = 0;
+  struct dirent *de;
+  while ((de = readdir(dir))) {
+    if (de->d_name[0] < '0' || de->d_name[0] > '9')
+      continue;
+    char target[64];
+    ssize_t len = readlinkat(dirfd(dir), de->d_name, target, sizeof(target) - 1);
+    if (len < 9 || memcmp(target, "/dev/dri/", 9))
+      continue;
+
+    if (num_clients == cap) {
+      cap = cap ? cap * 2 : 4;
+      struct drm_client *grown = realloc(clients, cap * sizeof(*clients));
+      if (!grown)
+        break;
+      clients = grown;
+    }
+    int fd = atoi(de->d_name);
+    struct drm_client *c = &clients[num_clients];
+
+    // Carry over a client we already track.
+    struct drm_client *old = NULL;
+    for (size_t i = 0; i < proc->num_clients; i++)
+      if (proc->clients[i].fd == fd && proc->clients[i].fdinfo.path)
+        old = &proc->clients[i];
+    if (old) {
+      *c = *old;
+      old->fdinfo = (struct procfs_file)PROCFS_FILE(NULL);
+    } else {
+      char fdinfo[PATH_MAX];
+      snprintf(fdinfo, sizeof(fdinfo), "%s/%d/fdinfo/%d", s->root, proc->pid, fd);
+      memset(c, 0, sizeof(*c));
+      c->fd = fd;
+      c->device = -1;
+      c->fdinfo = (struct procfs_file)PROCFS_FILE(strdup(fdinfo));
+      if (!c->fdinfo.path)
+        continue;
+    }
+    num_clients++;
+  }
+  closedir(dir);
+
+  drmscan_drop_clients(proc);
+  proc->clients = clients;
+  proc->num_clients = num_clients;
+}
+
+static inline int drmscan_cmp_pid(const void *a, const void *b) {
+  return *(const int *)a - *(const int *)b;
+}
+
+// Bring the process table in line with the pid directories under root.
+static inline void drmscan_refresh(struct drm_scanner *s) {
+  DIR *dir = opendir(s->root);
+  if (!dir)
+    return;
+  int *pids = NULL;
+  size_t n = 0, cap = 0;
+  struct dirent *de;
+  while ((de = readdir(dir))) {
+    if (de->d_name[0] < '0' || de->d_name[0] > '9')
+      continue;
+    if (n == cap) {
+      cap = cap ? cap * 2 : 256;
+      int *grown = realloc(pids, cap * sizeof(*pids));
+      if (!grown)
+        break;
+      pids = grown;
+    }
+    pids[n++] = atoi(de->d_name);
+  }
+  closedir(dir);
+  qsort(pids, n, sizeof(*pids), drmscan_cmp_pid);
+
+  // Merge the two sorted lists.
+  struct drm_proc *procs = calloc(n ? n : 1, sizeof(*procs));
+  if (!procs) {
+    free(pids);
+    return;
+  }
+  size_t j = 0;
+  for (size_t i = 0; i < n; i++) {
+    while (j < s->num_procs && s->procs[j].pid < pids[i])
+      drmscan_drop_clients(&s->procs[j++]); // Exited
+    struct drm_proc *p = &procs[i];
+    if (j < s->num_procs && s->procs[j].pid == pids[i]) {
+      *p = s->procs[j++];
+      if (p->denied)
+        continue;
+      int64_t count = drmscan_fd_count(s, p->pid);
+      p->since_scan++;
+      if (count > 0 ? count != p->fd_count
+                    : p->since_scan >= DRMSCAN_RESCAN_SAMPLES)
+        drmscan_list(s, p);
+    } else {
+      p->pid = pids[i];
+      drmscan_list(s, p);
+    }
+  }
+  while (j < s->num_procs)
+    drmscan_drop_clients(&s->procs[j++]);
+  free(s->procs);
+  free(pids);
+  s->procs = procs;
+  s->num_procs = n;
+}
+
+// Bounded copy; names longer than the field are cut.
+static inline void drmscan_copy(char *dst, size_t n, const char *src) {
+  size_t len = strlen(src);
+  len = len < n ? len : n - 1;
+  memcpy(dst, src, len);
+  dst[len] = '\0';
+}
+
+static inline int drmscan_device(struct drm_scanner *s, const char *driver,
+                                 const char *pdev) {
+  for (size_t i = 0; i < s->num_devices; i++)
+    if (!strcmp(s->devices[i].driver, driver) && !strcmp(s->devices[i].pdev, pdev))
+      return (int)i;
+  if (s->num_devices == DRMSCAN_MAX_DEVICES)
+    return -1;
+  struct drm_device *d = &s->devices[s->num_devices];
+  memset(d, 0, sizeof(*d));
+  drmscan_copy(d->driver, sizeof(d->driver), driver);
+  drmscan_copy(d->pdev, sizeof(d->pdev), pdev);
+  return (int)s->num_devices++;
+}
+
+static inline int drmscan_engine(struct drm_device *d, const char *name) {
+  for (size_t i = 0; i < d->num_engines; i++)
+    if (!strcmp(d->engine[i], name))
+      return (int)i;
+  if (d->num_engines == DRMSCAN_MAX_ENGINES)
+    return -1;
+  drmscan_copy(d->engine[d->num_engines], sizeof(d->engine[0]), name);
+  d->capacity[d->num_engines] = 1;
+  return (int)d->num_engines++;
+}
+
+// Copy the value after "key:" into dst, trimmed. Returns 1 if line has key.
+static inline int drmscan_field(const char *line, const char *key, char *dst,
+                                size_t n) {
+  size_t klen = strlen(key);
+  if (strncmp(line, key, klen) || line[klen] != ':')
+    return 0;
+  const char *v = line + klen + 1;
+  while (*v == ' ' || *v == '\t')
+    v++;
+  size_t len = strcspn(v, "\n");
+  if (len >= n)
+    len = n - 1;
+  memcpy(dst, v, len);
+  dst[len] = '\0';
+  return 1;
+}
+
+// A value copied out by drmscan_field. Malformed ones read 0.
+static inline uint64_t drmscan_u64(const char *v) {
+  int err = 0;
+  uint64_t n = tok_str_u64(v, &err);
+  return err ? 0 : n;
+}
+
+static inline uint64_t drmscan_bytes(const char *v) {
+  int err = 0;
+  const char *unit = v, *end = v + strlen(v);
+  uint64_t n = tok_u64(&unit, end, &err);
+  if (err)
+    return 0;
+  unit = tok_skip_blanks(unit, end);
+  if (!strncmp(unit, "KiB", 3))
+    return n << 10;
+  if (!strncmp(unit, "MiB", 3))
+    return n << 20;
+  if (!strncmp(unit, "GiB", 3))
+    return n << 30;
+  return n;
+}
+
+// Per-sample bookkeeping of clients already counted.
+struct drmscan_seen {
+  int device;
+  uint64_t client_id;
+};
+
+// Read one client's fdinfo and add its activity to its device.
+static inline void drmscan_client(struct drm_scanner *s, struct drm_client *c,
+                                  struct drmscan_seen **seen, size_t *num_seen,
+                                  size_t *seen_cap) {
+  char buf[4096], driver[32] = "", pdev[32] = "", client_id[32] = "";
+  ssize_t len = procfs_read_head(&c->fdinfo, buf, sizeof(buf));
+  if (len <= 0)
+    return;
+  const char *end = buf + len;
+
+  for (const char *line = buf; line < end; line = tok_next_line(line, end)) {
+    drmscan_field(line, "drm-driver", driver, sizeof(driver));
+    drmscan_field(line, "drm-pdev", pdev, sizeof(pdev));
+    drmscan_field(line, "drm-client-id", client_id, sizeof(client_id));
+  }
+  if (!driver[0])
+    return; // Not a DRM client (or a driver without usage stats)
+
+  int dev = drmscan_device(s, driver, pdev);
+  if (dev < 0)
+    return;
+  uint64_t id = drmscan_u64(client_id);
+  if (c->device != dev || c->client_id != id)
+    c->has_prev = 0; // The fd number now belongs to another client
+  c->device = dev;
+  c->client_id = id;
+
+  // One count per client, however many fds share it.
+  for (size_t i = 0; client_id[0] && i < *num_seen; i++)
+    if ((*seen)[i].device == dev && (*seen)[i].client_id == id)
+      return;
+  if (*num_seen == *seen_cap) {
+    size_t cap = *seen_cap ? *seen_cap * 2 : 16;
+    struct drmscan_seen *grown = realloc(*seen, cap * sizeof(**seen));
+    if (!grown)
+      return;
+    *seen = grown;
+    *seen_cap = cap;
+  }
+  (*seen)[(*num_seen)++] = (struct drmscan_seen){dev, id};
+
+  struct drm_device *d = &s->devices[dev];
+  uint64_t resident = 0, memory = 0;
+  uint64_t cycles[DRMSCAN_MAX_ENGINES] = {0}, total_cycles[DRMSCAN_MAX_ENGINES] = {0};
+  char value[64];
+  for (const char *line = buf; line < end; line = tok_next_line(line, end)) {
+    if (strncmp(line, "drm-", 4))
+      continue;
+    char key[64];
+    size_t klen = strcspn(line, ":\n");
+    if (line[klen] != ':' || klen >= sizeof(key))
+      continue;
+    memcpy(key, line, klen);
+    key[klen] = '\0';
+    drmscan_field(line, key, value, sizeof(value));
+
+    if (!strncmp(key, "drm-engine-capacity-", 20)) {
+      int e = drmscan_engine(d, key + 20);
+      uint64_t capacity = drmscan_u64(value);
+      if (e >= 0 && capacity > 0 && capacity <= UINT32_MAX)
+        d->capacity[e] = (uint32_t)capacity;
+    } else if (!strncmp(key, "drm-engine-", 11)) {
+      int e = drmscan_engine(d, key + 11);
+      if (e < 0)
+        continue;
+      uint64_t ns = drmscan_u64(value);
+      if (c->has_prev && ns >= c->engine_ns[e])
+        d->busy_ns[e] += ns - c->engine_ns[e];
+      c->engine_ns[e] = ns;
+    } else if (!strncmp(key, "drm-total-cycles-", 17)) {
+      int e = drmscan_engine(d, key + 17);
+      if (e >= 0)
+        total_cycles[e] = drmscan_u64(value);
+    } else if (!strncmp(key, "drm-cycles-", 11)) {
+      int e = drmscan_engine(d, key + 11);
+      if (e >= 0)
+        cycles[e] = drmscan_u64(value);
+    } else if (!strncmp(key, "drm-resident-", 13)) {
+      resident += drmscan_bytes(value);
+    } else if (!strncmp(key, "drm-memory-", 11)) {
+      memory += drmscan_bytes(value);
+    }
+  }
+  // drm-resident-* supersedes the older drm-memory-* keys.
+  d->resident_bytes += resident ? resident : memory;
+
+  // Cycle counts are per client against the GPU clock, so each client's
+  // share adds up rather than its raw cycles.
+  for (size_t e = 0; e < d->num_engines; e++) {
+    if (!total_cycles[e])
+      continue;
+    if (c->has_prev && total_cycles[e] > c->total_cycles[e] &&
+        cycles[e] >= c->cycles[e])
+      d->cycles_busy[e] += 100.0f * (cycles[e] - c->cycles[e]) /
+                           (float)(total_cycles[e] - c->total_cycles[e]);
+    c->cycles[e] = cycles[e];
+    c->total_cycles[e] = total_cycles[e];
+  }
+  c->has_prev = 1;
+}
+
+// Take one sample: refresh the process table, read every DRM client, and
+// turn the engine time since the previous sample into utilization.
+static inline void drmscan_sample(struct drm_scanner *s) {
+  drmscan_refresh(s);
+
+  for (size_t i = 0; i < s->num_devices; i++) {
+    memset(s->devices[i].busy_ns, 0, sizeof(s->devices[i].busy_ns));
+    memset(s->devices[i].cycles_busy, 0, sizeof(s->devices[i].cycles_busy));
+    s->devices[i].resident_bytes = 0;
+  }
+
+  struct drmscan_seen *seen = NULL;
+  size_t num_seen = 0, seen_cap = 0;
+  for (size_t p = 0; p < s->num_procs; p++)
+    for (size_t i = 0; i < s->procs[p].num_clients; i++)
+      drmscan_client(s, &s->procs[p].clients[i], &seen, &num_seen, &seen_cap);
+  free(seen);
+
+  uint64_t now = drmscan_now_ns();
+  uint64_t elapsed = s->last_ns ? now - s->last_ns : 0;
+  s->last_ns = now;
+  for (size_t i = 0; i < s->num_devices; i++) {
+    struct drm_device *d = &s->devices[i];
+    d->utilization = 0;
+    for (size_t e = 0; e < d->num_engines; e++) {
+      float u = d->cycles_busy[e] / d->capacity[e];
+      if (elapsed && d->busy_ns[e])
+        u = 100.0f * d->busy_ns[e] / ((double)elapsed * d->capacity[e]);
+      if (u > d->utilization)
+        d->utilization = u > 100.0f ? 100.0f : u;
+    }
+  }
+}
+
+#endif // DRMSCAN_H
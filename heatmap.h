@@ -0,0 +1,263 @@
+// Many-core heatmap: grid layout, grouping and color ramp.
+// Shared by sys-genmon (--svg --heatmap) and the Raccoon Monitor plugin.
+//
+// Every core is one pixel of a small grid image, which the renderers scale
+// up to the panel with nearest-neighbour filtering. Output size and draw
+// time follow the grid, not per-core markup. Cores can be grouped by
+// package, cluster or NUMA node; groups are separated by a blank column.
+
+#ifndef HEATMAP_H
+#define HEATMAP_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "procfs.h"
+
+enum heatmap_group {
+  HEATMAP_GROUP_NONE,
+  HEATMAP_GROUP_PACKAGE,
+  HEATMAP_GROUP_CLUSTER,
+  HEATMAP_GROUP_NUMA,
+};
+
+struct heatmap {
+  size_t num_cells;
+  uint32_t *x, *y;         // Grid pixel of each core, by core index
+  uint32_t grid_w, grid_h; // Grid image size
+  uint32_t cell_px;        // On-screen size of one cell
+};
+
+// Utilization ramp, 0-100% in 1% steps. Built from the panel palette:
+// idle navy, CPU blue, GPU green, memory yellow, hot red.
+static inline const uint8_t *heatmap_color(float util) {
+  static uint8_t lut[101][3];
+  static int built = 0;
+  if (!built) {
+    static const uint8_t stops[5][3] = {
+        {0x1B, 0x2A, 0x49}, {0x34, 0x98, 0xDB}, {0x27, 0xAE, 0x60},
+        {0xF1, 0xC4, 0x0F}, {0xE7, 0x4C, 0x3C},
+    };
+    for (int i = 0; i <= 100; i++) {
+      int seg = i < 100 ? i / 25 : 3;
+      int t = i - seg * 25; // 0..25 within the segment
+      for (int c = 0; c < 3; c++)
+        lut[i][c] = (stops[seg][c] * (25 - t) + stops[seg + 1][c] * t) / 25;
+    }
+    built = 1;
+  }
+  int i = util <= 0 ? 0 : util >= 100 ? 100 : (int)(util + 0.5f);
+  return lut[i];
+}
+
+static inline int heatmap_parse_group(const char *s, enum heatmap_group *g) {
+  if (!strcmp(s, "none"))
+    *g = HEATMAP_GROUP_NONE;
+  else if (!strcmp(s, "package"))
+    *g = HEATMAP_GROUP_PACKAGE;
+  else if (!strcmp(s, "cluster"))
+    *g = HEATMAP_GROUP_CLUSTER;
+  else if (!strcmp(s, "numa"))
+    *g = HEATMAP_GROUP_NUMA;
+  else
+    return -1;
+  return 0;
+}
+
+// Mark every id of a sysfs cpu list ("0-3,8-11") that maps to a core.
+static inline void heatmap_assign_list(const char *s, const int32_t *index_of,
+                                       uint32_t max_id, uint32_t *group,
+                                       uint32_t g) {
+  while (*s >= '0' && *s <= '9') {
+    char *end;
+    unsigned long lo = strtoul(s, &end, 10);
+    unsigned long hi = lo;
+    if (*end == '-')
+      hi = strtoul(end + 1, &end, 10);
+    for (unsigned long id = lo; id <= hi && id <= max_id; id++)
+      if (index_of[id] >= 0)
+        group[index_of[id]] = g;
+    s = *end == ',' ? end + 1 : end;
+  }
+}
+
+// Group number of each core (cpu_id[i] is the N of "cpuN").
+// One sysfs list is read per group, not per core. Cores the kernel doesn't
+// place anywhere end up together in a last group.
+static inline void heatmap_groups(const uint32_t *cpu_id, size_t n,
+                                  enum heatmap_group kind, uint32_t *group) {
+  uint32_t max_id = 0;
+  for (size_t i = 0; i < n; i++)
+    max_id = cpu_id[i] > max_id ? cpu_id[i] : max_id;
+
+  const uint32_t unassigned = UINT32_MAX;
+  for (size_t i = 0; i < n; i++)
+    group[i] = kind == HEATMAP_GROUP_NONE ? 0 : unassigned;
+  if (kind == HEATMAP_GROUP_NONE || !n)
+    return;
+
+  int32_t *index_of = malloc((max_id + 1) * sizeof(*index_of));
+  if (!index_of) {
+    memset(group, 0, n * sizeof(*group));
+    return;
+  }
+  for (uint32_t id = 0; id <= max_id; id++)
+    index_of[id] = -1;
+  for (size_t i = 0; i < n; i++)
+    index_of[cpu_id[i]] = (int32_t)i;
+
+  char path[128], list[4096];
+  uint32_t num_groups = 0;
+  if (kind == HEATMAP_GROUP_NUMA) {
+    char nodes[1024];
+    struct procfs_file online = PROCFS_FILE("/sys/devices/system/node/online");
+    ssize_t got = procfs_read_head(&online, nodes, sizeof(nodes));
+    procfs_close(&online);
+    for (char *s = got > 0 ? nodes : ""; *s >= '0' && *s <= '9';) {
+      char *end;
+      unsigned long lo = strtoul(s, &end, 10);
+      unsigned long hi = lo;
+      if (*end == '-')
+        hi = strtoul(end + 1, &end, 10);
+      for (unsigned long node = lo; node <= hi; node++) {
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%lu/cpulist", node);
+        struct procfs_file f = PROCFS_FILE(path);
+        if (procfs_read_head(&f, list, sizeof(list)) > 0)
+          heatmap_assign_list(list, index_of, max_id, group, num_groups++);
+        procfs_close(&f);
+      }
+      s = *end == ',' ? end + 1 : end;
+    }
+  } else {
+    const char *which = kind == HEATMAP_GROUP_PACKAGE ? "package_cpus_list"
+                                                      : "cluster_cpus_list";
+    for (size_t i = 0; i < n; i++) {
+      if (group[i] != unassigned)
+        continue;
+      snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%u/topology/%s",
+               cpu_id[i], which);
+      struct procfs_file f = PROCFS_FILE(path);
+      ssize_t got = procfs_read_head(&f, list, sizeof(list));
+      procfs_close(&f);
+      if (got <= 0)
+        continue; // Left for the last group
+      heatmap_assign_list(list, index_of, max_id, group, num_groups);
+      group[i] = num_groups++; // Even if the list didn't name this core.
+    }
+  }
+
+  for (size_t i = 0; i < n; i++)
+    if (group[i] == unassigned)
+      group[i] = num_groups;
+  free(index_of);
+}
+
+// Columns needed for the group blocks at a given row count.
+static inline uint32_t heatmap_columns(const uint32_t *count, uint32_t num_groups,
+                                       uint32_t rows) {
+  uint32_t cols = 0;
+  for (uint32_t g = 0; g < num_groups; g++)
+    if (count[g])
+      cols += (count[g] + rows - 1) / rows + (cols ? 1 : 0);
+  return cols;
+}
+
+static inline void heatmap_free(struct heatmap *hm) {
+  free(hm->x);
+  free(hm->y);
+  memset(hm, 0, sizeof(*hm));
+}
+
+// Place n cores into a grid of rows filling a panel_w x panel_h area.
+// Groups become blocks of whole columns, filled top to bottom, with one
+// blank column between blocks. The row count is the one that gives the
+// largest cells. panel_w 0 means "as wide as needed" with cells of at
+// least min_cell_px. Returns 0, or -1 if out of memory.
+static inline int heatmap_layout(struct heatmap *hm, const uint32_t *group,
+                                 size_t n, uint32_t panel_w, uint32_t panel_h,
+                                 uint32_t min_cell_px) {
+  heatmap_free(hm);
+  if (!n || !panel_h)
+    return 0;
+  hm->x = malloc(n * sizeof(*hm->x));
+  hm->y = malloc(n * sizeof(*hm->y));
+  uint32_t num_groups = 0;
+  for (size_t i = 0; i < n; i++)
+    num_groups = group[i] + 1 > num_groups ? group[i] + 1 : num_groups;
+  uint32_t *count = calloc(num_groups, sizeof(*count));
+  if (!hm->x || !hm->y || !count) {
+    free(count);
+    heatmap_free(hm);
+    return -1;
+  }
+  for (size_t i = 0; i < n; i++)
+    count[group[i]]++;
+  hm->num_cells = n;
+
+  // Pick the row count. A fixed panel takes the one giving the largest
+  // cells; cell size is bounded by the height and by the columns the
+  // groups need. An open-ended panel takes as many rows as fit.
+  uint32_t best_rows = 1, best_cell = 0;
+  uint32_t max_rows = n < panel_h ? (uint32_t)n : panel_h;
+  if (!panel_w) {
+    best_rows = panel_h / (min_cell_px ? min_cell_px : 1);
+    best_rows = best_rows < 1 ? 1 : best_rows > max_rows ? max_rows : best_rows;
+    best_cell = panel_h / best_rows;
+  } else {
+    for (uint32_t rows = 1; rows <= max_rows; rows++) {
+      uint32_t cols = heatmap_columns(count, num_groups, rows);
+      uint32_t cell = panel_h / rows;
+      if (panel_w / cols < cell)
+        cell = panel_w / cols;
+      if (cell > best_cell) {
+        best_rows = rows;
+        best_cell = cell;
+      }
+    }
+  }
+  uint32_t best_cols = heatmap_columns(count, num_groups, best_rows);
+
+  // Column where each group's block starts.
+  uint32_t col = 0;
+  for (uint32_t g = 0; g < num_groups; g++) {
+    uint32_t width = (count[g] + best_rows - 1) / best_rows;
+    uint32_t start = col;
+    col += count[g] ? width + 1 : 0;
+    count[g] = start; // Reused as the block's next free cell below.
+  }
+  uint32_t *filled = calloc(num_groups, sizeof(*filled));
+  if (!filled) {
+    free(count);
+    heatmap_free(hm);
+    return -1;
+  }
+  for (size_t i = 0; i < n; i++) {
+    uint32_t k = filled[group[i]]++;
+    hm->x[i] = count[group[i]] + k / best_rows;
+    hm->y[i] = k % best_rows;
+  }
+  free(filled);
+  free(count);
+
+  hm->grid_w = best_cols;
+  hm->grid_h = best_rows;
+  // A panel too small for that still gets one pixel per core.
+  hm->cell_px = best_cell ? best_cell : 1;
+  return 0;
+}
+
+// Fill a 32-bit pixel grid (grid_w x grid_h, stride in pixels) with the
+// ramp color of each core. Pixels are written as 0xAARRGGBB; cells outside
+// any core keep whatever the caller cleared them to.
+static inline void heatmap_fill_argb(const struct heatmap *hm, const float *util,
+                                     uint32_t *pixels, size_t stride) {
+  for (size_t i = 0; i < hm->num_cells; i++) {
+    const uint8_t *c = heatmap_color(util[i]);
+    pixels[hm->y[i] * stride + hm->x[i]] =
+        0xFF000000u | (uint32_t)c[0] << 16 | (uint32_t)c[1] << 8 | c[2];
+  }
+}
+
+#endif // HEATMAP_H
@@ -0,0 +1,242 @@
+// Utilization history at several resolutions, kept in shared memory.
+// Used by sys-genmon; readers need nothing but the mapping.
+//
+// Each tier is a ring of time buckets holding a whole-percent value per
+// row: row 0 is the average, row 1 + i is core slot i. A sample covering
+// [from, to) is averaged into the tier-0 buckets it overlaps, weighted by
+// the overlap. When a bucket closes its average is added to the next tier
+// the same way, so coarse tiers are rolled up from the finer ones, never
+// from raw samples. Buckets from before the first sample read
+// HISTORY_EMPTY.
+//
+// Everything lives in the history_bytes() region the caller maps, so
+// pushing a sample allocates nothing. Every sampling consumer pushes, so a
+// push first claims the history by compare-and-swap of claim_ns; one that
+// finds it held skips its sample. The holder brackets the push with seq
+// (odd while writing), and readers retry a copy that straddles one.
+
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "cpustat.h"
+
+#define HISTORY_TIERS 3
+#define HISTORY_EMPTY 0xFF
+#define HISTORY_MAX_LENGTH 1440
+#define HISTORY_STALE_NS 10000000000ull // A writer holding a claim this long died
+
+// 1 s x 120 (2 minutes), 10 s x 360 (1 hour), 60 s x 1440 (1 day).
+static const struct {
+  uint32_t period_s;
+  uint32_t length;
+} history_config[HISTORY_TIERS] = {{1, 120}, {10, 360}, {60, 1440}};
+
+struct history_tier {
+  uint64_t period_ns;
+  uint64_t bucket;  // Time bucket (ns / period_ns) at head, 0 before any
+  uint64_t open_ns; // Time added to the head bucket, 0 once it closed
+  uint32_t length;  // Slots in the ring
+  uint32_t head;    // Slot of the newest bucket
+};
+
+struct history_header {
+  uint32_t seq;
+  uint32_t rows;
+  uint64_t claim_ns; // CLOCK_MONOTONIC the writer claimed it at, 0 if free
+  uint64_t last_ns; // End of the newest sample, 0 before the first
+  struct history_tier tier[HISTORY_TIERS];
+};
+
+struct history {
+  struct history_header *hdr;
+  uint8_t *slots[HISTORY_TIERS]; // length x rows, one slot after another
+  float *acc[HISTORY_TIERS];     // Per row, value x seconds of the head bucket
+};
+
+static inline size_t history_bytes(size_t rows) {
+  size_t n = cpustat_align(sizeof(struct history_header));
+  for (size_t k = 0; k < HISTORY_TIERS; k++)
+    n += cpustat_align(history_config[k].length * rows) +
+         cpustat_align(rows * sizeof(float));
+  return n;
+}
+
+// Point h into mem (history_bytes(rows), 64-byte aligned).
+static inline void history_bind(struct history *h, void *mem, size_t rows) {
+  char *p = mem;
+  h->hdr = (struct history_header *)p;
+  p += cpustat_align(sizeof(struct history_header));
+  for (size_t k = 0; k < HISTORY_TIERS; k++) {
+    h->slots[k] = (uint8_t *)p;
+    p += cpustat_align(history_config[k].length * rows);
+    h->acc[k] = (float *)p;
+    p += cpustat_align(rows * sizeof(float));
+  }
+}
+
+// Start an empty history.
+static inline void history_init(struct history *h, size_t rows) {
+  memset(h->hdr, 0, sizeof(*h->hdr));
+  h->hdr->rows = (uint32_t)rows;
+  for (size_t k = 0; k < HISTORY_TIERS; k++) {
+    h->hdr->tier[k].period_ns = history_config[k].period_s * 1000000000ull;
+    h->hdr->tier[k].length = history_config[k].length;
+    memset(h->slots[k], HISTORY_EMPTY, history_config[k].length * rows);
+    memset(h->acc[k], 0, rows * sizeof(float));
+  }
+}
+
+// Move the head forward to bucket b, emptying the slots it passes.
+static inline void history_advance(struct history *h, size_t k, uint64_t b) {
+  struct history_tier *t = &h->hdr->tier[k];
+  uint64_t steps = t->bucket ? b - t->bucket : 1;
+  steps = steps < t->length ? steps : t->length;
+  for (uint64_t i = 0; i < steps; i++) {
+    t->head = t->head + 1 < t->length ? t->head + 1 : 0;
+    memset(h->slots[k] + (size_t)t->head * h->hdr->rows, HISTORY_EMPTY,
+           h->hdr->rows);
+  }
+  t->bucket = b;
+}
+
+static inline uint8_t history_value(float v) {
+  return v <= 0 ? 0 : v >= 100 ? 100 : (uint8_t)(v + 0.5f);
+}
+
+static inline void history_add(struct history *h, size_t k, uint64_t from,
+                               uint64_t to, float avg, const float *v,
+                               size_t n);
+
+// Close the head bucket of tier k and add its average to tier k + 1.
+static inline void history_close(struct history *h, size_t k) {
+  struct history_tier *t = &h->hdr->tier[k];
+  if (!t->open_ns)
+    return;
+  float *acc = h->acc[k];
+  float seconds = t->open_ns / 1e9f;
+  for (size_t r = 0; r < h->hdr->rows; r++)
+    acc[r] /= seconds;
+  uint64_t end = (t->bucket + 1) * t->period_ns;
+  uint64_t open_ns = t->open_ns;
+  t->open_ns = 0;
+  if (k + 1 < HISTORY_TIERS)
+    history_add(h, k + 1, end - open_ns, end, acc[0], acc + 1,
+                h->hdr->rows - 1);
+  memset(acc, 0, h->hdr->rows * sizeof(float));
+}
+
+static inline void history_store(struct history *h, size_t k, float avg,
+                                 const float *v, size_t n) {
+  uint8_t *slot = h->slots[k] + (size_t)h->hdr->tier[k].head * h->hdr->rows;
+  slot[0] = history_value(avg);
+  for (size_t i = 0; i < n; i++)
+    slot[1 + i] = history_value(v[i]);
+}
+
+// avg and v[0..n) were the utilization over [from, to).
+static inline void history_add(struct history *h, size_t k, uint64_t from,
+                               uint64_t to, float avg, const float *v,
+                               size_t n) {
+  struct history_tier *t = &h->hdr->tier[k];
+  uint64_t p = t->period_ns;
+  n = n < h->hdr->rows - 1 ? n : h->hdr->rows - 1;
+  while (from < to) {
+    uint64_t b = from / p;
+    if (b != t->bucket) {
+      if (t->bucket && b < t->bucket)
+        return; // Older than what is stored
+      history_close(h, k);
+      history_advance(h, k, b);
+    }
+
+    // Whole buckets (a long gap between samples) all get the same value.
+    uint64_t whole = from == b * p ? (to - from) / p : 0;
+    if (whole > 1) {
+      uint64_t skip = whole > t->length ? whole - t->length : 0;
+      for (uint64_t i = skip; i < whole; i++) {
+        history_advance(h, k, b + i);
+        history_store(h, k, avg, v, n);
+      }
+      if (k + 1 < HISTORY_TIERS)
+        history_add(h, k + 1, from, from + whole * p, avg, v, n);
+      from += whole * p;
+      continue;
+    }
+
+    uint64_t end = (b + 1) * p < to ? (b + 1) * p : to;
+    float w = (end - from) / 1e9f;
+    float *acc = h->acc[k];
+    acc[0] += avg * w;
+    for (size_t i = 0; i < n; i++)
+      acc[1 + i] += v[i] * w;
+    t->open_ns += end - from;
+
+    float seconds = t->open_ns / 1e9f;
+    uint8_t *slot = h->slots[k] + (size_t)t->head * h->hdr->rows;
+    for (size_t r = 0; r < 1 + n; r++)
+      slot[r] = history_value(acc[r] / seconds);
+
+    if (end == (b + 1) * p)
+      history_close(h, k);
+    from = end;
+  }
+}
+
+// Record a sample taken at now_ns: the average and n per-core values since
+// the previous push. The first push only sets the starting point. Returns
+// 0 if another writer held the history and the sample was left out.
+static inline int history_push(struct history *h, uint64_t now_ns, float avg,
+                               const float *util, size_t n) {
+  struct history_header *hdr = h->hdr;
+  uint64_t claim = __atomic_load_n(&hdr->claim_ns, __ATOMIC_ACQUIRE);
+  // Held; take it over only from a writer that died mid-push.
+  if (claim && (now_ns < claim || now_ns - claim < HISTORY_STALE_NS))
+    return 0;
+  if (!__atomic_compare_exchange_n(&hdr->claim_ns, &claim, now_ns, 0,
+                                   __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+    return 0;
+
+  // Odd, also if a dead writer left it so.
+  uint32_t seq = __atomic_load_n(&hdr->seq, __ATOMIC_RELAXED) | 1;
+  __atomic_store_n(&hdr->seq, seq, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+
+  if (hdr->last_ns && now_ns > hdr->last_ns)
+    history_add(h, 0, hdr->last_ns, now_ns, avg, util, n);
+  if (now_ns > hdr->last_ns)
+    hdr->last_ns = now_ns;
+
+  __atomic_store_n(&hdr->seq, seq + 1, __ATOMIC_RELEASE);
+  __atomic_store_n(&hdr->claim_ns, 0, __ATOMIC_RELEASE);
+  return 1;
+}
+
+// Copy the newest n buckets of one row into out, oldest first. Returns how
+// many were copied: at most the tier length.
+static inline size_t history_read(const struct history *h, size_t k,
+                                  size_t row, uint8_t *out, size_t n) {
+  const struct history_tier *t = &h->hdr->tier[k];
+  for (int tries = 0; tries < 100; tries++) {
+    uint32_t seq = __atomic_load_n(&h->hdr->seq, __ATOMIC_ACQUIRE);
+    if (seq & 1)
+      continue;
+    size_t rows = h->hdr->rows, length = t->length, head = t->head;
+    if (row >= rows || head >= length)
+      return 0;
+    n = n < length ? n : length;
+    for (size_t i = 0; i < n; i++) {
+      size_t slot = (head + length - (n - 1 - i)) % length;
+      out[i] = h->slots[k][slot * rows + row];
+    }
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&h->hdr->seq, __ATOMIC_RELAXED) == seq)
+      return n;
+  }
+  return 0;
+}
+
+#endif // HISTORY_H
@@ -0,0 +1,258 @@
+// Disk and network throughput from /proc/diskstats and /proc/net/dev.
+// Used by sys-genmon.
+//
+// Both files are parsed in one pass over the buffer procfs_read() filled,
+// with no allocation: each line's name is checked against a filter first,
+// and a rejected line costs one tok_next_line() (tokenize.h). Containers
+// and loop mounts can leave hundreds of veth and loop devices; skipping
+// them is the common case. Accepted devices are copied into fixed tables,
+// and rates come from two such samples.
+//
+// A filter is a comma-separated list of names; a trailing '*' matches any
+// suffix and a leading '!' excludes. With any inclusions, a device must
+// match one. Partitions are always skipped, so disks aren't counted twice:
+// diskstats lists them right after their disk, with the same major number
+// and the disk's name as a prefix.
+
+#ifndef IOSTAT_H
+#define IOSTAT_H
+
+#include <stdint.h>
+#include <string.h>
+
+#include "tokenize.h"
+
+#define IOSTAT_MAX_DEVS 16
+#define IOSTAT_MAX_PATTERNS 16
+#define IOSTAT_NAME_LEN 16 // IFNAMSIZ; block device names are shorter
+#define IOSTAT_SECTOR 512  // diskstats counts 512-byte sectors on any device
+
+#define IOSTAT_DEFAULT_DISKS "!loop*,!ram*,!zram*,!sr*,!fd*"
+#define IOSTAT_DEFAULT_NETS "!lo,!veth*,!docker*,!br-*,!virbr*"
+
+struct iostat_pattern {
+  char name[IOSTAT_NAME_LEN];
+  uint8_t len;
+  uint8_t prefix; // Ended in '*'
+  uint8_t deny;   // Started with '!'
+};
+
+struct iostat_filter {
+  struct iostat_pattern pattern[IOSTAT_MAX_PATTERNS];
+  size_t num_patterns;
+  int any_allow;
+};
+
+struct disk_counters {
+  char name[IOSTAT_NAME_LEN];
+  uint64_t read_ios, read_sectors;
+  uint64_t write_ios, write_sectors;
+  uint64_t io_ticks_ms; // Time with I/O in flight
+};
+
+struct net_counters {
+  char name[IOSTAT_NAME_LEN];
+  uint64_t rx_bytes, rx_packets, rx_drop;
+  uint64_t tx_bytes, tx_packets, tx_drop;
+};
+
+struct iostat_sample {
+  uint64_t ns; // CLOCK_MONOTONIC, 0 before the first
+  uint32_t num_disks;
+  uint32_t num_nets;
+  struct disk_counters disk[IOSTAT_MAX_DEVS];
+  struct net_counters net[IOSTAT_MAX_DEVS];
+};
+
+struct disk_rate {
+  char name[IOSTAT_NAME_LEN];
+  float read_bps, write_bps;
+  float read_iops, write_iops;
+  float busy; // Percent of the interval with I/O in flight
+};
+
+struct net_rate {
+  char name[IOSTAT_NAME_LEN];
+  float rx_bps, tx_bps;
+  float rx_pps, tx_pps;
+  float drops; // Per second, both directions
+};
+
+// Returns 0, or -1 if spec has too many or too long names.
+static inline int iostat_filter_parse(struct iostat_filter *f, const char *spec) {
+  memset(f, 0, sizeof(*f));
+  while (*spec) {
+    const char *end = strchr(spec, ',');
+    size_t len = end ? (size_t)(end - spec) : strlen(spec);
+    if (len) {
+      if (f->num_patterns == IOSTAT_MAX_PATTERNS)
+        return -1;
+      int deny = *spec == '!';
+      int prefix = spec[len - 1] == '*';
+      size_t name_len = len - deny - prefix;
+      if (name_len >= IOSTAT_NAME_LEN || (deny && len == 1))
+        return -1;
+      struct iostat_pattern *p = &f->pattern[f->num_patterns++];
+      memcpy(p->name, spec + deny, name_len);
+      p->len = (uint8_t)name_len;
+      p->prefix = (uint8_t)prefix;
+      p->deny = (uint8_t)deny;
+      f->any_allow |= !deny;
+    }
+    spec += len + (end != NULL);
+  }
+  return 0;
+}
+
+static inline int iostat_filter_match(const struct iostat_filter *f,
+                                      const char *name, size_t len) {
+  int allowed = !f->any_allow;
+  for (size_t i = 0; i < f->num_patterns; i++) {
+    const struct iostat_pattern *p = &f->pattern[i];
+    if (len < p->len || (!p->prefix && len != p->len) ||
+        memcmp(name, p->name, p->len))
+      continue;
+    if (p->deny)
+      return 0;
+    allowed = 1;
+  }
+  return allowed;
+}
+
+static inline void iostat_name(char *dst, const char *name, size_t len) {
+  len = len < IOSTAT_NAME_LEN - 1 ? len : IOSTAT_NAME_LEN - 1;
+  memcpy(dst, name, len);
+  dst[len] = '\0';
+}
+
+// "   8       0 sda 4096 12 262144 1234 2048 7 131072 567 0 1500 1801 ..."
+static inline void diskstats_parse(struct iostat_sample *s, const char *buf,
+                                   size_t len, const struct iostat_filter *f) {
+  const char *p = buf, *end = buf + len;
+  const char *disk = NULL; // Name of the last whole disk, for partitions
+  size_t disk_len = 0;
+  uint64_t disk_major = 0;
+  int err = 0; // Missing counters read 0
+  s->num_disks = 0;
+  for (; p < end; p = tok_next_line(p, end)) {
+    uint64_t major = tok_u64(&p, end, &err);
+    tok_u64(&p, end, &err); // minor
+    const char *name = tok_skip_blanks(p, end);
+    p = tok_find2(name, end, ' ', '\n');
+    size_t name_len = p - name;
+    if (!name_len)
+      continue;
+
+    if (disk && major == disk_major && name_len > disk_len &&
+        !memcmp(name, disk, disk_len))
+      continue; // Partition of the disk before it
+    disk = name, disk_len = name_len, disk_major = major;
+    if (s->num_disks == IOSTAT_MAX_DEVS || !iostat_filter_match(f, name, name_len))
+      continue;
+
+    uint64_t v[10];
+    tok_u64s(&p, end, v, 10, &err);
+    struct disk_counters *d = &s->disk[s->num_disks++];
+    iostat_name(d->name, name, name_len);
+    d->read_ios = v[0];
+    d->read_sectors = v[2];
+    d->write_ios = v[4];
+    d->write_sectors = v[6];
+    d->io_ticks_ms = v[9];
+  }
+}
+
+// Two header lines, then "  eth0: rx_bytes rx_packets errs drop fifo frame
+// compressed multicast tx_bytes tx_packets errs drop ...".
+static inline void netdev_parse(struct iostat_sample *s, const char *buf,
+                                size_t len, const struct iostat_filter *f) {
+  const char *p = buf, *end = buf + len;
+  int err = 0;
+  s->num_nets = 0;
+  p = tok_next_line(tok_next_line(p, end), end);
+  for (; p < end; p = tok_next_line(p, end)) {
+    const char *name = tok_skip_blanks(p, end);
+    p = tok_find2(name, end, ':', '\n');
+    size_t name_len = p - name;
+    if (p == end || *p != ':' || !name_len)
+      continue;
+    p++;
+    if (s->num_nets == IOSTAT_MAX_DEVS || !iostat_filter_match(f, name, name_len))
+      continue;
+
+    uint64_t v[12];
+    tok_u64s(&p, end, v, 12, &err);
+    struct net_counters *n = &s->net[s->num_nets++];
+    iostat_name(n->name, name, name_len);
+    n->rx_bytes = v[0];
+    n->rx_packets = v[1];
+    n->rx_drop = v[3];
+    n->tx_bytes = v[8];
+    n->tx_packets = v[9];
+    n->tx_drop = v[11];
+  }
+}
+
+// Counters only grow; a device that was re-created restarts from zero.
+static inline float iostat_rate(uint64_t prev, uint64_t cur, double seconds) {
+  return cur >= prev ? (float)((cur - prev) / seconds) : 0;
+}
+
+// Index of name in prev, trying hint first (devices rarely move), or -1.
+static inline int iostat_find(const char *name, const char *first,
+                              size_t stride, uint32_t n, uint32_t hint) {
+  for (uint32_t k = 0; k < n; k++) {
+    uint32_t i = (hint + k) % n;
+    if (!strcmp(first + i * stride, name))
+      return (int)i;
+  }
+  return -1;
+}
+
+// Rates between two samples for every device in cur; ones that weren't in
+// prev get zeros.
+static inline void iostat_rates(const struct iostat_sample *prev,
+                                const struct iostat_sample *cur,
+                                struct disk_rate *disk, uint32_t *num_disks,
+                                struct net_rate *net, uint32_t *num_nets) {
+  double seconds = prev->ns && cur->ns > prev->ns ? (cur->ns - prev->ns) / 1e9 : 0;
+  *num_disks = cur->num_disks;
+  for (uint32_t i = 0; i < cur->num_disks; i++) {
+    const struct disk_counters *c = &cur->disk[i];
+    int j = seconds ? iostat_find(c->name, prev->disk[0].name, sizeof(*c),
+                                  prev->num_disks, i)
+                    : -1;
+    memset(&disk[i], 0, sizeof(disk[i]));
+    memcpy(disk[i].name, c->name, IOSTAT_NAME_LEN);
+    if (j < 0)
+      continue;
+    const struct disk_counters *p = &prev->disk[j];
+    disk[i].read_bps = iostat_rate(p->read_sectors, c->read_sectors, seconds) * IOSTAT_SECTOR;
+    disk[i].write_bps = iostat_rate(p->write_sectors, c->write_sectors, seconds) * IOSTAT_SECTOR;
+    disk[i].read_iops = iostat_rate(p->read_ios, c->read_ios, seconds);
+    disk[i].write_iops = iostat_rate(p->write_ios, c->write_ios, seconds);
+    float busy = iostat_rate(p->io_ticks_ms, c->io_ticks_ms, seconds) / 10;
+    disk[i].busy = busy < 100 ? busy : 100;
+  }
+
+  *num_nets = cur->num_nets;
+  for (uint32_t i = 0; i < cur->num_nets; i++) {
+    const struct net_counters *c = &cur->net[i];
+    int j = seconds ? iostat_find(c->name, prev->net[0].name, sizeof(*c),
+                                  prev->num_nets, i)
+                    : -1;
+    memset(&net[i], 0, sizeof(net[i]));
+    memcpy(net[i].name, c->name, IOSTAT_NAME_LEN);
+    if (j < 0)
+      continue;
+    const struct net_counters *p = &prev->net[j];
+    net[i].rx_bps = iostat_rate(p->rx_bytes, c->rx_bytes, seconds);
+    net[i].tx_bps = iostat_rate(p->tx_bytes, c->tx_bytes, seconds);
+    net[i].rx_pps = iostat_rate(p->rx_packets, c->rx_packets, seconds);
+    net[i].tx_pps = iostat_rate(p->tx_packets, c->tx_packets, seconds);
+    net[i].drops = iostat_rate(p->rx_drop, c->rx_drop, seconds) +
+                   iostat_rate(p->tx_drop, c->tx_drop, seconds);
+  }
+}
+
+#endif // IOSTAT_H
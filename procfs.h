@@ -0,0 +1,119 @@
+// Long-lived readers for /proc and /sys files.
+// Shared by sys-genmon and the Raccoon Monitor plugin.
+//
+// Each source is opened once and re-read with pread(fd, buf, n, 0), so the
+// steady state is one syscall per file per sample (plus one to see EOF).
+// procfs and sysfs regenerate their contents on every read from offset 0.
+
+#ifndef PROCFS_H
+#define PROCFS_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#define PROCFS_INITIAL_CAP 4096
+
+struct procfs_file {
+  const char *path;
+  int fd; // -1 until the first read
+};
+
+// Caller-owned read buffer. Starts empty ({0}) and grows to fit the file.
+// data is always NUL-terminated after a successful read.
+struct procfs_buf {
+  char *data;
+  size_t len;
+  size_t cap;
+};
+
+#define PROCFS_FILE(p) {.path = (p), .fd = -1}
+
+static inline int procfs_open(struct procfs_file *f) {
+  if (f->fd < 0)
+    f->fd = open(f->path, O_RDONLY | O_CLOEXEC);
+  return f->fd;
+}
+
+static inline void procfs_close(struct procfs_file *f) {
+  if (f->fd >= 0)
+    close(f->fd);
+  f->fd = -1;
+}
+
+static inline void procfs_buf_free(struct procfs_buf *buf) {
+  free(buf->data);
+  buf->data = NULL;
+  buf->len = buf->cap = 0;
+}
+
+// pread until EOF or until dst is full. Returns bytes read, or -1.
+static inline ssize_t procfs_pread_all(int fd, char *dst, size_t n) {
+  size_t got = 0;
+  while (got < n) {
+    ssize_t r = pread(fd, dst + got, n - got, got);
+    if (r < 0) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    if (r == 0)
+      break;
+    got += r;
+  }
+  return got;
+}
+
+// Re-read the whole file into buf. If the contents fill the buffer, it is
+// doubled and the read restarts from offset 0 so the result is one
+// consistent snapshot. Returns the number of bytes read, or -1.
+static inline ssize_t procfs_read(struct procfs_file *f, struct procfs_buf *buf) {
+  if (procfs_open(f) < 0)
+    return -1;
+
+  if (!buf->data) {
+    buf->data = malloc(PROCFS_INITIAL_CAP);
+    if (!buf->data)
+      return -1;
+    buf->cap = PROCFS_INITIAL_CAP;
+  }
+
+  while (1) {
+    // Keep one byte back for the terminator.
+    ssize_t n = procfs_pread_all(f->fd, buf->data, buf->cap - 1);
+    if (n < 0) {
+      // Reopen next time, in case the source went away and came back.
+      procfs_close(f);
+      return -1;
+    }
+    if ((size_t)n < buf->cap - 1) {
+      buf->data[n] = '\0';
+      buf->len = n;
+      return n;
+    }
+
+    char *grown = realloc(buf->data, buf->cap * 2);
+    if (!grown)
+      return -1;
+    buf->data = grown;
+    buf->cap *= 2;
+  }
+}
+
+// Read at most n - 1 bytes from the start of the file into dst, for sources
+// where only the head matters. dst is NUL-terminated. Returns bytes read, or -1.
+static inline ssize_t procfs_read_head(struct procfs_file *f, char *dst, size_t n) {
+  if (!n || procfs_open(f) < 0)
+    return -1;
+  ssize_t got = procfs_pread_all(f->fd, dst, n - 1);
+  if (got < 0) {
+    procfs_close(f);
+    return -1;
+  }
+  dst[got] = '\0';
+  return got;
+}
+
+#endif // PROCFS_H
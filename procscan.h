@@ -0,0 +1,411 @@
+// Top processes by CPU and resident memory, from /proc/[pid]/stat.
+// Used by sys-genmon.
+//
+// A full pass over /proc is too slow to repeat every tick on build
+// servers with thousands of processes (listing 5000 pids alone takes
+// milliseconds), so the scanner is incremental:
+//  - A pid-sorted table remembers each process' last utime + stime, so
+//    CPU% is the delta over that process' own interval.
+//  - The root directory stays open. Each sample only reads the entries
+//    after the highest pid seen (seekdir to where the last listing
+//    ended); new pids are appended. The whole list is read again every
+//    PROCSCAN_RELIST samples, and when /proc/loadavg shows pids wrapped.
+//    Exits show up as stat reads failing.
+//  - Each process' stat file is opened once (openat on the root dirfd)
+//    and re-read with pread, while there are fds to spare.
+//  - A sample reads at most PROCSCAN_BUDGET stat files: new processes and
+//    ones that used CPU last time first, then the idle rest round-robin.
+//    Most processes are idle, so busy ones are read every sample and the
+//    others are checked over a few samples.
+// root is the procfs mount, so a fake tree can stand in for /proc.
+
+#ifndef PROCSCAN_H
+#define PROCSCAN_H
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "tokenize.h"
+
+#define PROCSCAN_BUDGET 128 // stat reads per sample
+#define PROCSCAN_RELIST 64  // Samples between full listings
+#define PROCSCAN_TOP 5
+#define PROCSCAN_COMM_LEN 16
+
+struct proc_entry {
+  int pid;
+  int fd;             // Open on [pid]/stat, or -1
+  uint64_t ticks;     // utime + stime at the last read
+  uint64_t read_ns;   // Time of the last read, 0 before the first
+  float cpu;          // Percent of one CPU over the last read's interval
+  uint32_t rss_kb;
+  uint32_t read_seq;  // Sample that last read it
+  uint8_t hot;        // Used CPU last time, or has no delta yet
+  uint8_t gone;       // stat unreadable; dropped at the next listing
+  char comm[PROCSCAN_COMM_LEN];
+};
+
+struct top_process {
+  int32_t pid;
+  uint32_t rss_kb;
+  float cpu;
+  char comm[PROCSCAN_COMM_LEN];
+};
+
+struct proc_scanner {
+  const char *root;
+  int root_fd;
+  DIR *dir;                 // root, kept open for incremental listing
+  long tail;                // telldir() after the highest pid listed
+  int max_pid;
+  int last_pid;             // /proc/loadavg's at the last listing
+  unsigned since_list;      // Samples since the last full listing
+  size_t num_gone;
+  struct proc_entry *procs; // Sorted by pid
+  size_t num_procs, cap;
+  int *pids;                // Listing scratch, kept between samples
+  size_t pids_cap;
+  size_t open_fds, max_fds;
+  int cursor;               // Pid the round-robin resumes at
+  uint32_t seq;
+  long clk_tck;
+  long page_kb;
+};
+
+// Returns 0, or -1 if root can't be opened.
+static inline int procscan_init(struct proc_scanner *s, const char *root) {
+  memset(s, 0, sizeof(*s));
+  s->root = root;
+  s->root_fd = open(root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  int list_fd = s->root_fd >= 0 ? openat(s->root_fd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC) : -1;
+  s->dir = list_fd >= 0 ? fdopendir(list_fd) : NULL;
+  if (!s->dir) {
+    if (list_fd >= 0)
+      close(list_fd);
+    if (s->root_fd >= 0)
+      close(s->root_fd);
+    s->root_fd = -1;
+    return -1;
+  }
+  s->since_list = PROCSCAN_RELIST; // Full listing first
+  s->clk_tck = sysconf(_SC_CLK_TCK);
+  s->page_kb = sysconf(_SC_PAGESIZE) / 1024;
+
+  // Keep stat files open for as many processes as the fd limit allows,
+  // leaving room for everything else.
+  struct rlimit rl;
+  if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+    if (rl.rlim_cur < rl.rlim_max) {
+      rl.rlim_cur = rl.rlim_max < 65536 ? rl.rlim_max : 65536;
+      setrlimit(RLIMIT_NOFILE, &rl);
+      getrlimit(RLIMIT_NOFILE, &rl);
+    }
+    s->max_fds = rl.rlim_cur > 512 ? rl.rlim_cur - 256 : 0;
+  }
+  return 0;
+}
+
+static inline void procscan_drop(struct proc_scanner *s, struct proc_entry *p) {
+  if (p->fd >= 0) {
+    close(p->fd);
+    s->open_fds--;
+  }
+  p->fd = -1;
+}
+
+static inline void procscan_free(struct proc_scanner *s) {
+  for (size_t i = 0; i < s->num_procs; i++)
+    procscan_drop(s, &s->procs[i]);
+  free(s->procs);
+  free(s->pids);
+  if (s->dir)
+    closedir(s->dir);
+  if (s->root_fd >= 0)
+    close(s->root_fd);
+  memset(s, 0, sizeof(*s));
+  s->root_fd = -1;
+}
+
+static inline int procscan_cmp_pid(const void *a, const void *b) {
+  return *(const int *)a - *(const int *)b;
+}
+
+static inline int procscan_grow(struct proc_scanner *s, size_t n) {
+  if (n <= s->cap)
+    return 0;
+  size_t cap = s->cap ? s->cap : 1024;
+  while (cap < n)
+    cap *= 2;
+  struct proc_entry *grown = realloc(s->procs, cap * sizeof(*grown));
+  if (!grown)
+    return -1;
+  s->procs = grown;
+  s->cap = cap;
+  return 0;
+}
+
+static inline void procscan_new(struct proc_entry *p, int pid) {
+  memset(p, 0, sizeof(*p));
+  p->pid = pid;
+  p->fd = -1;
+  p->hot = 1;
+}
+
+// Read pid entries from the directory's current position into s->pids,
+// sorted. Leaves s->tail after the highest. Returns the count, or -1.
+static inline ssize_t procscan_read_pids(struct proc_scanner *s) {
+  size_t n = 0;
+  int sorted = 1;
+  struct dirent *de;
+  while ((de = readdir(s->dir))) {
+    if (de->d_name[0] < '0' || de->d_name[0] > '9')
+      continue;
+    if (n == s->pids_cap) {
+      size_t cap = s->pids_cap ? s->pids_cap * 2 : 1024;
+      int *grown = realloc(s->pids, cap * sizeof(*grown));
+      if (!grown)
+        return -1;
+      s->pids = grown;
+      s->pids_cap = cap;
+    }
+    s->pids[n] = atoi(de->d_name);
+    if (s->pids[n] >= s->max_pid) {
+      s->max_pid = s->pids[n];
+      s->tail = telldir(s->dir);
+    }
+    sorted &= !n || s->pids[n - 1] < s->pids[n];
+    n++;
+  }
+  if (!sorted) // procfs lists pids in order; fake trees may not
+    qsort(s->pids, n, sizeof(*s->pids), procscan_cmp_pid);
+  return (ssize_t)n;
+}
+
+// Bring the table in line with every pid directory under root. Returns 0,
+// or -1 if out of memory (the table is left as it was).
+static inline int procscan_list_all(struct proc_scanner *s, int last_pid) {
+  s->last_pid = last_pid;
+  rewinddir(s->dir);
+  s->max_pid = 0;
+  s->tail = telldir(s->dir);
+  ssize_t listed = procscan_read_pids(s);
+  if (listed < 0 || procscan_grow(s, (size_t)listed))
+    return -1;
+  size_t n = (size_t)listed;
+
+  // First drop the entries that are gone, compacting the survivors.
+  size_t old = s->num_procs, kept = 0;
+  for (size_t i = 0, j = 0; i < old; i++) {
+    struct proc_entry *p = &s->procs[i];
+    while (j < n && s->pids[j] < p->pid)
+      j++;
+    if (j < n && s->pids[j] == p->pid && !p->gone)
+      s->procs[kept++] = *p;
+    else
+      procscan_drop(s, p);
+  }
+  // Then spread them out from the back to make room for the new pids.
+  size_t i = kept, out = n;
+  for (size_t j = n; j-- > 0;) {
+    struct proc_entry *dst = &s->procs[--out];
+    if (i > 0 && s->procs[i - 1].pid == s->pids[j])
+      *dst = s->procs[--i];
+    else
+      procscan_new(dst, s->pids[j]);
+  }
+  s->num_procs = n;
+  s->num_gone = 0;
+  s->since_list = 0;
+  return 0;
+}
+
+// Highest pid handed out, from the last field of /proc/loadavg, or -1.
+static inline int procscan_last_pid(struct proc_scanner *s) {
+  char buf[128];
+  int fd = openat(s->root_fd, "loadavg", O_RDONLY | O_CLOEXEC);
+  ssize_t len = fd >= 0 ? pread(fd, buf, sizeof(buf) - 1, 0) : -1;
+  if (fd >= 0)
+    close(fd);
+  if (len <= 0)
+    return -1;
+  buf[len] = '\0';
+  const char *last = strrchr(buf, ' ');
+  if (!last)
+    return -1;
+  int err = 0;
+  last++;
+  uint64_t pid = tok_u64(&last, buf + len, &err);
+  return err || pid > INT32_MAX ? -1 : (int)pid;
+}
+
+// Append the pids created since the last listing and drop the ones that
+// failed to read. Falls back to a full listing when pids wrapped.
+static inline int procscan_list(struct proc_scanner *s) {
+  int last_pid = procscan_last_pid(s);
+  if (++s->since_list >= PROCSCAN_RELIST ||
+      (last_pid >= 0 && last_pid < s->max_pid))
+    return procscan_list_all(s, last_pid);
+
+  if (s->num_gone) {
+    size_t kept = 0;
+    for (size_t i = 0; i < s->num_procs; i++) {
+      if (s->procs[i].gone)
+        procscan_drop(s, &s->procs[i]);
+      else
+        s->procs[kept++] = s->procs[i];
+    }
+    s->num_procs = kept;
+    s->num_gone = 0;
+  }
+
+  if (last_pid >= 0 && (last_pid <= s->max_pid || last_pid == s->last_pid))
+    return 0; // Nothing forked since the last listing
+  s->last_pid = last_pid;
+  seekdir(s->dir, s->tail);
+  int max_pid = s->max_pid;
+  ssize_t n = procscan_read_pids(s);
+  if (n < 0)
+    return -1;
+  for (ssize_t j = 0; j < n; j++) {
+    if (s->pids[j] <= max_pid)
+      continue; // The entry the listing resumed at
+    if (procscan_grow(s, s->num_procs + 1))
+      return -1;
+    procscan_new(&s->procs[s->num_procs++], s->pids[j]);
+  }
+  return 0;
+}
+
+// Read one process' stat. Returns 0, or -1 if it went away.
+static inline int procscan_read(struct proc_scanner *s, struct proc_entry *p,
+                                uint64_t now_ns) {
+  char buf[512];
+  int fd = p->fd;
+  if (fd < 0) {
+    char name[24];
+    snprintf(name, sizeof(name), "%d/stat", p->pid);
+    fd = openat(s->root_fd, name, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+      return -1;
+    if (s->open_fds < s->max_fds) {
+      p->fd = fd;
+      s->open_fds++;
+    }
+  }
+  ssize_t len = pread(fd, buf, sizeof(buf) - 1, 0);
+  if (fd != p->fd)
+    close(fd);
+  if (len <= 0)
+    return -1;
+  buf[len] = '\0';
+
+  // "pid (comm) state ppid ..." where comm may hold spaces and parens.
+  char *open = strchr(buf, '('), *close_paren = strrchr(buf, ')');
+  if (!open || !close_paren || close_paren < open)
+    return -1;
+  size_t comm_len = close_paren - open - 1;
+  comm_len = comm_len < PROCSCAN_COMM_LEN - 1 ? comm_len : PROCSCAN_COMM_LEN - 1;
+  memcpy(p->comm, open + 1, comm_len);
+  p->comm[comm_len] = '\0';
+
+  // Fields after comm, 1-based from state: utime 12, stime 13, rss 22.
+  uint64_t field[23] = {0};
+  const char *c = close_paren + 2, *end = buf + len;
+  int err = 0; // The state letter and negative fields read 0
+  for (int k = 1; k <= 22 && c < end; k++) {
+    field[k] = tok_u64(&c, end, &err);
+    c = tok_find(c, end, ' ');
+  }
+  uint64_t ticks = field[12] + field[13];
+
+  // Ticks going backwards mean the pid was reused; start that one over.
+  if (p->read_ns && now_ns > p->read_ns && s->clk_tck > 0 &&
+      ticks >= p->ticks) {
+    double seconds = (now_ns - p->read_ns) / 1e9;
+    p->cpu = (float)((ticks - p->ticks) * 100.0 / s->clk_tck / seconds);
+    p->hot = ticks != p->ticks;
+  } else {
+    p->cpu = 0;
+    p->hot = 1; // Read again next time to get a delta
+  }
+  p->ticks = ticks;
+  p->read_ns = now_ns;
+  p->rss_kb = (uint32_t)(field[22] * s->page_kb);
+  p->read_seq = s->seq;
+  return 0;
+}
+
+// Refresh the table, reading at most PROCSCAN_BUDGET processes.
+static inline void procscan_sample(struct proc_scanner *s, uint64_t now_ns) {
+  if (!s->dir || procscan_list(s))
+    return;
+  s->seq++;
+  size_t budget = PROCSCAN_BUDGET;
+
+  for (size_t i = 0; i < s->num_procs && budget; i++) {
+    struct proc_entry *p = &s->procs[i];
+    if (p->hot && !p->gone) {
+      p->gone = procscan_read(s, p, now_ns) != 0;
+      s->num_gone += p->gone;
+      budget--;
+    }
+  }
+
+  // The rest, round-robin from where the last sample stopped.
+  size_t start = 0;
+  while (start < s->num_procs && s->procs[start].pid < s->cursor)
+    start++;
+  for (size_t k = 0; k < s->num_procs && budget; k++) {
+    struct proc_entry *p = &s->procs[(start + k) % s->num_procs];
+    if (p->read_seq == s->seq || p->gone)
+      continue;
+    p->gone = procscan_read(s, p, now_ns) != 0;
+    s->num_gone += p->gone;
+    s->cursor = p->pid + 1;
+    budget--;
+  }
+}
+
+// Insert p into top (sorted by key, at most PROCSCAN_TOP) if it ranks.
+static inline void procscan_rank(struct top_process *top, size_t *n,
+                                 const struct proc_entry *p, int by_rss) {
+  float key = by_rss ? (float)p->rss_kb : p->cpu;
+  size_t at = *n;
+  while (at > 0 && key > (by_rss ? (float)top[at - 1].rss_kb : top[at - 1].cpu))
+    at--;
+  if (at >= PROCSCAN_TOP)
+    return;
+  size_t last = *n < PROCSCAN_TOP ? *n : PROCSCAN_TOP - 1;
+  memmove(&top[at + 1], &top[at], (last - at) * sizeof(*top));
+  top[at].pid = p->pid;
+  top[at].rss_kb = p->rss_kb;
+  top[at].cpu = p->cpu;
+  memcpy(top[at].comm, p->comm, sizeof(top[at].comm));
+  *n = last + 1;
+}
+
+// The busiest processes by CPU (those that used any), and the largest by
+// resident memory.
+static inline void procscan_top(const struct proc_scanner *s,
+                                struct top_process *by_cpu, size_t *num_cpu,
+                                struct top_process *by_rss, size_t *num_rss) {
+  *num_cpu = *num_rss = 0;
+  for (size_t i = 0; i < s->num_procs; i++) {
+    const struct proc_entry *p = &s->procs[i];
+    if (!p->read_ns || p->gone)
+      continue;
+    if (p->cpu > 0)
+      procscan_rank(by_cpu, num_cpu, p, 0);
+    if (p->rss_kb)
+      procscan_rank(by_rss, num_rss, p, 1);
+  }
+}
+
+#endif // PROCSCAN_H
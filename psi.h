@@ -0,0 +1,170 @@
+// Pressure stall information from /proc/pressure/{cpu,memory,io}, and
+// from the cgroup v2 *.pressure files of our own cgroup when there is one.
+// Shared by sys-genmon and the Raccoon Monitor plugin.
+//
+// "some" is the share of time at least one task was stalled on the
+// resource, "full" the share all non-idle tasks were. The kernel's avg10
+// and avg60 are running averages; the stall over the caller's own
+// interval comes from the total= counters (microseconds) of two reads,
+// kept in a caller-provided baseline so it can live in shared memory.
+// Every file is opened once and re-read with pread (procfs.h).
+
+#ifndef PSI_H
+#define PSI_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "procfs.h"
+#include "tokenize.h"
+
+#define PSI_RESOURCES 3 // cpu, memory, io
+#define PSI_SCOPES 2    // System, cgroup
+#define PSI_PATH_MAX 512
+
+static const char *const psi_names[PSI_RESOURCES] = {"cpu", "memory", "io"};
+
+struct psi_pressure {
+  float some_avg10, some_avg60;
+  float full_avg10, full_avg60;
+  float some_stall, full_stall; // Percent of the last interval
+};
+
+struct psi_record {
+  struct psi_pressure scope[PSI_SCOPES][PSI_RESOURCES];
+  uint8_t have[PSI_SCOPES]; // Whether the scope's files could be read
+};
+
+// Totals of the previous read, 0 before the first.
+struct psi_baseline {
+  uint64_t ns;
+  uint64_t some_us[PSI_SCOPES][PSI_RESOURCES];
+  uint64_t full_us[PSI_SCOPES][PSI_RESOURCES];
+};
+
+struct psi_reader {
+  struct procfs_file file[PSI_SCOPES][PSI_RESOURCES];
+  char path[PSI_SCOPES][PSI_RESOURCES][PSI_PATH_MAX];
+  struct procfs_buf buf;
+};
+
+// Our cgroup v2 directory from /proc/self/cgroup ("0::/path"), or an
+// empty string in the root cgroup (the system files cover that) or on
+// cgroup v1.
+static inline void psi_cgroup_dir(const char *proc, const char *sys_cgroup,
+                                  char *dir, size_t n) {
+  char path[PSI_PATH_MAX];
+  struct procfs_buf b = {0};
+  snprintf(path, sizeof(path), "%s/self/cgroup", proc);
+  struct procfs_file f = PROCFS_FILE(path);
+  ssize_t len = procfs_read(&f, &b);
+  procfs_close(&f);
+  *dir = '\0';
+  for (char *line = len > 0 ? b.data : NULL; line && *line;) {
+    char *nl = strchr(line, '\n');
+    if (nl)
+      *nl = '\0';
+    if (!strncmp(line, "0::/", 4) && line[4])
+      snprintf(dir, n, "%s%s", sys_cgroup, line + 3);
+    line = nl ? nl + 1 : NULL;
+  }
+  procfs_buf_free(&b);
+}
+
+// proc and sys_cgroup are the procfs and cgroup2 mounts.
+static inline void psi_init(struct psi_reader *r, const char *proc,
+                            const char *sys_cgroup) {
+  memset(r, 0, sizeof(*r));
+  char cgroup[PSI_PATH_MAX - 16];
+  psi_cgroup_dir(proc, sys_cgroup, cgroup, sizeof(cgroup));
+  for (int k = 0; k < PSI_RESOURCES; k++) {
+    snprintf(r->path[0][k], PSI_PATH_MAX, "%s/pressure/%s", proc, psi_names[k]);
+    if (*cgroup)
+      snprintf(r->path[1][k], PSI_PATH_MAX, "%s/%s.pressure", cgroup,
+               psi_names[k]);
+    for (int s = 0; s < PSI_SCOPES; s++)
+      r->file[s][k] = (struct procfs_file)PROCFS_FILE(r->path[s][k]);
+  }
+}
+
+static inline void psi_free(struct psi_reader *r) {
+  for (int s = 0; s < PSI_SCOPES; s++)
+    for (int k = 0; k < PSI_RESOURCES; k++)
+      procfs_close(&r->file[s][k]);
+  procfs_buf_free(&r->buf);
+}
+
+// "avg10=1.52 avg60=2.68 avg300=5.08 total=62362121" after "some " or
+// "full ". Hundredths are all the kernel prints.
+static inline const char *psi_parse_line(const char *p, const char *end,
+                                         float *avg10, float *avg60,
+                                         uint64_t *total) {
+  const char *nl = tok_find(p, end, '\n');
+  int err = 0; // Missing values read 0
+  for (int field = 0; field < 4; field++) {
+    p = tok_find(p, nl, '=');
+    if (p == nl)
+      break;
+    p++;
+    uint64_t whole = tok_u64(&p, nl, &err), frac = 0, scale = 1;
+    if (p < nl && *p == '.') {
+      const char *digits = ++p;
+      frac = tok_u64(&p, nl, &err);
+      scale = p - digits <= 8 ? tok_pow10[p - digits] : 0;
+    }
+    float v = whole + (scale ? (float)frac / scale : 0);
+    if (field == 0)
+      *avg10 = v;
+    else if (field == 1)
+      *avg60 = v;
+    else if (field == 3)
+      *total = whole;
+  }
+  return nl < end ? nl + 1 : end;
+}
+
+static inline float psi_stall(uint64_t prev, uint64_t cur, uint64_t dt_ns) {
+  if (!prev || cur < prev || !dt_ns)
+    return 0;
+  float stall = (cur - prev) * 1000.0f / dt_ns * 100.0f;
+  return stall < 100 ? stall : 100;
+}
+
+// Read every file into out, computing stalls against base and then
+// making this read the new base.
+static inline void psi_read(struct psi_reader *r, struct psi_baseline *base,
+                            struct psi_record *out, uint64_t now_ns) {
+  uint64_t dt = base->ns && now_ns > base->ns ? now_ns - base->ns : 0;
+  memset(out, 0, sizeof(*out));
+  for (int s = 0; s < PSI_SCOPES; s++) {
+    for (int k = 0; k < PSI_RESOURCES && *r->path[s][k]; k++) {
+      ssize_t len = procfs_read(&r->file[s][k], &r->buf);
+      if (len <= 0)
+        break;
+      struct psi_pressure *p = &out->scope[s][k];
+      uint64_t some = 0, full = 0;
+      for (const char *c = r->buf.data, *end = c + len; c < end;) {
+        if (!strncmp(c, "some ", 5))
+          c = psi_parse_line(c + 5, end, &p->some_avg10, &p->some_avg60, &some);
+        else if (!strncmp(c, "full ", 5))
+          c = psi_parse_line(c + 5, end, &p->full_avg10, &p->full_avg60, &full);
+        else
+          c = tok_next_line(c, end);
+      }
+      p->some_stall = psi_stall(base->some_us[s][k], some, dt);
+      p->full_stall = psi_stall(base->full_us[s][k], full, dt);
+      base->some_us[s][k] = some;
+      base->full_us[s][k] = full;
+      out->have[s] = k == PSI_RESOURCES - 1;
+    }
+  }
+  base->ns = now_ns;
+}
+
+// 0 (green), 1 (amber) or 2 (red) for a resource, by its some avg10.
+static inline int psi_level(const struct psi_pressure *p) {
+  return p->some_avg10 >= 40 ? 2 : p->some_avg10 >= 10 ? 1 : 0;
+}
+
+#endif // PSI_H
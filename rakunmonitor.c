@@ -16,9 +16,16 @@
 #include <string.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 
-#define MAX_NUM_CPUS 256
+#include "burst.h"
+#include "coremap.h"
+#include "cpufreq.h"
+#include "cpustat.h"
+#include "heatmap.h"
+#include "procfs.h"
+#include "psi.h"
 
 /* Plugin structure */
 typedef struct {
@@ -26,19 +33,59 @@ typedef struct {
 
     /* Widgets */
     GtkWidget *ebox;
-    GtkWidget *image;
+    GtkWidget *area;
 
     /* Update timer */
     guint timeout_id;
 
-    /* CPU data */
-    struct cpu_instance {
-        char cpu_number[16];
-        uint32_t user, system, idle, iowait, irq, softirq, steal, guest;
-    } cpu_current[MAX_NUM_CPUS];
-    struct cpu_instance cpu_prev[MAX_NUM_CPUS];
+    /* Microbursts: /proc/stat sub-sampled at BURST_HZ between updates,
+     * only while the "Show microbursts" setting is on */
+    gboolean bursts;
+    guint burst_id;
+    struct burst burst;
+    struct burst_stats burst_stats;
+
+    /* /proc/stat, opened once and re-read with pread() */
+    struct procfs_file stat_file;
+    struct procfs_buf stat_buf;
+
+    /* Per-core cpufreq readers, kept open */
+    struct cpufreq freq;
+
+    /* Pressure stall information, system-wide and for our cgroup */
+    struct psi_reader psi;
+    struct psi_baseline psi_base;
+    struct psi_record psi_info;
+
+    /* CPU data (cpustat.h), sized once from the detected topology */
+    struct cpu_record cpu_current;
+    struct cpu_record cpu_prev;
     size_t num_cpus;
-    float utilization[MAX_NUM_CPUS];
+    size_t num_cpu_slots;
+    float *utilization;
+    float avg_utilization;
+
+    /* Core tiles, laid out once from the CPU topology (coremap.h) */
+    struct coremap chip;
+
+    /* Many-core hosts: one heatmap cell per core instead of the M1 tiles */
+    struct heatmap heatmap;
+    cairo_surface_t *heatmap_grid;
+
+    /* Static artwork rendered once per window scale (see build_layers) */
+    cairo_surface_t *base_layer;    /* background and core outlines */
+    cairo_surface_t *detail_layer;  /* core line art, drawn over the fills */
+    cairo_surface_t *header_layer;  /* rainbow header tinted for header_heat */
+    int layer_scale;
+    int header_heat;                /* -1 until rendered */
+    int header_psi;                 /* shown_psi the header has, -1 until rendered */
+
+    /* What is on screen, in whole percent; changes are what gets damaged */
+    uint8_t *shown;
+    uint8_t *shown_freq;            /* tint step 0-10 per core tile */
+    uint8_t *shown_peak;            /* burst peak per core tile, 0 if none */
+    uint8_t shown_avg;
+    int shown_psi;                  /* psi_levels(), 0 if no pressure files */
 
     /* Shared memory for persistent stats */
     char shm_name[256];
@@ -48,99 +95,244 @@ typedef struct {
 
 /* Parse /proc/stat to get CPU info */
 static void get_cpu_info(RakunMonitor *rakun) {
-    FILE *fp = fopen("/proc/stat", "r");
-    if (!fp) return;
-
-    char line[512];
-    rakun->num_cpus = 0;
+    ssize_t n = procfs_read(&rakun->stat_file, &rakun->stat_buf);
+    if (n <= 0 || cpustat_parse(&rakun->cpu_current, rakun->stat_buf.data, n) != 0) {
+        rakun->cpu_current.num_cpus = 0;
+    }
+    cpufreq_read(&rakun->freq, &rakun->cpu_current);
+    rakun->num_cpus = rakun->cpu_current.num_cpus;
+}
 
-    // Skip first summary line
-    if (!fgets(line, sizeof(line), fp)) {
-        fclose(fp);
+/* Calculate CPU utilization percentages */
+static void calculate_utilization(RakunMonitor *rakun) {
+    if (rakun->cpu_prev.num_cpus != rakun->cpu_current.num_cpus) {
+        // CPU went away or /proc/stat was unreadable, show idle this tick
+        memset(rakun->utilization, 0, rakun->num_cpu_slots * sizeof(float));
+        rakun->avg_utilization = 0.0;
         return;
     }
+    rakun->avg_utilization = cpustat_utilization(&rakun->cpu_prev, &rakun->cpu_current,
+                                                 rakun->utilization);
+}
 
-    // Parse individual CPU lines
-    while (fgets(line, sizeof(line), fp) && rakun->num_cpus < MAX_NUM_CPUS) {
-        if (strncmp(line, "cpu", 3) != 0) break;
-        if (!isdigit(line[3])) continue;
+#define BURST_HZ 20
 
-        struct cpu_instance *cpu = &rakun->cpu_current[rakun->num_cpus];
+/* Take a burst sub-sample */
+static gboolean rakun_burst(gpointer user_data) {
+    RakunMonitor *rakun = (RakunMonitor *)user_data;
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    burst_sample(&rakun->burst, &rakun->stat_file, &rakun->stat_buf,
+                 (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec);
+    return TRUE;
+}
 
-        unsigned long nice, guest_nice;
-        if (sscanf(line, "%15s %u %lu %u %u %u %u %u %u %u %lu",
-                   cpu->cpu_number,
-                   &cpu->user, &nice, &cpu->system, &cpu->idle,
-                   &cpu->iowait, &cpu->irq, &cpu->softirq,
-                   &cpu->steal, &cpu->guest, &guest_nice) >= 5) {
-            rakun->num_cpus++;
-        }
+/* Start or stop the sub-sampling timer; off, the panel wakes only for
+ * rakun_update */
+static void set_bursts(RakunMonitor *rakun, gboolean on) {
+    rakun->bursts = on;
+    if (on && rakun->burst_id == 0) {
+        rakun->burst.last_ns = 0; // The last sub-sample is stale by now
+        rakun->burst_id = g_timeout_add(1000 / BURST_HZ, rakun_burst, rakun);
+    } else if (!on && rakun->burst_id != 0) {
+        g_source_remove(rakun->burst_id);
+        rakun->burst_id = 0;
     }
+}
 
-    fclose(fp);
+static void rakun_bursts_toggled(GtkCheckMenuItem *item, RakunMonitor *rakun) {
+    set_bursts(rakun, gtk_check_menu_item_get_active(item));
+    xfce_panel_plugin_save(rakun->plugin);
 }
 
-/* Calculate CPU utilization percentages */
-static void calculate_utilization(RakunMonitor *rakun) {
-    for (size_t i = 0; i < rakun->num_cpus; i++) {
-        struct cpu_instance *prev = &rakun->cpu_prev[i];
-        struct cpu_instance *curr = &rakun->cpu_current[i];
+/* Settings live in the rc file the panel keeps for this instance */
+static void rakun_read_settings(RakunMonitor *rakun) {
+    gchar *file = xfce_panel_plugin_lookup_rc_file(rakun->plugin);
+    XfceRc *rc = file ? xfce_rc_simple_open(file, TRUE) : NULL;
+    g_free(file);
+    rakun->bursts = rc && xfce_rc_read_bool_entry(rc, "bursts", FALSE);
+    if (rc)
+        xfce_rc_close(rc);
+}
 
-        uint32_t prev_idle = prev->idle + prev->iowait;
-        uint32_t curr_idle = curr->idle + curr->iowait;
+static void rakun_save(XfcePanelPlugin *plugin, RakunMonitor *rakun) {
+    gchar *file = xfce_panel_plugin_save_location(plugin, TRUE);
+    XfceRc *rc = file ? xfce_rc_simple_open(file, FALSE) : NULL;
+    g_free(file);
+    if (!rc)
+        return;
+    xfce_rc_write_bool_entry(rc, "bursts", rakun->bursts);
+    xfce_rc_close(rc);
+}
 
-        uint32_t prev_non_idle = prev->user + prev->system + prev->irq +
-                                  prev->softirq + prev->steal + prev->guest;
-        uint32_t curr_non_idle = curr->user + curr->system + curr->irq +
-                                  curr->softirq + curr->steal + curr->guest;
+/* Lay out the heatmap for hosts with more cores than the tiles fit */
+static void setup_heatmap(RakunMonitor *rakun, int width, int height) {
+    size_t n = rakun->num_cpus;
+    uint32_t *group = g_new(uint32_t, n);
+    heatmap_groups(rakun->cpu_current.id, n, HEATMAP_GROUP_PACKAGE, group);
+    int rc = heatmap_layout(&rakun->heatmap, group, n, width, height, 1);
+    g_free(group);
+    if (rc != 0)
+        return;
 
-        uint32_t prev_total = prev_idle + prev_non_idle;
-        uint32_t curr_total = curr_idle + curr_non_idle;
+    rakun->heatmap_grid = cairo_image_surface_create(CAIRO_FORMAT_ARGB32,
+                                                     rakun->heatmap.grid_w,
+                                                     rakun->heatmap.grid_h);
+}
 
-        // Check for underflow
-        if (curr_idle < prev_idle || curr_total < prev_total) {
-            rakun->utilization[i] = 0.0;
-            continue;
-        }
+/* Draw the per-core heatmap: fill the small grid, scale it up unfiltered */
+static void render_heatmap(cairo_t *cr, RakunMonitor *rakun, int x, int y) {
+    cairo_surface_t *grid = rakun->heatmap_grid;
+    struct heatmap *hm = &rakun->heatmap;
+
+    cairo_surface_flush(grid);
+    uint32_t *pixels = (uint32_t *)cairo_image_surface_get_data(grid);
+    size_t stride = cairo_image_surface_get_stride(grid) / sizeof(uint32_t);
+    memset(pixels, 0, stride * sizeof(uint32_t) * hm->grid_h);
+    // A core that went away keeps its cell but reads idle
+    size_t n = rakun->num_cpus < hm->num_cells ? rakun->num_cpus : hm->num_cells;
+    struct heatmap live = *hm;
+    live.num_cells = n;
+    heatmap_fill_argb(&live, rakun->utilization, pixels, stride);
+    cairo_surface_mark_dirty(grid);
+
+    cairo_save(cr);
+    cairo_translate(cr, x, y);
+    cairo_scale(cr, hm->cell_px, hm->cell_px);
+    cairo_set_source_surface(cr, grid, 0, 0);
+    cairo_pattern_set_filter(cairo_get_source(cr), CAIRO_FILTER_NEAREST);
+    cairo_rectangle(cr, 0, 0, hm->grid_w, hm->grid_h);
+    cairo_fill(cr);
+    cairo_restore(cr);
+}
 
-        uint32_t idle_diff = curr_idle - prev_idle;
-        uint32_t total_diff = curr_total - prev_total;
+/* Chip geometry, in widget pixels */
+#define IMG_WIDTH 290       // Another 10% wider (was 264)
+#define IMG_HEIGHT 92       // 10 header + tile bands with 2px margins
+#define HEADER_HEIGHT 10
+#define MARGIN 2
+#define MIN_TILE 12         // Smaller tiles than this and the heatmap takes over
 
-        if (total_diff > 0) {
-            float ratio_idle = (float)idle_diff / (float)total_diff;
-            rakun->utilization[i] = (1.0 - ratio_idle) * 100.0;
-        } else {
-            rakun->utilization[i] = 0.0;
-        }
-    }
+/* Core tiles on screen: by package and tier, P-cores on top and taller */
+static size_t tiles_shown(RakunMonitor *rakun) {
+    return rakun->heatmap_grid ? 0 : rakun->chip.num_placed;
 }
 
-/* Render M1 chip architecture diagram to Cairo surface */
-static void render_m1_chip(cairo_t *cr, RakunMonitor *rakun, int width, int height) {
-    const int header_height = 10;
-    const int p_core_height = 50;  // Performance cores - TWICE as tall!
-    const int e_core_height = 26;  // Efficiency cores - 30% taller
-    const int margin = 2;
-    const int core_width = 66;   // Wider cores
-    const int core_spacing = 73;  // More spacing to fill 290px canvas
+/* Whole-percent utilization, the resolution the fills and ramp show */
+static uint8_t quantize_util(float util) {
+    return util <= 0 ? 0 : util >= 100 ? 100 : (uint8_t)(util + 0.5f);
+}
 
+/* Static layer under the fills: background and core outlines */
+static void render_base(cairo_t *cr, RakunMonitor *rakun) {
     // Background (semi-transparent)
     cairo_set_source_rgba(cr, 0.0, 0.0, 0.0, 0.6);
-    cairo_rectangle(cr, 0, 0, width, height);
+    cairo_rectangle(cr, 0, HEADER_HEIGHT, IMG_WIDTH, IMG_HEIGHT - HEADER_HEIGHT);
     cairo_fill(cr);
 
-    // Calculate average CPU utilization for dynamic rainbow
-    float avg_util = 0.0;
-    for (size_t i = 0; i < rakun->num_cpus; i++) {
-        avg_util += rakun->utilization[i];
+    // Core outlines (transparent background)
+    cairo_set_source_rgb(cr, 0.25, 0.25, 0.25);
+    cairo_set_line_width(cr, 1);
+    for (size_t k = 0; k < tiles_shown(rakun); k++) {
+        const struct coremap_tile *c = &rakun->chip.tile[k];
+        cairo_rectangle(cr, c->x, c->y, c->w, c->h);
+        cairo_stroke(cr);
+    }
+}
+
+/* Static layer over the fills: the P-core and E-core line art, by each
+ * tile's class; left out on tiles too small for it */
+static void render_details(cairo_t *cr, RakunMonitor *rakun) {
+    for (size_t k = 0; k < tiles_shown(rakun); k++) {
+        const struct coremap_tile *c = &rakun->chip.tile[k];
+        int x = c->x, y = c->y, w = c->w, h = c->h;
+
+        if (c->cls == 'E') {
+            // Horizontal lines (Apple M1 E-core style - 3 lines)
+            if (h < 14)
+                continue;
+            cairo_set_source_rgb(cr, 0.32, 0.32, 0.32);
+            cairo_set_line_width(cr, 2);
+            for (int line = 0; line < 3; line++) {
+                int line_y = y + 6 + line * (h - 12) / 2;
+                cairo_move_to(cr, x + 4, line_y);
+                cairo_line_to(cr, x + w - 4, line_y);
+                cairo_stroke(cr);
+            }
+            continue;
+        }
+
+        // Vertical lines (Apple M1 P-core style - 5 lines with notches)
+        if (w < 32 || h < 20)
+            continue;
+        cairo_set_source_rgb(cr, 0.35, 0.35, 0.35);
+        cairo_set_line_width(cr, 2);
+        const int notch_size = 4;
+        for (int line = 0; line < 5; line++) {
+            int line_x = x + 8 + line * (w - 16) / 4;
+
+            if (line == 0 || line == 4) {
+                // First and last lines: full height
+                cairo_move_to(cr, line_x, y + 4);
+                cairo_line_to(cr, line_x, y + h - 4);
+                cairo_stroke(cr);
+            } else {
+                // Middle lines (1-3): have top and bottom notches
+                cairo_move_to(cr, line_x, y + 4 + notch_size);
+                cairo_line_to(cr, line_x, y + h - 4 - notch_size);
+                cairo_stroke(cr);
+
+                // Draw the notch marks (horizontal bars at top and bottom)
+                cairo_move_to(cr, line_x - 3, y + 4);
+                cairo_line_to(cr, line_x + 3, y + 4);
+                cairo_stroke(cr);
+
+                cairo_move_to(cr, line_x - 3, y + h - 4);
+                cairo_line_to(cr, line_x + 3, y + h - 4);
+                cairo_stroke(cr);
+            }
+        }
     }
-    avg_util /= rakun->num_cpus;
+}
+
+/* Pressure indicator levels, 2 bits per resource (psi_level), plus 1 << 6
+ * when there is anything to show: system-wide, or our cgroup's where
+ * /proc/pressure is hidden */
+static int psi_levels(const struct psi_record *psi) {
+    int s = psi->have[0] ? 0 : 1;
+    if (!psi->have[s])
+        return 0;
+    int levels = 1 << 6;
+    for (int k = 0; k < PSI_RESOURCES; k++)
+        levels |= psi_level(&psi->scope[s][k]) << (2 * k);
+    return levels;
+}
+
+/* CPU, memory and IO pressure as green/amber/red squares at the right of
+ * the header */
+static void render_pressure(cairo_t *cr, int levels) {
+    static const double colors[3][3] = {{0.18, 0.8, 0.44}, {0.95, 0.61, 0.07},
+                                        {0.91, 0.3, 0.24}};
+    if (!levels)
+        return;
+    for (int k = 0; k < PSI_RESOURCES; k++) {
+        const double *c = colors[(levels >> (2 * k)) & 3];
+        double x = IMG_WIDTH - 2 - (PSI_RESOURCES - k) * 8;
+        cairo_rectangle(cr, x, 2, 6, HEADER_HEIGHT - 4);
+        cairo_set_source_rgb(cr, c[0], c[1], c[2]);
+        cairo_fill_preserve(cr);
+        cairo_set_source_rgb(cr, 0, 0, 0);
+        cairo_set_line_width(cr, 0.5);
+        cairo_stroke(cr);
+    }
+}
 
+/* M1 Dynamic Rainbow Gradient Header (shifts red when hot) */
+static void render_header(cairo_t *cr, int heat_percent, int psi_levels) {
     // Heat factor: 0.0 = cool (blue), 1.0 = hot (red)
-    float heat = avg_util / 100.0;
+    float heat = heat_percent / 100.0;
 
-    // M1 Dynamic Rainbow Gradient Header (shifts red when hot)
-    cairo_pattern_t *rainbow = cairo_pattern_create_linear(0, 0, width, 0);
+    cairo_pattern_t *rainbow = cairo_pattern_create_linear(0, 0, IMG_WIDTH, 0);
 
     // Shift color spectrum based on CPU load
     // High load: more red/orange/yellow
@@ -156,103 +348,183 @@ static void render_m1_chip(cairo_t *cr, RakunMonitor *rakun, int width, int heig
     cairo_pattern_add_color_stop_rgb(rainbow, 0.83, 0.29, 0.0, 0.51 - blue_reduce); // Indigo (dim when hot)
     cairo_pattern_add_color_stop_rgb(rainbow, 1.00, 0.58, 0.0, 0.83 - blue_reduce); // Violet (dim when hot)
 
+    cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
     cairo_set_source(cr, rainbow);
-    cairo_rectangle(cr, 0, 0, width, header_height);
+    cairo_rectangle(cr, 0, 0, IMG_WIDTH, HEADER_HEIGHT);
     cairo_fill(cr);
     cairo_pattern_destroy(rainbow);
+    cairo_set_operator(cr, CAIRO_OPERATOR_OVER);
 
     // M1 text
     cairo_select_font_face(cr, "Arial", CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_BOLD);
     cairo_set_font_size(cr, 8);
     cairo_set_source_rgb(cr, 1.0, 1.0, 1.0);
-    cairo_move_to(cr, width/2 - 8, header_height - 2);
+    cairo_move_to(cr, IMG_WIDTH/2 - 8, HEADER_HEIGHT - 2);
     cairo_show_text(cr, "M1");
 
-    int y_offset = header_height + margin;
-
-    // Performance Cores (Top Row) - Cores 0-3
-    for (int i = 0; i < 4 && i < (int)rakun->num_cpus; i++) {
-        int x = margin + (i * core_spacing);
-        float util = rakun->utilization[i];
+    render_pressure(cr, psi_levels);
+}
 
-        // Core outline (transparent background)
-        cairo_set_source_rgb(cr, 0.25, 0.25, 0.25);
-        cairo_set_line_width(cr, 1);
-        cairo_rectangle(cr, x, y_offset, core_width, p_core_height);
-        cairo_stroke(cr);
+/* Frequency tint step (0-10, 0 if unknown) of core i */
+static uint8_t freq_step(RakunMonitor *rakun, int i) {
+    float f = cpufreq_fraction(&rakun->cpu_current, i);
+    return f < 0 ? 0 : (uint8_t)(f * 10 + 0.5f);
+}
 
-        // Utilization fill (blue)
-        if (util > 0) {
-            int fill_height = (int)((p_core_height - 4) * util / 100.0);
-            double alpha = 0.3 + (util / 100.0 * 0.7);
-            cairo_set_source_rgba(cr, 0.2, 0.6, 0.86, alpha);
-            cairo_rectangle(cr, x + 2, y_offset + p_core_height - 2 - fill_height,
-                          core_width - 4, fill_height);
+/* Utilization fills and frequency tints, from the values last damaged
+ * onto the screen */
+static void render_fills(cairo_t *cr, RakunMonitor *rakun) {
+    for (size_t k = 0; k < tiles_shown(rakun); k++) {
+        const struct coremap_tile *c = &rakun->chip.tile[k];
+        int i = c->core, x = c->x, y = c->y, w = c->w, h = c->h;
+
+        // Warms toward amber as the core nears its max frequency
+        if (rakun->shown_freq[i]) {
+            cairo_set_source_rgba(cr, 0.95, 0.6, 0.1, 0.04 * rakun->shown_freq[i]);
+            cairo_rectangle(cr, x + 1, y + 1, w - 2, h - 2);
             cairo_fill(cr);
         }
 
-        // Vertical lines (Apple M1 P-core style - 5 lines with notches)
-        cairo_set_source_rgb(cr, 0.35, 0.35, 0.35);
-        cairo_set_line_width(cr, 2);
-        const int notch_size = 4;
-        for (int line = 0; line < 5; line++) {
-            int line_x = x + 8 + (line * 12);
+        int util = rakun->shown[i];
+        if (util == 0)
+            continue;
 
-            if (line == 0 || line == 4) {
-                // First and last lines: full height
-                cairo_move_to(cr, line_x, y_offset + 4);
-                cairo_line_to(cr, line_x, y_offset + p_core_height - 4);
-                cairo_stroke(cr);
-            } else {
-                // Middle lines (1-3): have top and bottom notches
-                cairo_move_to(cr, line_x, y_offset + 4 + notch_size);
-                cairo_line_to(cr, line_x, y_offset + p_core_height - 4 - notch_size);
-                cairo_stroke(cr);
+        int fill_height = (int)((h - 4) * util / 100.0);
+        double alpha = 0.3 + (util / 100.0 * 0.7);
+        if (c->cls != 'E')
+            cairo_set_source_rgba(cr, 0.2, 0.6, 0.86, alpha);   // blue
+        else
+            cairo_set_source_rgba(cr, 0.36, 0.68, 0.88, alpha); // lighter blue
+        cairo_rectangle(cr, x + 2, y + h - 2 - fill_height, w - 4, fill_height);
+        cairo_fill(cr);
+    }
 
-                // Draw the notch marks (horizontal bars at top and bottom)
-                cairo_move_to(cr, line_x - 3, y_offset + 4);
-                cairo_line_to(cr, line_x + 3, y_offset + 4);
-                cairo_stroke(cr);
+    // Peak markers where a burst went above the interval average
+    for (size_t k = 0; k < tiles_shown(rakun); k++) {
+        const struct coremap_tile *c = &rakun->chip.tile[k];
+        if (!rakun->shown_peak[c->core])
+            continue;
+        int peak_height = (int)((c->h - 4) * rakun->shown_peak[c->core] / 100.0);
+        cairo_set_source_rgba(cr, 1.0, 1.0, 1.0, 0.8);
+        cairo_rectangle(cr, c->x + 2, c->y + c->h - 2 - peak_height, c->w - 4, 1);
+        cairo_fill(cr);
+    }
+}
 
-                cairo_move_to(cr, line_x - 3, y_offset + p_core_height - 4);
-                cairo_line_to(cr, line_x + 3, y_offset + p_core_height - 4);
-                cairo_stroke(cr);
-            }
-        }
+/* Drop the cached layers, they are rebuilt on the next draw */
+static void free_layers(RakunMonitor *rakun) {
+    cairo_surface_t **layers[] = {&rakun->base_layer, &rakun->detail_layer,
+                                  &rakun->header_layer};
+    for (size_t i = 0; i < G_N_ELEMENTS(layers); i++) {
+        if (*layers[i])
+            cairo_surface_destroy(*layers[i]);
+        *layers[i] = NULL;
     }
+    rakun->header_heat = -1;
+    rakun->header_psi = -1;
+}
 
-    y_offset += p_core_height + margin;
+/* Render the static artwork once per window scale */
+static void build_layers(GtkWidget *widget, RakunMonitor *rakun) {
+    GdkWindow *window = gtk_widget_get_window(widget);
+    int scale = gtk_widget_get_scale_factor(widget);
+    if (rakun->base_layer && rakun->layer_scale == scale)
+        return;
+    free_layers(rakun);
+
+    // Similar surfaces pick up the window's device scale, so HiDPI stays sharp
+    rakun->base_layer = gdk_window_create_similar_surface(
+        window, CAIRO_CONTENT_COLOR_ALPHA, IMG_WIDTH, IMG_HEIGHT);
+    rakun->detail_layer = gdk_window_create_similar_surface(
+        window, CAIRO_CONTENT_COLOR_ALPHA, IMG_WIDTH, IMG_HEIGHT);
+    rakun->header_layer = gdk_window_create_similar_surface(
+        window, CAIRO_CONTENT_COLOR_ALPHA, IMG_WIDTH, HEADER_HEIGHT);
+
+    cairo_t *cr = cairo_create(rakun->base_layer);
+    render_base(cr, rakun);
+    cairo_destroy(cr);
 
-    // Efficiency Cores (Bottom Row) - Cores 4-7
-    for (int i = 4; i < 8 && i < (int)rakun->num_cpus; i++) {
-        int x = margin + ((i - 4) * core_spacing);
-        float util = rakun->utilization[i];
+    cr = cairo_create(rakun->detail_layer);
+    render_details(cr, rakun);
+    cairo_destroy(cr);
 
-        // Core outline (transparent background)
-        cairo_set_source_rgb(cr, 0.25, 0.25, 0.25);
-        cairo_set_line_width(cr, 1);
-        cairo_rectangle(cr, x, y_offset, core_width, e_core_height);
-        cairo_stroke(cr);
+    rakun->layer_scale = scale;
+}
 
-        // Utilization fill (lighter blue)
-        if (util > 0) {
-            int fill_height = (int)((e_core_height - 4) * util / 100.0);
-            double alpha = 0.3 + (util / 100.0 * 0.7);
-            cairo_set_source_rgba(cr, 0.36, 0.68, 0.88, alpha);
-            cairo_rectangle(cr, x + 2, y_offset + e_core_height - 2 - fill_height,
-                          core_width - 4, fill_height);
-            cairo_fill(cr);
-        }
+/* Draw handler: composite the cached layers with the live parts.
+ * GTK clips cr to the damaged area, so only changed cores are repainted. */
+static gboolean rakun_draw(GtkWidget *widget, cairo_t *cr, RakunMonitor *rakun) {
+    build_layers(widget, rakun);
+
+    // Header tint is re-rendered only when the whole-percent average or a
+    // pressure level moves
+    if (rakun->header_heat != rakun->shown_avg ||
+        rakun->header_psi != rakun->shown_psi) {
+        cairo_t *hcr = cairo_create(rakun->header_layer);
+        render_header(hcr, rakun->shown_avg, rakun->shown_psi);
+        cairo_destroy(hcr);
+        rakun->header_heat = rakun->shown_avg;
+        rakun->header_psi = rakun->shown_psi;
+    }
 
-        // Horizontal lines (Apple M1 E-core style - 3 lines)
-        cairo_set_source_rgb(cr, 0.32, 0.32, 0.32);
-        cairo_set_line_width(cr, 2);
-        for (int line = 0; line < 3; line++) {
-            int line_y = y_offset + 6 + (line * 7);
-            cairo_move_to(cr, x + 4, line_y);
-            cairo_line_to(cr, x + core_width - 4, line_y);
-            cairo_stroke(cr);
+    cairo_set_source_surface(cr, rakun->base_layer, 0, 0);
+    cairo_paint(cr);
+    cairo_set_source_surface(cr, rakun->header_layer, 0, 0);
+    cairo_paint(cr);
+
+    if (rakun->heatmap_grid) {
+        render_heatmap(cr, rakun, MARGIN, HEADER_HEIGHT + MARGIN);
+        return TRUE;
+    }
+
+    render_fills(cr, rakun);
+    cairo_set_source_surface(cr, rakun->detail_layer, 0, 0);
+    cairo_paint(cr);
+    return TRUE;
+}
+
+/* Queue a redraw of whatever changed at the on-screen resolution */
+static void damage_changes(RakunMonitor *rakun) {
+    GtkWidget *area = rakun->area;
+
+    uint8_t avg = quantize_util(rakun->avg_utilization);
+    int psi = psi_levels(&rakun->psi_info);
+    if (avg != rakun->shown_avg || psi != rakun->shown_psi) {
+        rakun->shown_avg = avg;
+        rakun->shown_psi = psi;
+        gtk_widget_queue_draw_area(area, 0, 0, IMG_WIDTH, HEADER_HEIGHT);
+    }
+
+    if (rakun->heatmap_grid) {
+        // One damage rectangle for the grid if any cell changed color
+        gboolean changed = FALSE;
+        for (size_t i = 0; i < rakun->heatmap.num_cells; i++) {
+            uint8_t q = i < rakun->num_cpus ? quantize_util(rakun->utilization[i]) : 0;
+            changed |= q != rakun->shown[i];
+            rakun->shown[i] = q;
         }
+        if (changed)
+            gtk_widget_queue_draw_area(area, MARGIN, HEADER_HEIGHT + MARGIN,
+                                       rakun->heatmap.grid_w * rakun->heatmap.cell_px,
+                                       rakun->heatmap.grid_h * rakun->heatmap.cell_px);
+        return;
+    }
+
+    for (size_t k = 0; k < tiles_shown(rakun); k++) {
+        const struct coremap_tile *c = &rakun->chip.tile[k];
+        // A core that went away keeps its tile but reads idle
+        int i = c->core, live = (size_t)i < rakun->num_cpus;
+        uint8_t q = live ? quantize_util(rakun->utilization[i]) : 0;
+        uint8_t f = live ? freq_step(rakun, i) : 0;
+        uint8_t peak = live ? rakun->burst_stats.max[i] : 0;
+        peak = peak > q ? peak : 0;
+        if (q == rakun->shown[i] && f == rakun->shown_freq[i] &&
+            peak == rakun->shown_peak[i])
+            continue;
+        rakun->shown[i] = q;
+        rakun->shown_freq[i] = f;
+        rakun->shown_peak[i] = peak;
+        gtk_widget_queue_draw_area(area, c->x, c->y, c->w, c->h);
     }
 }
 
@@ -260,8 +532,10 @@ static void render_m1_chip(cairo_t *cr, RakunMonitor *rakun, int width, int heig
 static gboolean rakun_update(gpointer user_data) {
     RakunMonitor *rakun = (RakunMonitor *)user_data;
 
-    // Save previous CPU stats
-    memcpy(rakun->cpu_prev, rakun->cpu_current, sizeof(rakun->cpu_current));
+    // Current sample becomes the baseline (swaps the arrays, no copy)
+    struct cpu_record prev = rakun->cpu_prev;
+    rakun->cpu_prev = rakun->cpu_current;
+    rakun->cpu_current = prev;
 
     // Get new CPU stats
     get_cpu_info(rakun);
@@ -269,25 +543,18 @@ static gboolean rakun_update(gpointer user_data) {
     // Calculate utilization
     calculate_utilization(rakun);
 
-    // Render to pixbuf
-    const int img_width = 290;  // Another 10% wider (was 264)
-    const int img_height = 92;  // 10 header + 50 P-cores + 2 margin + 26 E-cores + 2 margin + 2 padding
-
-    cairo_surface_t *surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, img_width, img_height);
-    cairo_t *cr = cairo_create(surface);
+    // Peaks since the last update; none if no sub-sample fitted in
+    if (!burst_take(&rakun->burst, &rakun->burst_stats, rakun->num_cpus))
+        memset(rakun->burst_stats.max, 0, rakun->num_cpu_slots * sizeof(uint32_t));
 
-    render_m1_chip(cr, rakun, img_width, img_height);
+    // Pressure, from descriptors kept open
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    psi_read(&rakun->psi, &rakun->psi_base, &rakun->psi_info,
+             (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec);
 
-    // Convert Cairo surface to GdkPixbuf
-    GdkPixbuf *pixbuf = gdk_pixbuf_get_from_surface(surface, 0, 0, img_width, img_height);
-
-    // Update image widget
-    gtk_image_set_from_pixbuf(GTK_IMAGE(rakun->image), pixbuf);
-
-    // Cleanup
-    g_object_unref(pixbuf);
-    cairo_destroy(cr);
-    cairo_surface_destroy(surface);
+    // Repaint only the parts that changed
+    damage_changes(rakun);
 
     return TRUE; // Continue timer
 }
@@ -297,18 +564,58 @@ static RakunMonitor *rakun_construct(XfcePanelPlugin *plugin) {
     RakunMonitor *rakun = g_slice_new0(RakunMonitor);
 
     rakun->plugin = plugin;
+    rakun->header_heat = -1;
+    rakun->header_psi = -1;
+    rakun_read_settings(rakun);
 
     // Initialize shared memory path
     snprintf(rakun->shm_name, sizeof(rakun->shm_name), "/rakunmon_shmem_%d", getuid());
 
+    rakun->stat_file = (struct procfs_file)PROCFS_FILE("/proc/stat");
+    psi_init(&rakun->psi, "/proc", "/sys/fs/cgroup");
+
+    // Size all per-core state from the real CPU count
+    rakun->num_cpu_slots = cpustat_detect_cpus(&rakun->stat_file, &rakun->stat_buf);
+    rakun->utilization = g_new0(float, rakun->num_cpu_slots);
+    rakun->shown = g_new0(uint8_t, rakun->num_cpu_slots);
+    rakun->shown_freq = g_new0(uint8_t, rakun->num_cpu_slots);
+    rakun->shown_peak = g_new0(uint8_t, rakun->num_cpu_slots);
+    rakun->burst_stats.max = g_new0(uint32_t, 3 * rakun->num_cpu_slots);
+    rakun->burst_stats.p95 = rakun->burst_stats.max + rakun->num_cpu_slots;
+    rakun->burst_stats.above_ms = rakun->burst_stats.max + 2 * rakun->num_cpu_slots;
+    if (cpustat_alloc(&rakun->cpu_current, rakun->num_cpu_slots) != 0 ||
+        cpustat_alloc(&rakun->cpu_prev, rakun->num_cpu_slots) != 0 ||
+        cpufreq_init(&rakun->freq, rakun->num_cpu_slots) != 0 ||
+        burst_init(&rakun->burst, rakun->num_cpu_slots, BURST_DEFAULT_THRESHOLD) != 0) {
+        g_error("Raccoon Monitor: out of memory");
+    }
+
+    // Get initial CPU stats (baseline); utilization starts at 0 for first display
+    get_cpu_info(rakun);
+    cpustat_copy(&rakun->cpu_prev, &rakun->cpu_current);
+
+    // Classify the cores once and lay out their tiles; the heatmap if
+    // there are too many to fit
+    struct coremap_core *cores = g_new0(struct coremap_core, rakun->num_cpus + 1);
+    if (coremap_probe("/sys", rakun->cpu_current.id, rakun->num_cpus, cores) < 0 ||
+        coremap_build(&rakun->chip, cores, rakun->num_cpus) != 0) {
+        g_error("Raccoon Monitor: out of memory");
+    }
+    g_free(cores);
+    if (coremap_layout(&rakun->chip, IMG_WIDTH, IMG_HEIGHT, HEADER_HEIGHT, MARGIN,
+                       MIN_TILE) != 0)
+        setup_heatmap(rakun, IMG_WIDTH - 2 * MARGIN, IMG_HEIGHT - HEADER_HEIGHT - 2 * MARGIN);
+
     // Create event box (for tooltips/clicks)
     rakun->ebox = gtk_event_box_new();
     gtk_widget_show(rakun->ebox);
 
-    // Create image widget
-    rakun->image = gtk_image_new();
-    gtk_widget_show(rakun->image);
-    gtk_container_add(GTK_CONTAINER(rakun->ebox), rakun->image);
+    // Drawing area; the chip is painted from cached layers in rakun_draw
+    rakun->area = gtk_drawing_area_new();
+    gtk_widget_set_size_request(rakun->area, IMG_WIDTH, IMG_HEIGHT);
+    g_signal_connect(G_OBJECT(rakun->area), "draw", G_CALLBACK(rakun_draw), rakun);
+    gtk_widget_show(rakun->area);
+    gtk_container_add(GTK_CONTAINER(rakun->ebox), rakun->area);
 
     // Add to panel
     gtk_container_add(GTK_CONTAINER(plugin), rakun->ebox);
@@ -317,29 +624,16 @@ static RakunMonitor *rakun_construct(XfcePanelPlugin *plugin) {
     // Set tooltip
     gtk_widget_set_tooltip_text(rakun->ebox, "Raccoon Monitor - M1 CPU Architecture");
 
-    // Get initial CPU stats (baseline)
-    get_cpu_info(rakun);
-    memcpy(rakun->cpu_prev, rakun->cpu_current, sizeof(rakun->cpu_current));
-
-    // Initialize all utilization to 0 for first display
-    for (size_t i = 0; i < MAX_NUM_CPUS; i++) {
-        rakun->utilization[i] = 0.0;
-    }
-
-    // Render initial display with 0% utilization
-    const int img_width = 290;
-    const int img_height = 92;
-    cairo_surface_t *surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, img_width, img_height);
-    cairo_t *cr = cairo_create(surface);
-    render_m1_chip(cr, rakun, img_width, img_height);
-    GdkPixbuf *pixbuf = gdk_pixbuf_get_from_surface(surface, 0, 0, img_width, img_height);
-    gtk_image_set_from_pixbuf(GTK_IMAGE(rakun->image), pixbuf);
-    g_object_unref(pixbuf);
-    cairo_destroy(cr);
-    cairo_surface_destroy(surface);
+    // Right-click menu: microbursts cost a 20 Hz wakeup, so they're opt-in
+    GtkWidget *bursts = gtk_check_menu_item_new_with_label("Show microbursts");
+    gtk_check_menu_item_set_active(GTK_CHECK_MENU_ITEM(bursts), rakun->bursts);
+    g_signal_connect(G_OBJECT(bursts), "toggled", G_CALLBACK(rakun_bursts_toggled), rakun);
+    gtk_widget_show(bursts);
+    xfce_panel_plugin_menu_insert_item(plugin, GTK_MENU_ITEM(bursts));
 
     // Start update timer (2 second interval) - first update will have real data
     rakun->timeout_id = g_timeout_add(2000, rakun_update, rakun);
+    set_bursts(rakun, rakun->bursts);
 
     return rakun;
 }
@@ -351,6 +645,10 @@ static void rakun_free(XfcePanelPlugin *plugin, RakunMonitor *rakun) {
         g_source_remove(rakun->timeout_id);
         rakun->timeout_id = 0;
     }
+    if (rakun->burst_id != 0) {
+        g_source_remove(rakun->burst_id);
+        rakun->burst_id = 0;
+    }
 
     // Free shared memory
     if (rakun->shm_ptr) {
@@ -358,6 +656,25 @@ static void rakun_free(XfcePanelPlugin *plugin, RakunMonitor *rakun) {
         shm_unlink(rakun->shm_name);
     }
 
+    // Release /proc readers and per-core state
+    procfs_close(&rakun->stat_file);
+    procfs_buf_free(&rakun->stat_buf);
+    cpustat_free(&rakun->cpu_current);
+    cpustat_free(&rakun->cpu_prev);
+    cpufreq_free(&rakun->freq);
+    psi_free(&rakun->psi);
+    burst_free(&rakun->burst);
+    g_free(rakun->burst_stats.max);
+    g_free(rakun->utilization);
+    heatmap_free(&rakun->heatmap);
+    if (rakun->heatmap_grid)
+        cairo_surface_destroy(rakun->heatmap_grid);
+    free_layers(rakun);
+    coremap_free(&rakun->chip);
+    g_free(rakun->shown);
+    g_free(rakun->shown_freq);
+    g_free(rakun->shown_peak);
+
     // Free widgets
     gtk_widget_destroy(rakun->ebox);
 
@@ -367,8 +684,8 @@ static void rakun_free(XfcePanelPlugin *plugin, RakunMonitor *rakun) {
 
 /* Panel size changed callback */
 static gboolean rakun_size_changed(XfcePanelPlugin *plugin, gint size, RakunMonitor *rakun) {
-    // Force update with new size
-    rakun_update(rakun);
+    // Layers follow the window scale; rakun_draw rebuilds them if it changed
+    gtk_widget_queue_draw(rakun->area);
     return TRUE;
 }
 
@@ -381,6 +698,9 @@ static void rakun_construct_wrapper(XfcePanelPlugin *plugin) {
 
     g_signal_connect(G_OBJECT(plugin), "size-changed",
                      G_CALLBACK(rakun_size_changed), rakun);
+
+    g_signal_connect(G_OBJECT(plugin), "save",
+                     G_CALLBACK(rakun_save), rakun);
 }
 
 /* Plugin registration macro */
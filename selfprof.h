@@ -0,0 +1,126 @@
+// What sys-genmon itself costs: wall and CPU time per pipeline stage,
+// syscalls and bytes written per tick, as log-bucketed histograms that
+// accumulate across runs in shared memory. Used by sys-genmon.
+//
+// Stages nest (reading /proc while setting up shm, writing the SVG while
+// formatting); each one is charged only its own time, not its children's.
+// Buckets are 4 per power of two, so a quantile is good to about 20%.
+// The block holds today's histograms and the previous day's (UTC), so a
+// regression after an update shows as today against yesterday.
+//
+// Several processes can share the block (the panel's one-shot runs, a
+// daemon); increments are atomic and the day rollover is claimed with a
+// compare-and-swap, so at worst a tick at midnight lands in the wrong day.
+
+#ifndef SELFPROF_H
+#define SELFPROF_H
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+enum prof_stage {
+  PROF_SHM,    // Mapping shm, the snapshot, hardware discovery
+  PROF_READ,   // /proc and /sys reads
+  PROF_PARSE,
+  PROF_MATH,   // Utilization, history, bursts
+  PROF_FORMAT,
+  PROF_SVG,    // Writing and renaming the SVG file
+  PROF_TICK,   // Everything, one sample to output
+  PROF_STAGES
+};
+
+// Histograms: wall and CPU time per stage, then per-tick counts.
+#define PROF_WALL(stage) (2 * (stage))
+#define PROF_CPU(stage) (2 * (stage) + 1)
+#define PROF_SYSCALLS (2 * PROF_STAGES)
+#define PROF_WRITTEN (2 * PROF_STAGES + 1) // Bytes
+#define PROF_METRICS (2 * PROF_STAGES + 2)
+
+#define PROF_BUCKETS 160 // Up to 2^41 ns (about 36 minutes)
+#define PROF_MAX_DEPTH 8
+
+static const char *const prof_stage_names[PROF_STAGES] = {
+    "shm setup", "/proc reads", "parsing", "utilization", "formatting",
+    "SVG write", "tick"};
+
+struct prof_hist {
+  uint64_t count;
+  uint64_t sum;
+  uint32_t bucket[PROF_BUCKETS];
+};
+
+// Lives in shm. hist[0] is today, hist[1] the previous day.
+struct prof_block {
+  uint64_t day; // Days since the epoch (UTC) of hist[0], 0 if unused
+  struct prof_hist hist[2][PROF_METRICS];
+};
+
+struct prof_mark {
+  uint64_t wall_ns, cpu_ns;
+};
+
+// One tick in progress, in the recording process.
+struct prof_tick {
+  uint64_t wall_ns[PROF_STAGES], cpu_ns[PROF_STAGES];
+  struct prof_mark start;
+  struct prof_mark child[PROF_MAX_DEPTH]; // Time of finished nested stages
+  int depth;
+  uint64_t syscalls, written; // /proc/self/io at the start
+};
+
+static inline uint32_t prof_bucket(uint64_t v) {
+  if (v < 8)
+    return (uint32_t)v;
+  uint32_t msb = 63 - (uint32_t)__builtin_clzll(v);
+  uint32_t b = (msb - 1) * 4 + (uint32_t)((v >> (msb - 2)) & 3);
+  return b < PROF_BUCKETS ? b : PROF_BUCKETS - 1;
+}
+
+// Middle of bucket b's range.
+static inline uint64_t prof_bucket_value(uint32_t b) {
+  if (b < 8)
+    return b;
+  uint32_t msb = b / 4 + 1;
+  uint64_t low = (uint64_t)(4 + b % 4) << (msb - 2);
+  return low + (1ull << (msb - 2)) / 2;
+}
+
+static inline void prof_add(struct prof_hist *h, uint64_t v) {
+  __atomic_fetch_add(&h->count, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&h->sum, v, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&h->bucket[prof_bucket(v)], 1, __ATOMIC_RELAXED);
+}
+
+// Value at quantile q (0-1), 0 if empty.
+static inline uint64_t prof_quantile(const struct prof_hist *h, double q) {
+  uint64_t total = 0;
+  for (uint32_t b = 0; b < PROF_BUCKETS; b++)
+    total += h->bucket[b];
+  if (!total)
+    return 0;
+  uint64_t rank = (uint64_t)(q * (total - 1)) + 1, seen = 0;
+  for (uint32_t b = 0; b < PROF_BUCKETS; b++)
+    if ((seen += h->bucket[b]) >= rank)
+      return prof_bucket_value(b);
+  return prof_bucket_value(PROF_BUCKETS - 1);
+}
+
+// Move today's histograms to the previous day if the date changed.
+static inline void prof_rollover(struct prof_block *p) {
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  uint64_t today = (uint64_t)ts.tv_sec / 86400;
+  uint64_t day = __atomic_load_n(&p->day, __ATOMIC_RELAXED);
+  if (day == today ||
+      !__atomic_compare_exchange_n(&p->day, &day, today, 0, __ATOMIC_RELAXED,
+                                   __ATOMIC_RELAXED))
+    return;
+  if (day + 1 == today)
+    memcpy(p->hist[1], p->hist[0], sizeof(p->hist[0]));
+  else
+    memset(p->hist[1], 0, sizeof(p->hist[1])); // Not the day before
+  memset(p->hist[0], 0, sizeof(p->hist[0]));
+}
+
+#endif // SELFPROF_H
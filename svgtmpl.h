@@ -0,0 +1,299 @@
+// SVG documents compiled once per layout and patched in place every tick.
+// Used by sys-genmon.c.
+//
+// Most of a panel SVG never changes between ticks: gradients, outlines,
+// labels, x positions. A template holds the whole document as one byte
+// string in which every value that does change (a bar height, a y offset,
+// an opacity, a color) has a fixed-width slot. One function describes a
+// layout; run with compile set it lays down the static runs with
+// printf-style formatting and reserves the slots, and run without it the
+// static calls return at once and each value call overwrites the next
+// slot with a few digit stores. Numbers are zero-padded to the slot width,
+// which SVG reads like any other number.
+//
+// One variable-length piece, the heatmap image, can be left out as a blob
+// and spliced in by svgt_iov() for writev(). The text grows as it is
+// compiled, so a document can't be truncated however many cores it has.
+//
+// A compiled template can be kept in a file keyed by its layout
+// (svgt_save, svgt_load), so a one-shot run that finds the same layout
+// there only patches it.
+
+#ifndef SVGTMPL_H
+#define SVGTMPL_H
+
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#define SVGT_NO_BLOB SIZE_MAX
+
+struct svg_slot {
+  uint32_t at, width;
+};
+
+struct svg_template {
+  char *text;
+  size_t len, cap;
+  struct svg_slot *slot;
+  size_t num_slots, slot_cap;
+  size_t next;    // Slot the next value goes to
+  size_t blob_at; // Offset the blob is spliced in at, or SVGT_NO_BLOB
+  int compiling, failed;
+};
+
+static inline void svgt_free(struct svg_template *t) {
+  free(t->text);
+  free(t->slot);
+  memset(t, 0, sizeof(*t));
+}
+
+// Start a pass over the layout: a compile from scratch, or a patch of the
+// slots an earlier compile reserved.
+static inline void svgt_begin(struct svg_template *t, int compile) {
+  t->compiling = compile;
+  t->next = 0;
+  if (compile) {
+    t->len = t->num_slots = 0;
+    t->blob_at = SVGT_NO_BLOB;
+    t->failed = 0;
+  }
+}
+
+// Returns 1 if the template holds a whole document.
+static inline int svgt_end(struct svg_template *t) {
+  t->compiling = 0;
+  return !t->failed && t->len && t->next == t->num_slots;
+}
+
+static inline int svgt_reserve(struct svg_template *t, size_t n) {
+  if (t->failed)
+    return -1;
+  if (t->len + n + 1 > t->cap) {
+    size_t cap = t->cap ? t->cap : 4096;
+    while (t->len + n + 1 > cap)
+      cap *= 2;
+    char *text = realloc(t->text, cap);
+    if (!text)
+      return t->failed = 1, -1;
+    t->text = text;
+    t->cap = cap;
+  }
+  return 0;
+}
+
+// A static run; skipped when patching.
+__attribute__((format(printf, 2, 3))) static inline void
+svgt_text(struct svg_template *t, const char *fmt, ...) {
+  if (!t->compiling || t->failed)
+    return;
+  va_list ap;
+  va_start(ap, fmt);
+  int n = vsnprintf(t->cap ? t->text + t->len : NULL, t->cap - t->len, fmt, ap);
+  va_end(ap);
+  if (n < 0) {
+    t->failed = 1;
+    return;
+  }
+  if (t->len + (size_t)n + 1 > t->cap) {
+    if (svgt_reserve(t, (size_t)n))
+      return;
+    va_start(ap, fmt);
+    vsnprintf(t->text + t->len, t->cap - t->len, fmt, ap);
+    va_end(ap);
+  }
+  t->len += (size_t)n;
+}
+
+// Where the next value goes: a new slot of width bytes when compiling,
+// the matching old one when patching. NULL if the passes disagree.
+static inline char *svgt_slot(struct svg_template *t, uint32_t width) {
+  if (t->compiling) {
+    if (t->num_slots == t->slot_cap) {
+      size_t cap = t->slot_cap ? 2 * t->slot_cap : 64;
+      struct svg_slot *slot = realloc(t->slot, cap * sizeof(*slot));
+      if (!slot)
+        t->failed = 1;
+      else
+        t->slot = slot, t->slot_cap = cap;
+    }
+    if (svgt_reserve(t, width))
+      return NULL;
+    t->slot[t->num_slots++] = (struct svg_slot){(uint32_t)t->len, width};
+    t->len += width;
+    t->text[t->len] = '\0';
+  }
+  if (t->failed || t->next >= t->num_slots || t->slot[t->next].width != width)
+    return t->failed = 1, NULL;
+  return t->text + t->slot[t->next++].at;
+}
+
+// Digits a slot needs for values up to max.
+static inline uint32_t svgt_digits(uint64_t max) {
+  uint32_t n = 1;
+  for (; max >= 10; max /= 10)
+    n++;
+  return n;
+}
+
+// v zero-padded to width digits; larger values show as all nines.
+static inline void svgt_uint(struct svg_template *t, uint32_t width,
+                             uint64_t v) {
+  char *p = svgt_slot(t, width);
+  if (!p)
+    return;
+  for (uint32_t i = width; i-- > 0; v /= 10)
+    p[i] = '0' + v % 10;
+  if (v)
+    memset(p, '9', width);
+}
+
+// hundredths as "d.dd", for opacities; 9.99 at most.
+static inline void svgt_fixed2(struct svg_template *t, uint32_t hundredths) {
+  char *p = svgt_slot(t, 4);
+  if (!p)
+    return;
+  if (hundredths > 999)
+    hundredths = 999;
+  p[0] = '0' + hundredths / 100;
+  p[1] = '.';
+  p[2] = '0' + hundredths / 10 % 10;
+  p[3] = '0' + hundredths % 10;
+}
+
+// The low width hex digits of v, uppercase, for colors.
+static inline void svgt_hex(struct svg_template *t, uint32_t width,
+                            uint32_t v) {
+  char *p = svgt_slot(t, width);
+  if (!p)
+    return;
+  for (uint32_t i = width; i-- > 0; v >>= 4)
+    p[i] = "0123456789ABCDEF"[v & 15];
+}
+
+// Mark where the blob goes. One per document.
+static inline void svgt_blob(struct svg_template *t) {
+  if (t->compiling)
+    t->blob_at = t->len;
+}
+
+// The document, with blob spliced in if it has a place for one, as up to
+// three iovecs. Returns how many.
+static inline int svgt_iov(const struct svg_template *t, const char *blob,
+                           size_t blob_len, struct iovec *iov) {
+  if (t->blob_at == SVGT_NO_BLOB) {
+    iov[0] = (struct iovec){.iov_base = t->text, .iov_len = t->len};
+    return 1;
+  }
+  iov[0] = (struct iovec){.iov_base = t->text, .iov_len = t->blob_at};
+  iov[1] = (struct iovec){.iov_base = (void *)blob, .iov_len = blob_len};
+  iov[2] = (struct iovec){.iov_base = t->text + t->blob_at,
+                          .iov_len = t->len - t->blob_at};
+  return 3;
+}
+
+// The file is this header, the key, the slots, then the text.
+#define SVGT_MAGIC "SGMSVT1\n"
+#define SVGT_KEY_MAX 256
+
+struct svgt_file {
+  char magic[8];
+  uint32_t key_len, num_slots;
+  uint64_t len, blob_at;
+};
+
+// Replace the template at path with t, compiled for key. Best effort:
+// without the file the next run compiles again.
+static inline void svgt_save(const struct svg_template *t, const char *path,
+                             const void *key, uint32_t key_len) {
+  char tmp[4096];
+  if (snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)getpid()) >= (int)sizeof(tmp))
+    return;
+  int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC, 0600);
+  if (fd == -1)
+    return;
+  struct svgt_file h = {.key_len = key_len, .num_slots = (uint32_t)t->num_slots,
+                        .len = t->len, .blob_at = t->blob_at};
+  memcpy(h.magic, SVGT_MAGIC, sizeof(h.magic));
+  struct iovec iov[4] = {
+      {.iov_base = &h, .iov_len = sizeof(h)},
+      {.iov_base = (void *)key, .iov_len = key_len},
+      {.iov_base = t->slot, .iov_len = t->num_slots * sizeof(*t->slot)},
+      {.iov_base = t->text, .iov_len = t->len},
+  };
+  size_t want = sizeof(h) + key_len + t->num_slots * sizeof(*t->slot) + t->len;
+  int ok = writev(fd, iov, 4) == (ssize_t)want;
+  close(fd);
+  if (!ok || rename(tmp, path))
+    unlink(tmp);
+}
+
+// Load the template at path into t if it was compiled for key. Returns 0
+// if t now holds it, ready to patch; -1 leaves t to be compiled.
+static inline int svgt_load(struct svg_template *t, const char *path,
+                            const void *key, uint32_t key_len) {
+  int fd = open(path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+  if (fd == -1)
+    return -1;
+
+  // Only trust our own file; in /tmp anyone could have made it.
+  struct {
+    struct svgt_file h;
+    unsigned char key[SVGT_KEY_MAX];
+  } head;
+  struct svgt_file h;
+  struct stat st;
+  int ok = key_len <= SVGT_KEY_MAX && fstat(fd, &st) == 0 &&
+           st.st_uid == getuid() &&
+           pread(fd, &head, sizeof(h) + key_len, 0) == (ssize_t)(sizeof(h) + key_len) &&
+           (h = head.h, !memcmp(h.magic, SVGT_MAGIC, sizeof(h.magic))) &&
+           h.key_len == key_len && !memcmp(head.key, key, key_len) &&
+           (uint64_t)st.st_size ==
+               sizeof(h) + key_len + (uint64_t)h.num_slots * sizeof(*t->slot) + h.len;
+  if (!ok) {
+    close(fd);
+    return -1;
+  }
+
+  size_t slots_size = h.num_slots * sizeof(*t->slot);
+  if (h.num_slots > t->slot_cap) {
+    struct svg_slot *slot = realloc(t->slot, slots_size);
+    if (!slot) {
+      close(fd);
+      return -1;
+    }
+    t->slot = slot;
+    t->slot_cap = h.num_slots;
+  }
+  t->len = 0;
+  ok = !svgt_reserve(t, h.len);
+  if (ok) {
+    struct iovec iov[2] = {{.iov_base = t->slot, .iov_len = slots_size},
+                           {.iov_base = t->text, .iov_len = h.len}};
+    ok = preadv(fd, iov, 2, sizeof(h) + key_len) == (ssize_t)(slots_size + h.len);
+  }
+  close(fd);
+
+  // The slots and the blob must lie in the text.
+  for (uint32_t i = 0; ok && i < h.num_slots; i++)
+    ok = (uint64_t)t->slot[i].at + t->slot[i].width <= h.len;
+  if (!ok || (h.blob_at != SVGT_NO_BLOB && h.blob_at > h.len)) {
+    t->len = t->num_slots = 0;
+    t->failed = 0;
+    return -1;
+  }
+  t->len = h.len;
+  t->text[t->len] = '\0';
+  t->num_slots = h.num_slots;
+  t->blob_at = h.blob_at;
+  t->failed = 0;
+  return 0;
+}
+
+#endif // SVGTMPL_H
@@ -17,25 +17,47 @@ TMP="$(mktemp -d)"; cc -o "$TMP/a.out" -x c "$0" && "$TMP/a.out" $@; RVAL=$?; rm
 // 6. CPU temp - Red
 // 7. GPU temp - Orange
 // --------------------------------
-// 8. Disk usage
-// 9. Network usage.
+// 8. Disk usage - Turquoise
+// 9. Network usage - Orange
 // --------------------------------
 
 #include <errno.h>
 #include <fcntl.h>
 #include <inttypes.h>
 #include <limits.h>
+#include <signal.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/file.h>
 #include <sys/mman.h>
+#include <sys/prctl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 
-#define MAX_NUM_CPUS 256
+#include "burst.h"
+#include "cgroup.h"
+#include "cgscan.h"
+#include "coremap.h"
+#include "cpufreq.h"
+#include "cpustat.h"
+#include "drmscan.h"
+#include "heatmap.h"
+#include "history.h"
+#include "iostat.h"
+#include "procfs.h"
+#include "procscan.h"
+#include "psi.h"
+#include "selfprof.h"
+#include "svgtmpl.h"
+#include "tokenize.h"
+
 #define MAX_NUM_GPUS 8
 
 #define ANSI_COLOR_RED "\x1b[31m"
@@ -51,26 +73,13 @@ TMP="$(mktemp -d)"; cc -o "$TMP/a.out" -x c "$0" && "$TMP/a.out" $@; RVAL=$?; rm
 #define MEM_COLOR "#F1C40F"
 #define SWP_COLOR "#8E44AD"
 #define VRAM_COLOR "#BADC00"
+#define DISK_COLOR "#1ABC9C"
+#define NET_COLOR "#E67E22"
 
 #define PAGE_SIZE 4096
 
 struct all_info {
-  struct cpu_record {
-    struct cpu_instance {
-      char cpu_number[16];
-      uint32_t user;
-      uint32_t system;
-
-      uint32_t idle;
-      uint32_t iowait;
-      uint32_t irq;
-      uint32_t softirq;
-
-      uint32_t steal;
-      uint32_t guest;
-    } cpu[MAX_NUM_CPUS];
-    size_t num_cpus;
-  } cpu_info;
+  struct cpu_record cpu_info; // cpustat.h
 
   struct gpu_record {
     struct gpu_instance {
@@ -104,34 +113,146 @@ struct all_info {
     uint32_t swp_used;
     uint32_t swp_free;
   } mem_info;
+
+  struct proc_record {
+    struct top_process cpu[PROCSCAN_TOP]; // procscan.h
+    struct top_process rss[PROCSCAN_TOP];
+    size_t num_cpu;
+    size_t num_rss;
+  } proc_info;
+
+  struct cgtop_record {
+    struct top_cgroup cpu[CGSCAN_TOP]; // cgscan.h
+    struct top_cgroup mem[CGSCAN_TOP];
+    size_t num_cpu;
+    size_t num_mem;
+  } cgtop_info;
+
+  struct io_record {
+    struct disk_rate disk[IOSTAT_MAX_DEVS]; // iostat.h
+    struct net_rate net[IOSTAT_MAX_DEVS];
+    uint32_t num_disks;
+    uint32_t num_nets;
+  } io_info;
+
+  struct psi_record psi_info; // psi.h
+  struct cgroup_record cgroup_info; // cgroup.h, with --cgroup
 } info;
 
 static float avg_utilization;
-static float utilization[MAX_NUM_CPUS];
+static float *utilization; // num_cpu_slots entries
+static size_t num_cpu_slots; // Per-core capacity, see init_cpu_storage()
 typedef struct cpu_record cpu_record;
 typedef struct gpu_record gpu_record;
 typedef struct mem_record mem_record;
+typedef struct proc_record proc_record;
+typedef struct cgtop_record cgtop_record;
+typedef struct io_record io_record;
 
+// Baselines for the deltas: this consumer's, copied out of its shm slot
+// (get_prev_cpu_info) and saved back after each sample (save_cpu_shm).
 static struct cpu_record *prev_cpu_info = NULL;
+static struct cpu_record prev_cpu_record;
+static struct iostat_sample *prev_io;
+static struct psi_baseline *prev_psi;
+static struct cgroup_baseline *prev_cgroup;
+static uint64_t prev_sample_ns;     // CLOCK_MONOTONIC of the baseline, 0 if new
+static uint64_t sample_interval_ns; // Covered by the current sample, 0 if unknown
+static struct history history;      // In shm, after the header
+
+// Outputs running side by side (a --svg bar, an --arch-diagram panel, a
+// --tui) sample on their own schedules. Each keeps its baseline in a slot
+// named for it, so none shortens another's interval.
+#define SHM_LAYOUT 5
+#define SHM_CONSUMERS 8
+#define SHM_CONSUMER_NAME 24
+#define SHM_STALE_NS 10000000000ull // A writer holding a slot this long died
+
+static struct shm_header {
+  uint64_t capacity; // Per-core slots the arrays were sized for
+  uint32_t layout;   // SHM_LAYOUT once set up
+} *shm_hdr = NULL;
+
+// Header of a consumer slot; the cpu_record arrays, an iostat_sample, a
+// psi_baseline and a cgroup_baseline follow. Writers claim the slot with a
+// compare-and-swap of claim_ns, as two instances of one consumer can race;
+// the holder keeps seq odd while it writes (seqlock).
+struct shm_consumer {
+  uint32_t seq;
+  char name[SHM_CONSUMER_NAME];
+  uint64_t timestamp_ns; // CLOCK_MONOTONIC of the baseline, 0 if none
+  uint64_t claim_ns;     // CLOCK_MONOTONIC a writer took the slot at, 0 if free
+  uint64_t num_cpus;
+};
+static char *shm_slots;
+static size_t shm_slot_size;
+static size_t consumer_slot;
+static char consumer_name[SHM_CONSUMER_NAME]; // --consumer, or the mode's
 static char tmp_svg[512] = {0};  // Dynamic path per user
 static char shm_name[256] = {0}; // Dynamic name per user
-static const char *nvsmi_cmd = "nvidia-smi "
-                               "--query-gpu="
-                               "gpu_name,"
-                               "utilization.gpu,"
-                               "utilization.memory,"
-                               "memory.total,"
-                               "memory.used,"
-                               "memory.free,"
-                               "clocks.current.graphics,"
-                               "clocks.current.memory,"
-                               "clocks.current.video,"
-                               "power.draw,"
-                               "temperature.gpu "
-                               "--format=csv,noheader,nounits";
-
-// M1/Asahi GPU monitoring - Direct kernel interface, Carmack-style
-// Currently stubs - waiting for DRM fdinfo support in kernel 6.16+
+static char snap_name[256] = {0}; // Daemon snapshot, per user
+static char caps_path[512] = {0}; // Hardware discovery cache, per user
+static char bars_svgt[512] = {0}; // Compiled --svg template, per user
+static char m1_svgt[512] = {0};   // Compiled --arch-diagram template
+
+// Opened once, re-read with pread() every sample.
+static struct procfs_file proc_stat = PROCFS_FILE("/proc/stat");
+static struct procfs_file proc_meminfo = PROCFS_FILE("/proc/meminfo");
+static struct procfs_file proc_cpuinfo = PROCFS_FILE("/proc/cpuinfo");
+static struct procfs_buf stat_buf;
+static struct procfs_buf meminfo_buf;
+static struct procfs_file proc_diskstats = PROCFS_FILE("/proc/diskstats");
+static struct procfs_file proc_netdev = PROCFS_FILE("/proc/net/dev");
+static struct procfs_buf diskstats_buf;
+static struct procfs_buf netdev_buf;
+static struct iostat_filter disk_filter, net_filter; // --disks, --nets
+static struct cpufreq cpu_freq; // Sized on first use
+
+// Microbursts (burst.h), sub-sampled by --daemon and --tui with --burst.
+// One-shot modes get burst_hz and the stats from the daemon's snapshot.
+static struct burst burst;
+static uint32_t burst_hz = 0; // 0: off
+static float burst_threshold = BURST_DEFAULT_THRESHOLD;
+static struct burst_stats burst_stats; // Last window, num_cpu_slots each
+
+// Everything a formatter needs, as published by --daemon.
+// seq is odd while the daemon is writing (seqlock).
+struct snapshot {
+  uint32_t seq;
+  uint32_t interval_ms;
+  uint64_t timestamp_ns; // CLOCK_MONOTONIC
+  uint64_t capacity;     // Length of utilization[]
+  uint64_t num_cpus;
+  float avg_utilization;
+  uint32_t burst_hz;     // 0 if the stats below are unused
+  float burst_threshold;
+  struct gpu_record gpu_info;
+  struct mem_record mem_info;
+  struct proc_record proc_info;
+  struct cgtop_record cgtop_info;
+  struct io_record io_info;
+  struct psi_record psi_info;
+  struct cgroup_record cgroup_info;
+  float utilization[]; // capacity entries, then the per-core uint32_t
+                       // arrays of snapshot_core_arrays(), capacity each
+};
+
+// nvidia-smi can be replaced by a stub that prints recorded CSV, e.g.
+//   SYS_GENMON_NVSMI=./fake-nvidia-smi sys-genmon --tui
+#define NVSMI_QUERY "gpu_name,"                \
+                    "utilization.gpu,"         \
+                    "utilization.memory,"      \
+                    "memory.total,"            \
+                    "memory.used,"             \
+                    "memory.free,"             \
+                    "clocks.current.graphics," \
+                    "clocks.current.memory,"   \
+                    "clocks.current.video,"    \
+                    "power.draw,"              \
+                    "temperature.gpu"
+#define NVSMI_FORMAT "--format=csv,noheader,nounits"
+
+// Apple GPUs (Asahi) - Direct kernel interface, Carmack-style
 static inline int detect_asahi_gpu(void) {
   // Check if Asahi GPU device exists (works on all M1/M2/M3)
   struct stat st;
@@ -139,67 +260,36 @@ static inline int detect_asahi_gpu(void) {
   if (stat("/sys/devices/platform/soc/206400000.gpu", &st) == 0) {
     return 1; // M1/M2 detected
   }
-  // Check for DRM card0 with apple driver as fallback
-  FILE *f = fopen("/sys/class/drm/card0/device/driver", "r");
-  if (f) {
-    fclose(f);
-    return 1;
-  }
-  return 0;
+  // Check for DRM card0 driven by asahi as fallback
+  char driver[PATH_MAX];
+  ssize_t len = readlink("/sys/class/drm/card0/device/driver", driver,
+                         sizeof(driver) - 1);
+  if (len <= 0)
+    return 0;
+  driver[len] = '\0';
+  const char *name = strrchr(driver, '/');
+  return !strcmp(name ? name + 1 : driver, "asahi");
 }
 
-static inline void get_asahi_gpu_info(struct gpu_record *gpu) {
-  gpu->num_gpus = 0;
+// Without a previous DRM sample there is nothing to take a delta from, so
+// the one-shot modes only list the GPU. The daemon has the numbers.
+static inline void get_asahi_gpu_info(struct gpu_instance *g) {
+  memset(g, 0, sizeof(*g));
+  snprintf(g->gpu_name, sizeof(g->gpu_name), "Apple GPU (asahi)");
+}
 
-  if (!detect_asahi_gpu()) return;
-
-  // M1 GPU detected
-  gpu->num_gpus = 1;
-  struct gpu_instance *g = &gpu->gpu[0];
-
-  // Read GPU name from dmesg or default to M1
-  strncpy(g->gpu_name, "Apple M1 GPU (7-core)", sizeof(g->gpu_name) - 1);
-  g->gpu_name[sizeof(g->gpu_name) - 1] = '\0';
-
-  // STUBBED: DRM fdinfo not yet available in Asahi driver v0.0.0
-  // When kernel 6.16+ DRM stats land, parse /proc/[pid]/fdinfo/[fd]:
-  //   drm-engine-gfx: [cycles]
-  //   drm-cycles-gfx: [total]
-  //   drm-memory-vram: [bytes]
-  // For now: report 0 (unknown)
-  g->gpu_sm_utilization = 0;  // TODO: parse DRM fdinfo when available
-  g->gpu_mem_bandwidth_utilization = 0;
-
-  // M1 GPU memory is shared with system RAM - estimate from GL apps
-  g->gpu_mem_total = 0;  // Shared memory architecture
-  g->gpu_mem_used = 0;
-  g->gpu_mem_free = 0;
-  g->gpu_mem_used_percentage = 0.0;
-
-  // Clock/power stats not exposed by firmware
-  g->gpu_graphics_clock = 0;
-  g->gpu_mem_clock = 0;
-  g->gpu_video_clock = 0;
-  g->gpu_power_draw = 0;
-  g->gpu_temp = 0;
-}
-
-static inline uint32_t str_to_u32(char *s, int *err) {
-#if UINT32_MAX <= ULONG_MAX
-#define strtot unsigned long
-#define strtou strtoul
-#elif UINT32_MAX <= ULLONG_MAX
-#define strtot unsigned long long
-#define strtou strtoull
-#endif
-  errno = 0;
-  strtot ul = strtou(s, NULL, 10);
-  if (errno || (ul > UINT32_MAX))
+// s as an unsigned decimal. No digits, a value that doesn't fit or
+// anything after the digits sets err.
+static inline uint32_t str_to_u32(const char *s, int *err) {
+  int tok_err = 0;
+  const char *end = s + strlen(s);
+  uint32_t v = tok_u32(&s, end, &tok_err);
+  if (tok_err || s != end)
     *err = 1;
-  return ul;
+  return v;
 }
 
-static inline int starts_with(char *s, char *start) {
+static inline int starts_with(const char *s, const char *start) {
   while (*start && *s) {
     if (*start != *s)
       return 0;
@@ -216,29 +306,145 @@ static inline void init_secure_paths(void) {
 
   if (runtime_dir && runtime_dir[0] == '/') {
     snprintf(tmp_svg, sizeof(tmp_svg), "%s/sys-genmon-%d.svg", runtime_dir, uid);
+    snprintf(caps_path, sizeof(caps_path), "%s/sys-genmon-%d.caps", runtime_dir, uid);
   } else {
+    runtime_dir = "/tmp";
     snprintf(tmp_svg, sizeof(tmp_svg), "/tmp/sys-genmon-%d.svg", uid);
+    snprintf(caps_path, sizeof(caps_path), "/tmp/sys-genmon-%d.caps", uid);
   }
+  snprintf(bars_svgt, sizeof(bars_svgt), "%s/sys-genmon-%d.bars.svgt", runtime_dir, uid);
+  snprintf(m1_svgt, sizeof(m1_svgt), "%s/sys-genmon-%d.m1.svgt", runtime_dir, uid);
 
   snprintf(shm_name, sizeof(shm_name), "/genmon_shmem_%d", uid);
+  snprintf(snap_name, sizeof(snap_name), "/genmon_daemon_%d", uid);
+}
+
+// --cgroup keeps its history, baselines and daemon snapshot apart: its
+// cores and memory aren't the host's.
+static inline void use_cgroup_paths(void) {
+  uid_t uid = getuid();
+  snprintf(shm_name, sizeof(shm_name), "/genmon_shmem_%d_cgroup", uid);
+  snprintf(snap_name, sizeof(snap_name), "/genmon_daemon_%d_cgroup", uid);
+}
+
+static inline uint64_t monotonic_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// Self-profiling (selfprof.h). Every tick's wall time goes into the block
+// in shm; with --self-profile each stage's wall and CPU time, and the
+// read/write syscalls and bytes written from /proc/self/io, go in too.
+static struct prof_block *prof; // In shm, after the PSI baseline
+static int self_profile = 0;
+static struct prof_tick prof_tick;
+static struct procfs_file proc_self_io = PROCFS_FILE("/proc/self/io");
+static struct procfs_buf self_io_buf;
+static unsigned prof_ran; // Stages that ran this tick
+
+#define PROF_SELF_IO_SYSCALLS 2 // The pread and the EOF pread of a read
+
+static inline struct prof_mark prof_now(void) {
+  struct prof_mark m = {monotonic_ns(), 0};
+  if (self_profile) {
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    m.cpu_ns = (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+  }
+  return m;
+}
+
+// syscr + syscw and wchar of this process so far.
+static inline void prof_self_io(uint64_t *syscalls, uint64_t *written) {
+  ssize_t n = procfs_read(&proc_self_io, &self_io_buf);
+  *syscalls = *written = 0;
+  const char *p = self_io_buf.data, *end = p + (n > 0 ? n : 0);
+  int err = 0;
+  for (; p < end; p = tok_next_line(p, end)) {
+    if (!strncmp(p, "syscr: ", 7) || !strncmp(p, "syscw: ", 7)) {
+      p += 7;
+      *syscalls += tok_u64(&p, end, &err);
+    } else if (!strncmp(p, "wchar: ", 7)) {
+      p += 7;
+      *written = tok_u64(&p, end, &err);
+    }
+  }
+}
+
+static inline void prof_tick_begin(void) {
+  memset(&prof_tick, 0, sizeof(prof_tick));
+  prof_ran = 0;
+  if (self_profile)
+    prof_self_io(&prof_tick.syscalls, &prof_tick.written);
+  prof_tick.start = prof_now();
 }
 
-static inline char *get_cpu_name(void) {
+static inline struct prof_mark prof_begin(void) {
+  struct prof_mark m = {0, 0};
+  if (!self_profile)
+    return m;
+  if (prof_tick.depth < PROF_MAX_DEPTH)
+    prof_tick.child[prof_tick.depth] = m;
+  prof_tick.depth++;
+  return prof_now();
+}
+
+// Charge the time since m, less that of the stages nested in it, to stage.
+static inline void prof_end(enum prof_stage stage, struct prof_mark m) {
+  if (!self_profile || prof_tick.depth <= 0)
+    return;
+  struct prof_mark now = prof_now();
+  uint64_t wall = now.wall_ns - m.wall_ns, cpu = now.cpu_ns - m.cpu_ns;
+  int d = --prof_tick.depth;
+  if (d < PROF_MAX_DEPTH) {
+    prof_tick.wall_ns[stage] += wall - prof_tick.child[d].wall_ns;
+    prof_tick.cpu_ns[stage] += cpu - prof_tick.child[d].cpu_ns;
+  }
+  if (d > 0 && d <= PROF_MAX_DEPTH) {
+    prof_tick.child[d - 1].wall_ns += wall;
+    prof_tick.child[d - 1].cpu_ns += cpu;
+  }
+  prof_ran |= 1u << stage;
+}
+
+// Add the finished tick to today's histograms.
+static inline void prof_tick_end(void) {
+  if (!prof)
+    return;
+  struct prof_mark now = prof_now();
+  prof_rollover(prof);
+  struct prof_hist *h = prof->hist[0];
+  prof_add(&h[PROF_WALL(PROF_TICK)], now.wall_ns - prof_tick.start.wall_ns);
+  if (!self_profile)
+    return;
+  prof_add(&h[PROF_CPU(PROF_TICK)], now.cpu_ns - prof_tick.start.cpu_ns);
+  for (int k = 0; k < PROF_TICK; k++) {
+    if (prof_ran & (1u << k)) {
+      prof_add(&h[PROF_WALL(k)], prof_tick.wall_ns[k]);
+      prof_add(&h[PROF_CPU(k)], prof_tick.cpu_ns[k]);
+    }
+  }
+  uint64_t syscalls, written;
+  prof_self_io(&syscalls, &written);
+  syscalls -= prof_tick.syscalls + PROF_SELF_IO_SYSCALLS;
+  prof_add(&h[PROF_SYSCALLS], syscalls);
+  prof_add(&h[PROF_WRITTEN], written - prof_tick.written);
+}
+
+static inline char *detect_cpu_name(void) {
   static char cpu_name[4096];
   if (cpu_name[0])
     return cpu_name;
 
-  FILE *f = fopen("/proc/cpuinfo", "r");
-  if (!f)
-    puts("Failed to open /proc/cpuinfo."), exit(1);
-
 // Read the first few thousand bytes. The CPU name should be in there.
 #define CPU_NAME_BUFSZ 4096
-  ssize_t n_read = fread(cpu_name, CPU_NAME_BUFSZ, 1, f);
+  ssize_t n_read = procfs_read_head(&proc_cpuinfo, cpu_name, CPU_NAME_BUFSZ);
   if (n_read == -1)
     puts("Failed to read /proc/cpuinfo."), exit(1);
 
-  fclose(f);
+  // Only needed once per process.
+  procfs_close(&proc_cpuinfo);
 
   // Find model name field, skip to content.
   // If it can't be found, return "Unknown CPU".
@@ -273,55 +479,363 @@ static inline char *get_cpu_name(void) {
   return cpu_name;
 }
 
-static inline char *read_memitem(char *p, char *end, char *title, uint32_t *item, int *hit_one) {
-  if (!*p || p >= end) {
+// Hardware discovery, cached per boot
+//
+// GPU backends, the CPU name, the per-core slot count, core topology and
+// maximum frequencies don't change until reboot, but finding them costs a
+// /proc/cpuinfo read, sysfs lookups per core and, without this, an
+// nvidia-smi spawn on every machine without NVIDIA. The first run of each boot writes them to
+// caps_path keyed by /proc/sys/kernel/random/boot_id; later runs read that
+// one file instead. --clear-shm drops it.
+
+#define CAPS_MAGIC "SGMCAP3\n"
+#define CAPS_GPU_NVIDIA 1 // NVIDIA driver loaded, nvidia-smi worth running
+#define CAPS_GPU_ASAHI 2
+static struct hw_caps {
+  char magic[8];
+  char boot_id[40];
+  uint32_t gpu;           // CAPS_GPU_* bits
+  uint32_t num_cpu_slots; // cpustat_detect_cpus()
+  uint32_t cpufreq;       // Whether any core has a cpufreq directory
+  char cpu_name[256];
+  struct coremap_core *core; // By cpu id, num_cpu_slots entries
+  uint32_t *max_khz;         // cpuinfo_max_freq by cpu id, 0 if none
+} caps;
+
+// The file is the header up to core, then the cores, then max_khz.
+#define CAPS_HEADER_SIZE offsetof(struct hw_caps, core)
+#define CAPS_CORES_SIZE(n) \
+  ((size_t)(n) * (sizeof(struct coremap_core) + sizeof(uint32_t)))
+
+static inline int detect_nvidia_gpu(void) {
+  struct stat st;
+  return stat("/proc/driver/nvidia/version", &st) == 0;
+}
+
+static inline int load_caps(const char *boot_id) {
+  int fd = open(caps_path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+  if (fd == -1)
+    return 0;
+
+  // Only trust our own file; in /tmp anyone could have made it.
+  struct stat st;
+  int ok = fstat(fd, &st) == 0 && st.st_uid == getuid() &&
+           (size_t)st.st_size > CAPS_HEADER_SIZE &&
+           pread(fd, &caps, CAPS_HEADER_SIZE, 0) == (ssize_t)CAPS_HEADER_SIZE &&
+           !memcmp(caps.magic, CAPS_MAGIC, sizeof(caps.magic)) &&
+           !strncmp(caps.boot_id, boot_id, sizeof(caps.boot_id)) &&
+           (size_t)st.st_size == CAPS_HEADER_SIZE + CAPS_CORES_SIZE(caps.num_cpu_slots);
+  if (ok) {
+    // One allocation, the max_khz array after the cores.
+    caps.core = malloc(CAPS_CORES_SIZE(caps.num_cpu_slots));
+    ok = caps.core &&
+         pread(fd, caps.core, CAPS_CORES_SIZE(caps.num_cpu_slots),
+               CAPS_HEADER_SIZE) == (ssize_t)CAPS_CORES_SIZE(caps.num_cpu_slots);
+    if (ok)
+      caps.max_khz = (uint32_t *)(caps.core + caps.num_cpu_slots);
+  }
+  close(fd);
+
+  if (!ok) {
+    free(caps.core);
+    memset(&caps, 0, sizeof(caps));
+  }
+  caps.cpu_name[sizeof(caps.cpu_name) - 1] = '\0';
+  return ok;
+}
+
+// Best effort: without the file the next run just discovers again.
+static inline void save_caps(void) {
+  char tmp[sizeof(caps_path) + 16];
+  snprintf(tmp, sizeof(tmp), "%s.%d", caps_path, (int)getpid());
+  int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC, 0600);
+  if (fd == -1)
+    return;
+  struct iovec iov[2] = {
+      {.iov_base = &caps, .iov_len = CAPS_HEADER_SIZE},
+      {.iov_base = caps.core, .iov_len = CAPS_CORES_SIZE(caps.num_cpu_slots)},
+  };
+  ssize_t n = writev(fd, iov, 2);
+  close(fd);
+  if (n != (ssize_t)(CAPS_HEADER_SIZE + CAPS_CORES_SIZE(caps.num_cpu_slots)) ||
+      rename(tmp, caps_path) == -1)
+    unlink(tmp);
+}
+
+static inline const struct hw_caps *hw_caps(void) {
+  if (caps.magic[0])
+    return &caps;
+
+  char boot_id[sizeof(caps.boot_id)] = {0};
+  struct procfs_file f = PROCFS_FILE("/proc/sys/kernel/random/boot_id");
+  if (procfs_read_head(&f, boot_id, sizeof(boot_id)) > 0)
+    boot_id[strcspn(boot_id, "\n")] = '\0';
+  procfs_close(&f);
+  if (boot_id[0] && load_caps(boot_id))
+    return &caps;
+
+  memcpy(caps.magic, CAPS_MAGIC, sizeof(caps.magic));
+  memcpy(caps.boot_id, boot_id, sizeof(caps.boot_id));
+  caps.gpu = (detect_nvidia_gpu() ? CAPS_GPU_NVIDIA : 0) |
+             (detect_asahi_gpu() ? CAPS_GPU_ASAHI : 0);
+  caps.num_cpu_slots = cpustat_detect_cpus(&proc_stat, &stat_buf);
+  const char *name = detect_cpu_name();
+  memcpy(caps.cpu_name, name, strnlen(name, sizeof(caps.cpu_name) - 1));
+  caps.core = malloc(CAPS_CORES_SIZE(caps.num_cpu_slots));
+  if (!caps.core || coremap_probe("/sys", NULL, caps.num_cpu_slots, caps.core) < 0)
+    puts("Out of memory."), exit(1);
+  caps.max_khz = (uint32_t *)(caps.core + caps.num_cpu_slots);
+  for (uint32_t id = 0; id < caps.num_cpu_slots; id++) {
+    char path[CPUFREQ_PATH_LEN], value[32];
+    snprintf(path, sizeof(path),
+             "/sys/devices/system/cpu/cpu%u/cpufreq/cpuinfo_max_freq", id);
+    struct procfs_file f = PROCFS_FILE(path);
+    caps.max_khz[id] = cpufreq_parse(value, procfs_read_head(&f, value, sizeof(value)));
+    procfs_close(&f);
+    caps.cpufreq |= caps.max_khz[id] != 0;
+  }
+
+  // Without a boot id there is nothing to key the file on.
+  if (boot_id[0])
+    save_caps();
+  return &caps;
+}
+
+static inline const char *get_cpu_name(void) { return hw_caps()->cpu_name; }
+
+// P or E for cpu id, 0 if unknown. Doesn't discover anything by itself, so
+// a replayed log isn't labelled with this machine's classes.
+static inline char core_class(uint32_t id) {
+  return caps.core && id < caps.num_cpu_slots ? caps.core[id].cls : 0;
+}
+
+// Tier, package and cluster of cpu id; one unknown core if not discovered.
+static inline struct coremap_core core_topology(uint32_t id) {
+  if (caps.core && id < caps.num_cpu_slots)
+    return caps.core[id];
+  return (struct coremap_core){0};
+}
+
+static inline const char *read_memitem(const char *p, const char *end,
+                                       const char *title, uint32_t *item,
+                                       int *hit_one) {
+  if (p >= end || !*p) {
     puts("Failed to parse /proc/meminfo. Ran out of input."), exit(1);
   } else if (starts_with(p, title)) {
-    p += strlen(title);
-    while (*p == ' ' && p < end)
-      p++;
-    char *itemstr = p;
-    while (*p != ' ' && p < end)
-      p++;
-    if (*p != '\n' && p < end)
-      *p++ = '\0';
-    while (*p != '\n' && p < end)
-      p++;
-    if (p < end)
-      *p++ = '\0';
-
     int err = 0;
-    *item = str_to_u32(itemstr, &err);
+    p += strlen(title);
+    *item = tok_u32(&p, end, &err);
     if (err)
       puts("Failed to parse /proc/meminfo. Invalid number format."), exit(1);
-    else
-      *hit_one = 1;
+    *hit_one = 1;
+    p = tok_next_line(p, end);
   }
   return p;
 }
 
-static inline char *next_gpu_item(char *line, char *end) {
-  while (line < end) {
-    int lc = *line == ',';
-    int ln = *line == '\n';
-    int lz = *line == '\0';
-    if (lc | ln | lz)
-      return *line = '\0', line + (lc ? 2 : 1);
-    line++;
+static inline const char *nvsmi_bin(void) {
+  const char *bin = getenv("SYS_GENMON_NVSMI");
+  return (bin && *bin) ? bin : "nvidia-smi";
+}
+
+// Parse one row of NVSMI_QUERY fields. Returns the start of the next row.
+// Values it can't report ("[N/A]") read 0, and power keeps its watts.
+static inline const char *parse_gpu_row(const char *line, const char *end,
+                                        struct gpu_instance *g, int *err) {
+  const char *p = tok_find2(line, end, ',', '\n');
+  size_t name_len = p - line;
+  if (name_len > sizeof(g->gpu_name) - 1)
+    name_len = sizeof(g->gpu_name) - 1;
+  memcpy(g->gpu_name, line, name_len);
+  g->gpu_name[name_len] = '\0';
+
+  uint32_t *fields[] = {
+      &g->gpu_sm_utilization, &g->gpu_mem_bandwidth_utilization,
+      &g->gpu_mem_total,      &g->gpu_mem_used,
+      &g->gpu_mem_free,       &g->gpu_graphics_clock,
+      &g->gpu_mem_clock,      &g->gpu_video_clock,
+      &g->gpu_power_draw,     &g->gpu_temp,
+  };
+  for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+    // A short row leaves the rest 0 rather than running into the next.
+    int tok_err = 0;
+    if (p < end && *p == ',')
+      p++;
+    *fields[i] = tok_u32(&p, end, &tok_err);
+    if (tok_err & TOK_ERR_OVERFLOW)
+      *err = 1;
+    p = tok_find2(p, end, ',', '\n');
   }
-  return line;
+
+  // Handle division by zero gracefully
+  if (g->gpu_mem_total > 0) {
+    g->gpu_mem_used_percentage =
+        100.0 * ((float)g->gpu_mem_used / (float)g->gpu_mem_total);
+  } else {
+    g->gpu_mem_used_percentage = 0.0;
+  }
+  return tok_next_line(p, end);
 }
 
-static inline void get_gpu_info(struct gpu_record *gpu) {
-  gpu->num_gpus = 0;
+// Streaming NVIDIA collector, for the modes that sample repeatedly.
+// One `nvidia-smi --loop-ms=N` is started and its CSV is parsed as it
+// arrives. Rows are prefixed with the GPU index and stored at that slot.
+// A pass ends when an index comes again; the highest index in the pass
+// gives the GPU count. Once that is known, a set is published as soon
+// as its last GPU arrives. A row that is dropped keeps the slot's previous
+// values.
+static struct nvsmi_stream {
+  int enabled;
+  pid_t pid;
+  int fd;
+  uint32_t loop_ms;
+  uint64_t restart_ns; // Don't respawn a failing nvidia-smi before this
+
+  char buf[PAGE_SIZE * MAX_NUM_GPUS];
+  size_t len;
+
+  size_t set_size;           // GPUs per set, 0 until a full pass was seen
+  uint32_t pass_top, pass_seen; // Highest index + 1, indices seen this pass
+  struct gpu_record pending;
+  struct gpu_record latest;
+} nvsmi = {.pid = -1, .fd = -1};
+
+static inline void nvsmi_stream_stop(void) {
+  if (nvsmi.fd >= 0)
+    close(nvsmi.fd);
+  if (nvsmi.pid > 0) {
+    kill(nvsmi.pid, SIGTERM);
+    waitpid(nvsmi.pid, NULL, 0);
+  }
+  nvsmi.fd = -1;
+  nvsmi.pid = -1;
+  nvsmi.len = 0;
+  nvsmi.pass_top = 0;
+  nvsmi.pass_seen = 0;
+}
 
-  // Try Asahi/M1 GPU first (native Linux driver)
-  if (detect_asahi_gpu()) {
-    get_asahi_gpu_info(gpu);
+static inline void nvsmi_stream_start(void) {
+  int fds[2];
+  if (pipe(fds) == -1)
+    return;
+
+  char loop_arg[32];
+  snprintf(loop_arg, sizeof(loop_arg), "--loop-ms=%" PRIu32, nvsmi.loop_ms);
+
+  pid_t pid = fork();
+  if (pid == 0) {
+    prctl(PR_SET_PDEATHSIG, SIGTERM);
+    dup2(fds[1], STDOUT_FILENO);
+    int devnull = open("/dev/null", O_WRONLY);
+    if (devnull >= 0)
+      dup2(devnull, STDERR_FILENO);
+    close(fds[0]);
+    close(fds[1]);
+    const char *bin = nvsmi_bin();
+    execlp(bin, bin, "--query-gpu=index," NVSMI_QUERY, NVSMI_FORMAT, loop_arg,
+           (char *)NULL);
+    _exit(127);
+  }
+
+  close(fds[1]);
+  if (pid == -1) {
+    close(fds[0]);
+    return;
+  }
+  fcntl(fds[0], F_SETFL, O_NONBLOCK);
+  fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+  nvsmi.pid = pid;
+  nvsmi.fd = fds[0];
+}
+
+static inline void nvsmi_stream_row(const char *line, const char *end) {
+  int err = 0;
+  uint32_t idx = tok_u32(&line, end, &err);
+  if (err || idx >= MAX_NUM_GPUS)
+    return; // Not a row, a partial one, or a GPU we have no slot for
+  line = tok_find2(line, end, ',', '\n');
+  line = tok_skip_blanks(line + (line < end), end);
+
+  if (nvsmi.pass_seen & 1u << idx) {
+    // A new pass: the last one was complete. Publish it here unless its
+    // last row already did, i.e. unless it had exactly GPUs 0..set_size-1.
+    if (nvsmi.pass_seen != (1u << nvsmi.set_size) - 1) {
+      nvsmi.set_size = nvsmi.pass_top;
+      nvsmi.pending.num_gpus = nvsmi.set_size;
+      nvsmi.latest = nvsmi.pending;
+    }
+    nvsmi.pass_top = 0;
+    nvsmi.pass_seen = 0;
+  }
+  nvsmi.pass_seen |= 1u << idx;
+  if (idx + 1 > nvsmi.pass_top)
+    nvsmi.pass_top = idx + 1;
+
+  struct gpu_instance g;
+  parse_gpu_row(line, end, &g, &err);
+  if (!err) // Drop malformed rows, keep streaming.
+    nvsmi.pending.gpu[idx] = g;
+
+  if (nvsmi.set_size && nvsmi.pass_seen == (1u << nvsmi.set_size) - 1) {
+    nvsmi.pending.num_gpus = nvsmi.set_size;
+    nvsmi.latest = nvsmi.pending;
+  }
+}
+
+// Drain whatever nvidia-smi has written since the last tick. Never blocks.
+static inline void nvsmi_stream_poll(void) {
+  if (nvsmi.fd < 0) {
+    if (monotonic_ns() < nvsmi.restart_ns)
+      return;
+    nvsmi_stream_start();
+    if (nvsmi.fd < 0)
+      return;
+  }
+
+  while (1) {
+    if (nvsmi.len == sizeof(nvsmi.buf) - 1)
+      nvsmi.len = 0; // A row this long is garbage, resynchronize.
+
+    ssize_t n = read(nvsmi.fd, nvsmi.buf + nvsmi.len,
+                     sizeof(nvsmi.buf) - 1 - nvsmi.len);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      break;
+    if (n <= 0) {
+      // nvidia-smi exited (or was never there). Try again later.
+      nvsmi_stream_stop();
+      nvsmi.latest.num_gpus = 0;
+      nvsmi.restart_ns = monotonic_ns() + 30000000000ull;
+      return;
+    }
+    nvsmi.len += n;
+
+    // Consume every complete line, keep the partial tail.
+    char *line = nvsmi.buf;
+    char *end = nvsmi.buf + nvsmi.len;
+    char *eol;
+    while ((eol = memchr(line, '\n', end - line))) {
+      nvsmi_stream_row(line, eol);
+      line = eol + 1;
+    }
+    nvsmi.len = end - line;
+    memmove(nvsmi.buf, line, nvsmi.len);
+  }
+}
+
+static inline void get_nvidia_gpu_info(struct gpu_record *gpu) {
+  // Long-running modes keep one nvidia-smi streaming.
+  if (nvsmi.enabled) {
+    nvsmi_stream_poll();
+    *gpu = nvsmi.latest;
     return;
   }
 
   // Fall back to NVIDIA if present
+  char nvsmi_cmd[PATH_MAX + 512];
+  snprintf(nvsmi_cmd, sizeof(nvsmi_cmd),
+           "%s --query-gpu=" NVSMI_QUERY " " NVSMI_FORMAT, nvsmi_bin());
   FILE *fp = popen(nvsmi_cmd, "r");
   if (!fp) {
     // nvidia-smi not available, no GPUs
@@ -338,59 +852,11 @@ static inline void get_gpu_info(struct gpu_record *gpu) {
   }
   nvsmi_contents[n_read] = '\0';
 
-  char *line = nvsmi_contents;
-  char *end = nvsmi_contents + n_read;
+  const char *line = nvsmi_contents;
+  const char *end = nvsmi_contents + n_read;
   for (size_t i = 0; i < MAX_NUM_GPUS; i++) {
-
-    char *gpu_name = line;
-    line = next_gpu_item(line, end);
-    char *gpu_sm_utilization = line;
-    line = next_gpu_item(line, end);
-    char *gpu_mem_bandwidth_utilization = line;
-    line = next_gpu_item(line, end);
-
-    char *gpu_mem_total = line;
-    line = next_gpu_item(line, end);
-    char *gpu_mem_used = line;
-    line = next_gpu_item(line, end);
-    char *gpu_mem_free = line;
-    line = next_gpu_item(line, end);
-
-    char *gpu_graphics_clock = line;
-    line = next_gpu_item(line, end);
-    char *gpu_mem_clock = line;
-    line = next_gpu_item(line, end);
-    char *gpu_video_clock = line;
-    line = next_gpu_item(line, end);
-
-    char *gpu_power_draw = line;
-    line = next_gpu_item(line, end);
-    char *gpu_temp = line;
-    line = next_gpu_item(line, end);
-
     int err = 0;
-    // Use strncpy to prevent buffer overflow
-    strncpy(gpu->gpu[i].gpu_name, gpu_name, sizeof(gpu->gpu[i].gpu_name) - 1);
-    gpu->gpu[i].gpu_name[sizeof(gpu->gpu[i].gpu_name) - 1] = '\0';
-    gpu->gpu[i].gpu_sm_utilization = str_to_u32(gpu_sm_utilization, &err);
-    gpu->gpu[i].gpu_mem_bandwidth_utilization =
-        str_to_u32(gpu_mem_bandwidth_utilization, &err);
-    gpu->gpu[i].gpu_mem_total = str_to_u32(gpu_mem_total, &err);
-    gpu->gpu[i].gpu_mem_used = str_to_u32(gpu_mem_used, &err);
-    gpu->gpu[i].gpu_mem_free = str_to_u32(gpu_mem_free, &err);
-
-    // Handle division by zero gracefully
-    if (gpu->gpu[i].gpu_mem_total > 0) {
-      gpu->gpu[i].gpu_mem_used_percentage =
-          100.0 * ((float)gpu->gpu[i].gpu_mem_used / (float)gpu->gpu[i].gpu_mem_total);
-    } else {
-      gpu->gpu[i].gpu_mem_used_percentage = 0.0;
-    }
-    gpu->gpu[i].gpu_graphics_clock = str_to_u32(gpu_graphics_clock, &err);
-    gpu->gpu[i].gpu_mem_clock = str_to_u32(gpu_mem_clock, &err);
-    gpu->gpu[i].gpu_video_clock = str_to_u32(gpu_video_clock, &err);
-    gpu->gpu[i].gpu_power_draw = str_to_u32(gpu_power_draw, &err);
-    gpu->gpu[i].gpu_temp = str_to_u32(gpu_temp, &err);
+    line = parse_gpu_row(line, end, &gpu->gpu[i], &err);
     if (err)
       puts("Failed to parse nvidia-smi output."), exit(1);
 
@@ -400,136 +866,252 @@ static inline void get_gpu_info(struct gpu_record *gpu) {
   }
 }
 
-static inline void get_cpu_info(cpu_record *cpu) {
-  cpu->num_cpus = 0;
-
-  // read all of /proc/stat into cpu_line.
-  FILE *fp = fopen("/proc/stat", "r");
-  if (!fp)
-    puts("Failed to open /proc/stat."), exit(1);
+// GPUs from DRM fdinfo, after the NVIDIA ones (drmscan.h).
+static struct drm_scanner drm;
+static int drm_enabled = 0;
 
-  char stat_contents[81920];
-  size_t n_read = fread(stat_contents, 1, sizeof(stat_contents) - 1, fp);
-  if (!n_read)
-    puts("Failed to read from /proc/stat."), exit(1);
-  fclose(fp);
-  stat_contents[n_read] = '\0';
-
-  // Pass over the first line.
-  char *p = stat_contents;
-  char *end = stat_contents + n_read;
-  while (*p && *p != '\n' && p < end)
-    p++;
-  if (p < end)
-    p++;
+static inline const char *proc_root(void) {
+  const char *root = getenv("SYS_GENMON_PROC_ROOT");
+  return root && *root ? root : "/proc";
+}
 
-  // Parse the cpuX fields.
-  while (p < end) {
+static inline void get_drm_gpu_info(struct gpu_record *gpu) {
+  if (!drm_enabled) {
+    if ((hw_caps()->gpu & CAPS_GPU_ASAHI) && gpu->num_gpus < MAX_NUM_GPUS)
+      get_asahi_gpu_info(&gpu->gpu[gpu->num_gpus++]);
+    return;
+  }
 
-    // Verify that the line starts with "cpu".
-    char *name = p;
-    if (*p++ != 'c')
-      return;
-    if (*p++ != 'p')
-      return;
-    if (*p++ != 'u')
-      return;
+  drmscan_sample(&drm);
+  for (size_t i = 0; i < drm.num_devices && gpu->num_gpus < MAX_NUM_GPUS; i++) {
+    struct drm_device *d = &drm.devices[i];
+    if (!strcmp(d->driver, "nvidia-drm"))
+      continue; // nvidia-smi reports those
+    struct gpu_instance *g = &gpu->gpu[gpu->num_gpus++];
+    memset(g, 0, sizeof(*g));
+    if (!strcmp(d->driver, "asahi"))
+      snprintf(g->gpu_name, sizeof(g->gpu_name), "Apple GPU (asahi)");
+    else if (d->pdev[0])
+      snprintf(g->gpu_name, sizeof(g->gpu_name), "%s %s", d->driver, d->pdev);
+    else
+      snprintf(g->gpu_name, sizeof(g->gpu_name), "%s", d->driver);
+    g->gpu_sm_utilization = (uint32_t)(d->utilization + 0.5f);
+    g->gpu_mem_used = (uint32_t)(d->resident_bytes >> 20); // MiB, like nvidia-smi
+  }
+}
 
-    // Check bounds before adding CPU
-    if (cpu->num_cpus >= MAX_NUM_CPUS) {
-      puts("Too many CPUs detected. Exiting."), exit(1);
-    }
+static inline void get_gpu_info(struct gpu_record *gpu) {
+  gpu->num_gpus = 0;
 
-    // Parse the cpu number with bounds checking
-    while (*p && *p != ' ' && p < end)
-      p++;
-    if (p < end)
-      *p++ = '\0';
-    strncpy(cpu->cpu[cpu->num_cpus].cpu_number, name, sizeof(cpu->cpu[cpu->num_cpus].cpu_number) - 1);
-    cpu->cpu[cpu->num_cpus].cpu_number[sizeof(cpu->cpu[cpu->num_cpus].cpu_number) - 1] = '\0';
+  // Only run nvidia-smi where the driver was found (or a stub is named).
+  if ((hw_caps()->gpu & CAPS_GPU_NVIDIA) || getenv("SYS_GENMON_NVSMI"))
+    get_nvidia_gpu_info(gpu);
+  get_drm_gpu_info(gpu);
+}
 
-    // Parse the cpu fields with bounds checking
-    int err = 0;
+// Streaming collection for the long-running modes: one nvidia-smi loop,
+// and the incremental DRM fdinfo scanner (which needs the previous sample).
+static inline void enable_gpu_streaming(uint32_t loop_ms) {
+  nvsmi.enabled = 1;
+  nvsmi.loop_ms = loop_ms;
+  drm.root = proc_root();
+  drm_enabled = 1;
+}
 
-    char *user = p;
-    while (*p && *p != ' ' && p < end)
-      p++;
-    if (p < end) *p++ = '\0';
-    cpu->cpu[cpu->num_cpus].user = str_to_u32(user, &err);
+// Top processes (procscan.h), for the long-running modes: CPU% needs the
+// previous sample of each process.
+static struct proc_scanner procs = {.root_fd = -1};
+// Live core frequencies (cpufreq.h) for the daemon and --tui, which keep
+// the files open; one-shot runs would open every core's each time, so they
+// get frequencies from the daemon's snapshot or not at all.
+static int freq_enabled = 0;
+
+static inline void enable_cpu_freq(void) {
+  const struct hw_caps *c = hw_caps();
+  if (!c->cpufreq)
+    return; // No cpufreq here (most VMs): nothing to open per core
+  if (cpufreq_init(&cpu_freq, num_cpu_slots))
+    puts("Out of memory."), exit(1);
+  cpu_freq.max_by_id = c->max_khz;
+  cpu_freq.num_ids = c->num_cpu_slots;
+  freq_enabled = 1;
+}
 
-    char *nice = p; // Skip nice because it's not used in the calculation.
-    while (*p && *p != ' ' && p < end)
-      p++;
-    if (p < end) p++;
-    (void)nice;
+static int procs_enabled = 0;
 
-    char *system = p;
-    while (*p && *p != ' ' && p < end)
-      p++;
-    if (p < end) *p++ = '\0';
-    cpu->cpu[cpu->num_cpus].system = str_to_u32(system, &err);
+static inline void enable_proc_scan(void) {
+  procs_enabled = procscan_init(&procs, proc_root()) == 0;
+}
 
-    char *idle = p;
-    while (*p && *p != ' ' && p < end)
-      p++;
-    if (p < end) *p++ = '\0';
-    cpu->cpu[cpu->num_cpus].idle = str_to_u32(idle, &err);
+static inline void get_proc_info(proc_record *proc) {
+  proc->num_cpu = proc->num_rss = 0;
+  if (!procs_enabled)
+    return;
+  procscan_sample(&procs, monotonic_ns());
+  procscan_top(&procs, proc->cpu, &proc->num_cpu, proc->rss, &proc->num_rss);
+}
 
-    char *iowait = p;
-    while (*p && *p != ' ' && p < end)
-      p++;
-    if (p < end) *p++ = '\0';
-    cpu->cpu[cpu->num_cpus].iowait = str_to_u32(iowait, &err);
+// Top cgroups (cgscan.h), for the same modes, down to --cgroup-depth. The
+// walker keeps a quarter of the fds the process scanner may hold. The tree
+// is the cgroup2 mount, or the unified one of a hybrid setup, or
+// SYS_GENMON_CGROUP_ROOT for a fake one.
+static struct cgroup_scanner cgs = {.root_fd = -1};
+static int cgs_enabled = 0;
+static unsigned cgroup_depth = CGSCAN_DEFAULT_DEPTH;
+
+static inline void enable_cgroup_scan(void) {
+  const char *root = getenv("SYS_GENMON_CGROUP_ROOT");
+  size_t fds = procs.max_fds / 4;
+  if (!cgroup_depth)
+    return;
+  if (root && *root ? cgscan_init(&cgs, root, cgroup_depth, fds)
+                    : cgscan_init(&cgs, "/sys/fs/cgroup", cgroup_depth, fds) &&
+                          cgscan_init(&cgs, "/sys/fs/cgroup/unified",
+                                      cgroup_depth, fds))
+    return;
+  procs.max_fds -= fds;
+  cgs_enabled = 1;
+}
 
-    char *irq = p;
-    while (*p && *p != ' ' && p < end)
-      p++;
-    if (p < end) *p++ = '\0';
-    cpu->cpu[cpu->num_cpus].irq = str_to_u32(irq, &err);
+static inline void get_cgtop_info(cgtop_record *top) {
+  top->num_cpu = top->num_mem = 0;
+  if (!cgs_enabled)
+    return;
+  cgscan_sample(&cgs, monotonic_ns());
+  cgscan_top(&cgs, top->cpu, &top->num_cpu, top->mem, &top->num_mem);
+}
 
-    char *softirq = p;
-    while (*p && *p != ' ' && p < end)
-      p++;
-    if (p < end) *p++ = '\0';
-    cpu->cpu[cpu->num_cpus].softirq = str_to_u32(softirq, &err);
+// Disk and network rates since the previous sample, whose counters are
+// kept in shm so one-shot runs have a baseline too.
+static inline void get_io_info(io_record *io) {
+  static struct iostat_sample cur;
+  io->num_disks = io->num_nets = 0;
+  if (!prev_io)
+    return;
+  struct prof_mark mark = prof_begin();
+  ssize_t disks = procfs_read(&proc_diskstats, &diskstats_buf);
+  ssize_t nets = procfs_read(&proc_netdev, &netdev_buf);
+  prof_end(PROF_READ, mark);
+
+  mark = prof_begin();
+  cur.num_disks = cur.num_nets = 0;
+  if (disks > 0)
+    diskstats_parse(&cur, diskstats_buf.data, disks, &disk_filter);
+  if (nets > 0)
+    netdev_parse(&cur, netdev_buf.data, nets, &net_filter);
+  cur.ns = monotonic_ns();
+  iostat_rates(prev_io, &cur, io->disk, &io->num_disks, io->net, &io->num_nets);
+  *prev_io = cur;
+  prof_end(PROF_PARSE, mark);
+}
 
-    char *steal = p;
-    while (*p && *p != ' ' && p < end)
-      p++;
-    if (p < end) *p++ = '\0';
-    cpu->cpu[cpu->num_cpus].steal = str_to_u32(steal, &err);
+// Pressure stall information, system-wide and for our cgroup. The stall
+// over the interval is against totals kept in shm, like the I/O counters.
+static struct psi_reader psi;
+static int psi_ready = 0;
 
-    char *guest = p;
-    while (*p && *p != ' ' && p < end)
-      p++;
-    if (p < end) *p++ = '\0';
-    cpu->cpu[cpu->num_cpus].guest = str_to_u32(guest, &err);
+static inline void get_psi_info(struct psi_record *out) {
+  if (!prev_psi) {
+    memset(out, 0, sizeof(*out));
+    return;
+  }
+  if (!psi_ready) {
+    psi_init(&psi, proc_root(), "/sys/fs/cgroup");
+    psi_ready = 1;
+  }
+  psi_read(&psi, prev_psi, out, monotonic_ns());
+}
 
-    char *guest_nice =
-        p; // Skip guest_nice, because it's not used in the calculation.
-    while (*p && ((*p != ' ') & (*p != '\n')) && p < end)
-      p++;
-    if (p < end) p++;
-    (void)guest_nice;
+// --cgroup: our cgroup's CPU quota and memory limit and the usage against
+// them, with only the cores we may run on parsed out of /proc/stat.
+static int cgroup_view = 0;
+static struct cgroup_reader cgroup;
+static struct cpustat_mask cgroup_cpus;
+
+static inline void enable_cgroup_view(void) {
+  if (cgroup_init(&cgroup, proc_root(), "/sys/fs/cgroup"))
+    fputs("Not in a cgroup v2 of our own; showing the cores we may use.\n",
+          stderr);
+  if (cgroup_cpu_mask(&cgroup, &cgroup_cpus))
+    puts("Failed to read the CPU affinity."), exit(1);
+  cgroup_view = 1;
+  burst.mask = &cgroup_cpus;
+}
 
-    if (err)
-      puts("Failed to parse /proc/stat."), exit(1);
+// A long-running view can be moved to another cpuset or re-pinned
+// (taskset -p); read the cores we may use again every CGROUP_MASK_EVERY
+// samples. A new set rebaselines in calculate_cpu_utilization.
+#define CGROUP_MASK_EVERY 10
+static inline void refresh_cgroup_mask(void) {
+  static unsigned samples;
+  if (++samples < CGROUP_MASK_EVERY)
+    return;
+  samples = 0;
+
+  struct cpustat_mask m = {0};
+  size_t words = (cgroup_cpus.num_ids + 63) / 64;
+  if (cgroup_cpu_mask(&cgroup, &m) ||
+      (m.num_ids == cgroup_cpus.num_ids &&
+       !memcmp(m.bits, cgroup_cpus.bits, words * sizeof(*m.bits)))) {
+    free(m.bits);
+    return;
+  }
+  free(cgroup_cpus.bits);
+  cgroup_cpus = m;
+}
 
-    cpu->num_cpus++;
+// Sample the cgroup and make its memory the one shown: used against
+// memory.max, or against the host's RAM if it has no limit.
+static inline void get_cgroup_info(struct cgroup_record *out, mem_record *mem) {
+  if (!cgroup_view || !prev_cgroup) {
+    memset(out, 0, sizeof(*out));
+    return;
   }
+  cgroup_sample(&cgroup, prev_cgroup, out, info.cpu_info.num_cpus,
+                monotonic_ns());
+  if (!out->have_mem)
+    return;
+  uint64_t total_kb = out->mem_max ? out->mem_max / 1024 : mem->mem_total;
+  uint64_t used_kb = out->mem_current / 1024;
+  if (total_kb > UINT32_MAX)
+    total_kb = mem->mem_total;
+  if (used_kb > total_kb)
+    used_kb = total_kb;
+  mem->mem_total = (uint32_t)total_kb;
+  mem->mem_used = (uint32_t)used_kb;
+  mem->mem_free = mem->mem_total - mem->mem_used;
+  mem->mem_percentage =
+      mem->mem_total ? 100.0f * mem->mem_used / mem->mem_total : 0;
 }
 
-static inline void get_mem_info(mem_record *mem) {
-  FILE *fp = fopen("/proc/meminfo", "r");
-  if (!fp)
-    puts("Failed to open /proc/meminfo."), exit(1);
+static inline void get_cpu_info(cpu_record *cpu) {
+  // read all of /proc/stat into stat_buf.
+  struct prof_mark mark = prof_begin();
+  ssize_t n_read = procfs_read(&proc_stat, &stat_buf);
+  prof_end(PROF_READ, mark);
+  if (n_read <= 0)
+    puts("Failed to read from /proc/stat."), exit(1);
+  if (cgroup_view)
+    refresh_cgroup_mask();
+
+  mark = prof_begin();
+  int rc = cpustat_parse_mask(cpu, stat_buf.data, n_read,
+                              cgroup_view ? &cgroup_cpus : NULL);
+  prof_end(PROF_PARSE, mark);
+  if (rc == CPUSTAT_ERR_TOO_MANY)
+    puts("Too many CPUs detected. Exiting."), exit(1);
+  if (rc)
+    puts("Failed to parse /proc/stat."), exit(1);
+}
 
-  char meminfo_contents[16384];
-  size_t n_read = fread(meminfo_contents, 1, sizeof(meminfo_contents) - 1, fp);
-  if (!n_read)
+static inline void get_mem_info(mem_record *mem) {
+  struct prof_mark mark = prof_begin();
+  ssize_t n_read = procfs_read(&proc_meminfo, &meminfo_buf);
+  prof_end(PROF_READ, mark);
+  if (n_read <= 0)
     puts("Failed to read from /proc/meminfo."), exit(1);
-  fclose(fp);
-  meminfo_contents[n_read] = '\0';
+  char *meminfo_contents = meminfo_buf.data;
+  mark = prof_begin();
 
   // Unrolled by gcc/clang
   struct {
@@ -545,8 +1127,8 @@ static inline void get_mem_info(mem_record *mem) {
   size_t n_items = sizeof(items) / sizeof(items[0]);
   size_t n_found = 0;
 
-  char *p = meminfo_contents;
-  char *end = meminfo_contents + n_read;
+  const char *p = meminfo_contents;
+  const char *end = meminfo_contents + n_read;
   while (1) {
     // Look for the items in order
     int hit_one = 0;
@@ -564,14 +1146,10 @@ static inline void get_mem_info(mem_record *mem) {
 
     // Skip ahead to the next line if we didn't find anything
     if (!hit_one) {
-      if (*p && p < end) {
-        while (*p && *p != '\n' && p < end)
-          p++;
-        if (*p == '\n' && p < end)
-          p++;
-      } else {
+      if (p < end && *p)
+        p = tok_next_line(p, end);
+      else
         break;
-      }
     }
   }
 
@@ -591,64 +1169,150 @@ static inline void get_mem_info(mem_record *mem) {
   } else {
     mem->swp_percentage = 0.0;
   }
+  prof_end(PROF_PARSE, mark);
 }
 
 static inline float *calculate_cpu_utilization(cpu_record *prev,
                                                cpu_record *current) {
-  size_t num_cpus = prev->num_cpus;
-  if (num_cpus == 0)
+  if (current->num_cpus == 0)
     puts("No CPUs found. Exiting."), exit(1);
-  if (prev->num_cpus != current->num_cpus)
-    puts("Number of CPUs changed. Exiting."), exit(1);
 
-  for (size_t i = 0; i < num_cpus; i++) {
-    uint32_t prev_idle = prev->cpu[i].idle + prev->cpu[i].iowait;
-    uint32_t current_idle = current->cpu[i].idle + current->cpu[i].iowait;
-
-    uint32_t prev_non_idle = prev->cpu[i].user + prev->cpu[i].system +
-                             prev->cpu[i].irq + prev->cpu[i].softirq +
-                             prev->cpu[i].steal + prev->cpu[i].guest;
-    uint32_t current_non_idle = current->cpu[i].user + current->cpu[i].system +
-                                current->cpu[i].irq + current->cpu[i].softirq +
-                                current->cpu[i].steal + current->cpu[i].guest;
-
-    uint32_t prev_total = prev_idle + prev_non_idle;
-    uint32_t current_total = current_idle + current_non_idle;
-
-    // Check for underflow/wraparound - if current < prev, counters wrapped or bad data
-    if (current_idle < prev_idle || current_total < prev_total) {
-      utilization[i] = 0.0;
-      continue;
-    }
+  // A different set of cores (hotplug, a new cpuset) starts over from this
+  // sample, which becomes the baseline: the interval reads idle.
+  if (prev->num_cpus != current->num_cpus ||
+      memcmp(prev->id, current->id, current->num_cpus * sizeof(*current->id))) {
+    memset(utilization, 0, num_cpu_slots * sizeof(*utilization));
+    avg_utilization = 0;
+    return utilization;
+  }
+
+  avg_utilization = cpustat_utilization(prev, current, utilization);
+
+  return utilization;
+}
+
+// Allocate the per-core state once. capacity 0 sizes it from the
+// detected topology.
+static inline void init_cpu_storage(size_t capacity) {
+  if (!capacity)
+    capacity = hw_caps()->num_cpu_slots;
+  num_cpu_slots = capacity;
+
+  utilization = calloc(capacity, sizeof(*utilization));
+  burst_stats.max = calloc(3 * capacity, sizeof(uint32_t));
+  if (!utilization || !burst_stats.max || cpustat_alloc(&info.cpu_info, capacity))
+    puts("Out of memory."), exit(1);
+  burst_stats.p95 = burst_stats.max + capacity;
+  burst_stats.above_ms = burst_stats.max + 2 * capacity;
+}
 
-    uint32_t idle_diff = current_idle - prev_idle;
-    uint32_t total_diff = current_total - prev_total;
+static inline struct shm_consumer *shm_consumer(size_t k) {
+  return (struct shm_consumer *)(shm_slots + k * shm_slot_size);
+}
+
+// Point cpu, io, psi and cg at slot k's baselines.
+static inline void shm_consumer_bind(size_t k, struct cpu_record *cpu,
+                                     struct iostat_sample **io,
+                                     struct psi_baseline **psi,
+                                     struct cgroup_baseline **cg) {
+  char *p = (char *)shm_consumer(k) + cpustat_align(sizeof(struct shm_consumer));
+  cpustat_bind(cpu, p, num_cpu_slots);
+  p += cpustat_bytes(num_cpu_slots);
+  *io = (struct iostat_sample *)p;
+  p += cpustat_align(sizeof(struct iostat_sample));
+  *psi = (struct psi_baseline *)p;
+  *cg = (struct cgroup_baseline *)(p + cpustat_align(sizeof(struct psi_baseline)));
+}
 
-    float denom = (float)total_diff;
-    float ratio_idle = denom ? (float)idle_diff / denom : 0.0;
-    float percent_active = +(1.0 - ratio_idle) * 100; // Always positive to avoid signed zero.
-    utilization[i] = percent_active;
+// The slot named consumer_name, else an empty one, else the one used least
+// recently (evicted when we save).
+static inline size_t find_consumer(void) {
+  size_t pick = 0;
+  uint64_t oldest = UINT64_MAX;
+  for (size_t k = 0; k < SHM_CONSUMERS; k++) {
+    struct shm_consumer *c = shm_consumer(k);
+    if (!strncmp(c->name, consumer_name, SHM_CONSUMER_NAME))
+      return k;
+    uint64_t ts = c->name[0] ? c->timestamp_ns : 0;
+    if (ts < oldest)
+      oldest = ts, pick = k;
   }
+  return pick;
+}
 
-  avg_utilization = 0;
-  for (size_t i = 0; i < num_cpus; i++)
-    avg_utilization += utilization[i];
-  avg_utilization /= num_cpus;
+// Copy our baseline out of its slot. Returns 0 if there is none: a new or
+// evicted consumer, or a slot a writer kept busy throughout.
+static inline int load_consumer(void) {
+  struct shm_consumer *c = shm_consumer(consumer_slot);
+  struct cpu_record cpu;
+  struct iostat_sample *io;
+  struct psi_baseline *psi;
+  struct cgroup_baseline *cg;
+  shm_consumer_bind(consumer_slot, &cpu, &io, &psi, &cg);
+
+  for (int tries = 0; tries < 64; tries++) {
+    uint32_t seq = __atomic_load_n(&c->seq, __ATOMIC_ACQUIRE);
+    if (seq & 1)
+      continue;
 
-  return utilization;
+    int ours = !strncmp(c->name, consumer_name, SHM_CONSUMER_NAME);
+    uint64_t timestamp_ns = c->timestamp_ns;
+    uint64_t num_cpus = c->num_cpus;
+    cpustat_copy(&prev_cpu_record, &cpu);
+    *prev_io = *io;
+    *prev_psi = *psi;
+    *prev_cgroup = *cg;
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&c->seq, __ATOMIC_RELAXED) != seq)
+      continue;
+    if (!ours || !timestamp_ns || num_cpus > num_cpu_slots)
+      return 0;
+    prev_cpu_record.num_cpus = num_cpus;
+    prev_sample_ns = timestamp_ns;
+    return 1;
+  }
+  return 0;
 }
 
-static inline void get_prev_cpu_info() {
+// Map the segment and bind the history and profile blocks in it. Formatting
+// a daemon's snapshot needs nothing else, so attach only maps a segment
+// the daemon already set up, without resizing it or taking a slot.
+// Returns 0, or -1 if attach found no such segment.
+static inline int map_shm(int attach) {
   const size_t psm1 = PAGE_SIZE - 1;
-  const size_t shm_size = (sizeof(cpu_record) + 1 + psm1) & ~psm1;
+  const size_t hdr_size = cpustat_align(sizeof(struct shm_header));
+  const size_t history_rows = num_cpu_slots + 1; // Average, then each core
+  const size_t prof_offset = hdr_size + history_bytes(history_rows);
+  const size_t slots_offset =
+      prof_offset + cpustat_align(sizeof(struct prof_block));
+  shm_slot_size = cpustat_align(sizeof(struct shm_consumer)) +
+                  cpustat_bytes(num_cpu_slots) +
+                  cpustat_align(sizeof(struct iostat_sample)) +
+                  cpustat_align(sizeof(struct psi_baseline)) +
+                  cpustat_align(sizeof(struct cgroup_baseline));
+  const size_t shm_size =
+      (slots_offset + SHM_CONSUMERS * shm_slot_size + psm1) & ~psm1;
 
   // Open the shared memory file with secure permissions (user-only)
-  int fd = shm_open(shm_name, O_CREAT | O_RDWR, 0600);
+  int fd = shm_open(shm_name, attach ? O_RDWR : O_CREAT | O_RDWR, 0600);
+  if (fd == -1 && attach)
+    return -1;
   if (fd == -1)
     perror("shm_open"), puts("Failed to shm_open()."), exit(1);
 
+  // A segment sized for a different CPU count is emptied first.
   // Setting the size zeros the memory if it hasn't already been mapped.
-  if (ftruncate(fd, shm_size) == -1)
+  struct stat st;
+  if (fstat(fd, &st) == -1)
+    puts("Failed to stat the shared memory file."), exit(1);
+  if (attach && (size_t)st.st_size != shm_size) {
+    close(fd);
+    return -1;
+  }
+  if (!attach && (size_t)st.st_size != shm_size && ftruncate(fd, 0) == -1)
+    puts("Failed to ftruncate the shared memory file."), exit(1);
+  if (!attach && ftruncate(fd, shm_size) == -1)
     puts("Failed to ftruncate the shared memory file."), exit(1);
 
   char *shm_contents =
@@ -659,53 +1323,341 @@ static inline void get_prev_cpu_info() {
   // Dispose of the file descriptor.
   close(fd);
 
-  // Check if it's the first time this process has been run.
-  // If it is, we need to take new measurments and pack it in, so that we have a
+  shm_hdr = (struct shm_header *)shm_contents;
+  if (attach && (shm_hdr->layout != SHM_LAYOUT ||
+                 shm_hdr->capacity != num_cpu_slots)) {
+    munmap(shm_contents, shm_size);
+    shm_hdr = NULL;
+    return -1;
+  }
+  history_bind(&history, shm_contents + hdr_size, history_rows);
+  prof = (struct prof_block *)(shm_contents + prof_offset);
+  shm_slots = shm_contents + slots_offset;
+
+  if (shm_hdr->layout != SHM_LAYOUT || shm_hdr->capacity != num_cpu_slots) {
+    shm_hdr->layout = SHM_LAYOUT;
+    shm_hdr->capacity = num_cpu_slots;
+    history_init(&history, history_rows);
+    memset(shm_slots, 0, SHM_CONSUMERS * shm_slot_size);
+  }
+  return 0;
+}
+
+static inline void get_prev_cpu_info() {
+  // Mapped once per process.
+  if (prev_cpu_info)
+    return;
+  map_shm(0);
+
+  static struct iostat_sample io_baseline;
+  static struct psi_baseline psi_baseline;
+  static struct cgroup_baseline cgroup_baseline;
+  if (cpustat_alloc(&prev_cpu_record, num_cpu_slots))
+    puts("Out of memory."), exit(1);
+  prev_io = &io_baseline;
+  prev_psi = &psi_baseline;
+  prev_cgroup = &cgroup_baseline;
+
+  // A consumer without a baseline takes one now, so that it has a
   // reference point.
-  char *flagptr = shm_contents + sizeof(cpu_record);
-  if (*flagptr == '\0') {
-    *flagptr = 1;
-    get_cpu_info((cpu_record *)shm_contents);
+  consumer_slot = find_consumer();
+  if (!load_consumer()) {
+    get_cpu_info(&prev_cpu_record);
+    memset(prev_io, 0, sizeof(*prev_io));
+    memset(prev_psi, 0, sizeof(*prev_psi));
+    memset(prev_cgroup, 0, sizeof(*prev_cgroup));
+    prev_sample_ns = 0;
   }
+  prev_cpu_info = &prev_cpu_record;
+}
 
-  // Check if it's the first time this function has been run in the current
-  // process. If it is, yoink the shm_contents buffer. Or copy and unmap.
-  if (!prev_cpu_info) {
-    prev_cpu_info = (cpu_record *)shm_contents;
-  } else {
-    memcpy(prev_cpu_info, shm_contents, sizeof(cpu_record));
-    munmap(shm_contents, shm_size);
+// Make cpu, taken at now_ns, the baseline for the next sample, here and
+// in our slot. If another instance of this consumer is saving at the same
+// moment, its baseline will do.
+static inline void save_cpu_shm(cpu_record *cpu, uint64_t now_ns) {
+  cpustat_copy(prev_cpu_info, cpu);
+  prev_sample_ns = now_ns;
+
+  struct shm_consumer *c = shm_consumer(consumer_slot);
+  uint64_t claim = __atomic_load_n(&c->claim_ns, __ATOMIC_ACQUIRE);
+  // Held; take it over only from a writer that died mid-update.
+  if (claim && (now_ns < claim || now_ns - claim < SHM_STALE_NS))
+    return;
+  if (!__atomic_compare_exchange_n(&c->claim_ns, &claim, now_ns, 0,
+                                   __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+    return;
+
+  // Odd, also if a dead writer left it so.
+  uint32_t seq = __atomic_load_n(&c->seq, __ATOMIC_RELAXED) | 1;
+  __atomic_store_n(&c->seq, seq, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+
+  struct cpu_record slot_cpu;
+  struct iostat_sample *io;
+  struct psi_baseline *psi;
+  struct cgroup_baseline *cg;
+  shm_consumer_bind(consumer_slot, &slot_cpu, &io, &psi, &cg);
+  strncpy(c->name, consumer_name, SHM_CONSUMER_NAME);
+  c->timestamp_ns = now_ns;
+  c->num_cpus = cpu->num_cpus;
+  cpustat_copy(&slot_cpu, cpu);
+  *io = *prev_io;
+  *psi = *prev_psi;
+  *cg = *prev_cgroup;
+
+  __atomic_store_n(&c->seq, seq + 1, __ATOMIC_RELEASE);
+  __atomic_store_n(&c->claim_ns, 0, __ATOMIC_RELEASE);
+}
+
+// Daemon snapshot
+
+#define SNAPSHOT_CORE_ARRAYS 6
+
+// The per-core uint32_t arrays of cpu that travel in the snapshot.
+static inline void snapshot_core_arrays(struct cpu_record *cpu,
+                                        uint32_t *arrays[SNAPSHOT_CORE_ARRAYS]) {
+  arrays[0] = cpu->id;
+  arrays[1] = cpu->freq_khz;
+  arrays[2] = cpu->freq_max_khz;
+  arrays[3] = burst_stats.max;
+  arrays[4] = burst_stats.p95;
+  arrays[5] = burst_stats.above_ms;
+}
+
+static inline size_t snapshot_size(size_t capacity) {
+  return sizeof(struct snapshot) +
+         capacity * (sizeof(float) + SNAPSHOT_CORE_ARRAYS * sizeof(uint32_t));
+}
+
+static inline uint32_t *snapshot_array(struct snapshot *snap, size_t capacity,
+                                       size_t k) {
+  return (uint32_t *)(snap->utilization + capacity) + k * capacity;
+}
+
+// The snapshot has one writer: two daemons would interleave their seq
+// updates, and a reader could take a torn copy between two even values.
+// The lock is held on the descriptor, kept open for the life of the
+// daemon; the kernel drops it if the daemon dies.
+static inline struct snapshot *map_snapshot(void) {
+  int fd;
+  for (;;) {
+    fd = shm_open(snap_name, O_CREAT | O_RDWR, 0600);
+    if (fd == -1)
+      perror("shm_open"), puts("Failed to shm_open() the snapshot."), exit(1);
+    if (flock(fd, LOCK_EX | LOCK_NB) == -1) {
+      if (errno == EWOULDBLOCK)
+        puts("Another daemon is already running."), exit(1);
+      puts("Failed to lock the snapshot."), exit(1);
+    }
+    // A daemon on its way out unlinks the snapshot; lock the new one.
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_nlink)
+      break;
+    close(fd);
   }
+
+  size_t size = snapshot_size(num_cpu_slots);
+  if (ftruncate(fd, size) == -1)
+    puts("Failed to ftruncate the snapshot file."), exit(1);
+
+  struct snapshot *snap =
+      mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (snap == MAP_FAILED)
+    puts("Failed to mmap the snapshot file."), exit(1);
+
+  snap->capacity = num_cpu_slots;
+  return snap;
 }
 
-static inline void save_cpu_shm(cpu_record *cpu) {
-  memcpy((char *)prev_cpu_info, cpu, sizeof(cpu_record));
+static inline void publish_snapshot(struct snapshot *snap, uint32_t interval_ms) {
+  uint32_t seq = __atomic_load_n(&snap->seq, __ATOMIC_RELAXED);
+  __atomic_store_n(&snap->seq, seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+
+  snap->interval_ms = interval_ms;
+  snap->timestamp_ns = monotonic_ns();
+  snap->num_cpus = info.cpu_info.num_cpus;
+  snap->avg_utilization = avg_utilization;
+  snap->burst_hz = burst_hz;
+  snap->burst_threshold = burst_threshold;
+  snap->gpu_info = info.gpu_info;
+  snap->mem_info = info.mem_info;
+  snap->proc_info = info.proc_info;
+  snap->cgtop_info = info.cgtop_info;
+  snap->io_info = info.io_info;
+  snap->psi_info = info.psi_info;
+  snap->cgroup_info = info.cgroup_info;
+  memcpy(snap->utilization, utilization, num_cpu_slots * sizeof(float));
+  uint32_t *arrays[SNAPSHOT_CORE_ARRAYS];
+  snapshot_core_arrays(&info.cpu_info, arrays);
+  for (size_t k = 0; k < SNAPSHOT_CORE_ARRAYS; k++)
+    memcpy(snapshot_array(snap, num_cpu_slots, k), arrays[k],
+           num_cpu_slots * sizeof(uint32_t));
+
+  __atomic_store_n(&snap->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+// Copy the latest daemon snapshot into info/utilization, allocating the
+// per-core state to match it. Returns 0 if there is no daemon, or if it
+// stopped publishing.
+static inline int read_snapshot(void) {
+  int fd = shm_open(snap_name, O_RDONLY, 0);
+  if (fd == -1)
+    return 0;
+
+  struct stat st;
+  if (fstat(fd, &st) == -1 || (size_t)st.st_size < snapshot_size(1)) {
+    close(fd);
+    return 0;
+  }
+
+  size_t size = st.st_size;
+  struct snapshot *snap = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (snap == MAP_FAILED)
+    return 0;
+
+  size_t capacity = snap->capacity;
+  if (!capacity || snapshot_size(capacity) != size) {
+    munmap(snap, size);
+    return 0;
+  }
+  init_cpu_storage(capacity);
+  uint32_t *arrays[SNAPSHOT_CORE_ARRAYS];
+  snapshot_core_arrays(&info.cpu_info, arrays);
+
+  int ok = 0;
+  for (int tries = 0; tries < 64 && !ok; tries++) {
+    uint32_t seq = __atomic_load_n(&snap->seq, __ATOMIC_ACQUIRE);
+    if (seq & 1)
+      continue;
+
+    uint64_t timestamp_ns = snap->timestamp_ns;
+    uint32_t interval_ms = snap->interval_ms;
+    sample_interval_ns = interval_ms * 1000000ull;
+    info.cpu_info.num_cpus = snap->num_cpus;
+    avg_utilization = snap->avg_utilization;
+    burst_hz = snap->burst_hz;
+    burst_threshold = snap->burst_threshold;
+    info.gpu_info = snap->gpu_info;
+    info.mem_info = snap->mem_info;
+    info.proc_info = snap->proc_info;
+    info.cgtop_info = snap->cgtop_info;
+    info.io_info = snap->io_info;
+    info.psi_info = snap->psi_info;
+    info.cgroup_info = snap->cgroup_info;
+    memcpy(utilization, snap->utilization, capacity * sizeof(float));
+    for (size_t k = 0; k < SNAPSHOT_CORE_ARRAYS; k++)
+      memcpy(arrays[k], snapshot_array(snap, capacity, k),
+             capacity * sizeof(uint32_t));
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&snap->seq, __ATOMIC_RELAXED) != seq)
+      continue;
+
+    // A snapshot older than a few intervals means the daemon is gone.
+    if (!seq || !timestamp_ns || info.cpu_info.num_cpus > capacity)
+      break;
+    uint64_t max_age_ns = (uint64_t)interval_ms * 3000000ull + 1000000000ull;
+    ok = monotonic_ns() - timestamp_ns <= max_age_ns;
+    break;
+  }
+
+  munmap(snap, size);
+  if (!ok) {
+    // Start over sized from this machine's topology.
+    free(utilization);
+    free(burst_stats.max);
+    cpustat_free(&info.cpu_info);
+    utilization = NULL;
+    burst_stats.max = NULL;
+    burst_hz = 0;
+  }
+  return ok;
 }
 
 // Print results
 
+// Output buffer, grows with the number of cores.
 #define BUF_SIZE (4096 * 20)
+#define BUF_SIZE_PER_CPU 256
+static size_t buf_cap = BUF_SIZE;
+
 #define PRN(...) do { \
-  size_t remaining = BUF_SIZE - buf_len; \
+  size_t remaining = buf_cap - buf_len; \
   if (remaining > 0) { \
     int written = snprintf(buf + buf_len, remaining, __VA_ARGS__); \
-    if (written > 0) buf_len += (written < (int)remaining) ? written : remaining - 1; \
+    if (written > 0) buf_len += ((size_t)written < remaining) ? (size_t)written : remaining - 1; \
   } \
 } while(0)
 
+// " @ 3.20 GHz" for core i, or nothing if its frequency is unknown.
+static inline size_t print_cpu_freq(char *buf, size_t buf_len, size_t i) {
+  uint32_t khz = info.cpu_info.freq_khz[i];
+  if (khz)
+    PRN(" @ %.2f GHz", khz / 1e6);
+  return buf_len;
+}
+
+// Peak, p95 and time over the threshold since the last update, when the
+// sampler runs with --burst.
+static inline size_t print_cpu_burst(char *buf, size_t buf_len, size_t i) {
+  if (burst_hz)
+    PRN("  peak %3" PRIu32 "%%  p95 %3" PRIu32 "%%  %5.2fs over %.0f%%",
+        burst_stats.max[i], burst_stats.p95[i],
+        burst_stats.above_ms[i] / 1000.0, burst_threshold);
+  return buf_len;
+}
+
+// One history row as a Unicode block sparkline, width characters wide,
+// each the mean of the buckets it spans. Blank where there is no data.
+static inline size_t print_sparkline(char *buf, size_t buf_len, size_t tier,
+                                     size_t row, size_t width) {
+  static const char *const blocks[8] = {"▁", "▂", "▃", "▄", "▅", "▆", "▇", "█"};
+  uint8_t values[HISTORY_MAX_LENGTH];
+  size_t n = history.hdr ? history_read(&history, tier, row, values,
+                                        history_config[tier].length) : 0;
+  for (size_t c = 0; c < width && n; c++) {
+    size_t sum = 0, count = 0;
+    for (size_t i = c * n / width; i < (c + 1) * n / width; i++)
+      if (values[i] != HISTORY_EMPTY)
+        sum += values[i], count++;
+    if (count)
+      PRN("%s", blocks[sum / count * 8 / 101]);
+    else
+      PRN(" ");
+  }
+  return buf_len;
+}
+
+// Whether anything has been recorded yet.
+static inline int have_history(void) {
+  return history.hdr && history.hdr->tier[0].bucket;
+}
+
 static inline size_t print_cpu_utilization(size_t num_cpus, char *buf,
                                            size_t buf_len, int genmon,
                                            int bar) {
   if (genmon) PRN("<big><b><span weight='bold'>");
   PRN("CPU Utilization:");
   if (genmon) PRN("</span></b></big>");
+  if (sample_interval_ns)
+    PRN(" over %.1fs", sample_interval_ns / 1e9);
   PRN("\n");
+  if (have_history()) {
+    PRN("  Last 2m: ");
+    buf_len = print_sparkline(buf, buf_len, 0, 0, 30);
+    PRN("\n");
+  }
   for (size_t i = 0; i < num_cpus; i++) {
     if (bar) {
-      PRN("  CPU %2zu: %2.0f%%\n", i, utilization[i]);
+      PRN("  CPU %2" PRIu32 ": %2.0f%%", info.cpu_info.id[i], utilization[i]);
     } else {
-      PRN("  CPU %2zu: %2.0f%%\n", i, utilization[i]);
+      PRN("  CPU %2" PRIu32 ": %2.0f%%", info.cpu_info.id[i], utilization[i]);
     }
+    buf_len = print_cpu_freq(buf, buf_len, i);
+    buf_len = print_cpu_burst(buf, buf_len, i);
+    PRN("\n");
   }
   PRN("\n");
   return buf_len;
@@ -760,6 +1712,206 @@ static inline size_t print_gpu_info(gpu_record *gpu, char *buf, size_t buf_len,
   return buf_len;
 }
 
+// Process names are whatever the process set; escape them for Pango.
+static inline size_t print_comm(char *buf, size_t buf_len, const char *comm,
+                                int genmon) {
+  for (const char *c = comm; *c; c++) {
+    if (genmon && *c == '<')
+      PRN("&lt;");
+    else if (genmon && *c == '>')
+      PRN("&gt;");
+    else if (genmon && *c == '&')
+      PRN("&amp;");
+    else
+      PRN("%c", *c >= ' ' && *c != 0x7f ? *c : '?');
+  }
+  return buf_len;
+}
+
+static inline size_t print_top_list(char *buf, size_t buf_len,
+                                    const struct top_process *top, size_t n,
+                                    const char *title, int genmon) {
+  if (!n)
+    return buf_len;
+  if (title) {
+    if (genmon) PRN("<big><b><span weight='bold'>");
+    PRN("%s:", title);
+    if (genmon) PRN("</span></b></big>");
+    PRN("\n");
+  }
+  for (size_t i = 0; i < n; i++) {
+    PRN("  %7" PRId32 " ", top[i].pid);
+    buf_len = print_comm(buf, buf_len, top[i].comm, genmon);
+    size_t shown = strnlen(top[i].comm, PROCSCAN_COMM_LEN);
+    PRN("%*s %6.1f%% %8.1f MiB\n", (int)(PROCSCAN_COMM_LEN - 1 - shown), "",
+        top[i].cpu, top[i].rss_kb / 1024.0);
+  }
+  return buf_len;
+}
+
+// Top processes over the last interval (--daemon and --tui only).
+static inline size_t print_top_processes(proc_record *proc, char *buf,
+                                         size_t buf_len, int genmon) {
+  buf_len = print_top_list(buf, buf_len, proc->cpu, proc->num_cpu,
+                           "Top CPU", genmon);
+  if (proc->num_cpu && proc->num_rss)
+    PRN("\n");
+  buf_len = print_top_list(buf, buf_len, proc->rss, proc->num_rss,
+                           "Top Memory", genmon);
+  return buf_len;
+}
+
+static inline size_t print_cgtop_list(char *buf, size_t buf_len,
+                                      const struct top_cgroup *top, size_t n,
+                                      const char *title, int genmon) {
+  if (!n)
+    return buf_len;
+  if (title) {
+    if (genmon) PRN("<big><b><span weight='bold'>");
+    PRN("%s:", title);
+    if (genmon) PRN("</span></b></big>");
+    PRN("\n");
+  }
+  for (size_t i = 0; i < n; i++) {
+    PRN("  ");
+    buf_len = print_comm(buf, buf_len, top[i].name, genmon);
+    size_t shown = strnlen(top[i].name, CGSCAN_NAME_LEN);
+    PRN("%*s %6.1f%% %8.1f MiB\n", (int)(CGSCAN_NAME_LEN - 1 - shown), "",
+        top[i].cpu, top[i].mem / 1048576.0);
+  }
+  return buf_len;
+}
+
+// Top cgroups over the last interval (--daemon and --tui only).
+static inline size_t print_top_cgroups(cgtop_record *top, char *buf,
+                                       size_t buf_len, int genmon) {
+  buf_len = print_cgtop_list(buf, buf_len, top->cpu, top->num_cpu,
+                             "Top Cgroups by CPU", genmon);
+  if (top->num_cpu && top->num_mem)
+    PRN("\n");
+  buf_len = print_cgtop_list(buf, buf_len, top->mem, top->num_mem,
+                             "Top Cgroups by Memory", genmon);
+  return buf_len;
+}
+
+// Bytes per second in the largest unit that keeps it under 1024.
+static inline size_t print_rate(char *buf, size_t buf_len, float bps) {
+  static const char *const units[] = {"B", "KiB", "MiB", "GiB", "TiB"};
+  size_t u = 0;
+  while (bps >= 1024 && u < sizeof(units) / sizeof(units[0]) - 1)
+    bps /= 1024, u++;
+  PRN("%6.1f %3s/s", bps, units[u]);
+  return buf_len;
+}
+
+static inline size_t print_disk_rows(io_record *io, char *buf, size_t buf_len) {
+  for (size_t i = 0; i < io->num_disks; i++) {
+    struct disk_rate *d = &io->disk[i];
+    PRN("  %-10s read ", d->name);
+    buf_len = print_rate(buf, buf_len, d->read_bps);
+    PRN(" %6.0f IOPS  write ", d->read_iops);
+    buf_len = print_rate(buf, buf_len, d->write_bps);
+    PRN(" %6.0f IOPS  busy %3.0f%%\n", d->write_iops, d->busy);
+  }
+  return buf_len;
+}
+
+static inline size_t print_net_rows(io_record *io, char *buf, size_t buf_len) {
+  for (size_t i = 0; i < io->num_nets; i++) {
+    struct net_rate *n = &io->net[i];
+    PRN("  %-10s rx ", n->name);
+    buf_len = print_rate(buf, buf_len, n->rx_bps);
+    PRN(" %7.0f pkt/s  tx ", n->rx_pps);
+    buf_len = print_rate(buf, buf_len, n->tx_bps);
+    PRN(" %7.0f pkt/s  drops %.0f/s\n", n->tx_pps, n->drops);
+  }
+  return buf_len;
+}
+
+static inline size_t print_io_info(io_record *io, char *buf, size_t buf_len,
+                                   int genmon) {
+  if (io->num_disks) {
+    if (genmon) PRN("<big><b><span weight='bold'>");
+    PRN("Disk I/O:");
+    if (genmon) PRN("</span></b></big>");
+    PRN("\n");
+    buf_len = print_disk_rows(io, buf, buf_len);
+    PRN("\n");
+  }
+  if (io->num_nets) {
+    if (genmon) PRN("<big><b><span weight='bold'>");
+    PRN("Network:");
+    if (genmon) PRN("</span></b></big>");
+    PRN("\n");
+    buf_len = print_net_rows(io, buf, buf_len);
+    PRN("\n");
+  }
+  return buf_len;
+}
+
+// One row per resource: some and full avg10/avg60, and the stall over the
+// last interval from the kernel's totals.
+static inline size_t print_psi_rows(const struct psi_pressure *p, char *buf,
+                                    size_t buf_len) {
+  static const char *const labels[PSI_RESOURCES] = {"CPU", "Memory", "IO"};
+  PRN("  %-7s %17s %17s %13s\n", "", "some 10s/60s", "full 10s/60s",
+      "stall s/f");
+  for (int k = 0; k < PSI_RESOURCES; k++)
+    PRN("  %-7s %7.2f%% %7.2f%% %7.2f%% %7.2f%% %5.1f%% %5.1f%%\n", labels[k],
+        p[k].some_avg10, p[k].some_avg60, p[k].full_avg10, p[k].full_avg60,
+        p[k].some_stall, p[k].full_stall);
+  return buf_len;
+}
+
+static inline size_t print_psi_info(struct psi_record *psi, char *buf,
+                                    size_t buf_len, int genmon) {
+  static const char *const titles[PSI_SCOPES] = {"Pressure:",
+                                                 "Pressure (this cgroup):"};
+  for (int s = 0; s < PSI_SCOPES; s++) {
+    if (!psi->have[s])
+      continue;
+    if (genmon) PRN("<big><b><span weight='bold'>");
+    PRN("%s", titles[s]);
+    if (genmon) PRN("</span></b></big>");
+    PRN("\n");
+    buf_len = print_psi_rows(psi->scope[s], buf, buf_len);
+    PRN("\n");
+  }
+  return buf_len;
+}
+
+// CPU use against the quota, throttling, and what the memory is.
+static inline size_t print_cgroup_rows(const struct cgroup_record *cg,
+                                       char *buf, size_t buf_len) {
+  if (cg->have_cpu) {
+    PRN("  CPU:       %5.1f%% of %.2f cores%s\n", cg->cpu_percent,
+        cg->limit_cpus, cg->quota ? " (cpu.max)" : "");
+    PRN("  Throttled: %" PRIu32 " periods, %.1f ms\n", cg->throttled,
+        cg->throttled_ms);
+  }
+  if (cg->have_mem) {
+    PRN("  Memory:    %" PRIu64 " MB", cg->mem_current >> 20);
+    if (cg->mem_max)
+      PRN(" of %" PRIu64 " MB (memory.max)", cg->mem_max >> 20);
+    PRN("\n  Anon:      %" PRIu64 " MB\n", cg->mem_anon >> 20);
+    PRN("  File:      %" PRIu64 " MB\n", cg->mem_file >> 20);
+  }
+  return buf_len;
+}
+
+static inline size_t print_cgroup_info(const struct cgroup_record *cg,
+                                       char *buf, size_t buf_len, int genmon) {
+  if (!cg->have_cpu && !cg->have_mem)
+    return buf_len;
+  if (genmon) PRN("<big><b><span weight='bold'>");
+  PRN("Cgroup:");
+  if (genmon) PRN("</span></b></big>");
+  PRN("\n");
+  buf_len = print_cgroup_rows(cg, buf, buf_len);
+  PRN("\n");
+  return buf_len;
+}
+
 static inline size_t print_cpu_mem_info(mem_record *mem, char *buf,
                                         size_t buf_len, int genmon) {
   if (genmon) PRN("<big><b><span weight='bold'>");
@@ -851,10 +2003,19 @@ static inline size_t print_tooltip_text(char *buf, size_t buf_len, int genmon) {
   PRN("<tool><tt>\n");
   buf_len =
       print_cpu_utilization(info.cpu_info.num_cpus, buf, buf_len, genmon, 1);
+  buf_len = print_cgroup_info(&info.cgroup_info, buf, buf_len, genmon);
   buf_len = print_cpu_mem_info(&info.mem_info, buf, buf_len, genmon);
   buf_len = print_swap_mem_info(&info.mem_info, buf, buf_len, genmon);
   buf_len = print_gpu_mem_info(&info.gpu_info, buf, buf_len, genmon);
+  buf_len = print_psi_info(&info.psi_info, buf, buf_len, genmon);
+  buf_len = print_io_info(&info.io_info, buf, buf_len, genmon);
   buf_len = print_gpu_info(&info.gpu_info, buf, buf_len, genmon);
+  if (info.proc_info.num_cpu || info.proc_info.num_rss)
+    PRN("\n");
+  buf_len = print_top_processes(&info.proc_info, buf, buf_len, genmon);
+  if (info.cgtop_info.num_cpu || info.cgtop_info.num_mem)
+    PRN("\n");
+  buf_len = print_top_cgroups(&info.cgtop_info, buf, buf_len, genmon);
   PRN("</tt></tool>\n");
   return buf_len;
 }
@@ -868,95 +2029,445 @@ static inline size_t print_genmon(char *buf, size_t buf_len) {
   return buf_len;
 }
 
-static inline size_t print_svg_header(char *buf, size_t buf_len, size_t width,
-                                      size_t height, int topdown) {
-  char transform[256];
-  *transform = '\0';
+// The bars SVG (--svg) is a template (svgtmpl.h), compiled again whenever
+// something that moves an element changes. The compiled template is kept
+// in bars_svgt, so the one-shot runs genmon makes only patch it.
+static struct svg_template bars_svg;
+static struct bars_layout {
+  int topdown, heatmap, peaks, disks, nets;
+  size_t num_cpus, num_gpus;
+} bars_layout;
+static struct heatmap bars_heatmap;
+static int bars_have_heatmap; // Laid out; otherwise the cores are bars
+
+static inline void print_svg_header(struct svg_template *t, size_t width,
+                                    size_t height, int topdown) {
+  svgt_text(t, "<svg xmlns='http://www.w3.org/2000/svg' "
+               "xmlns:xlink='http://www.w3.org/1999/xlink' "
+               "width='%zu' height='%zu'", width, height);
   if (!topdown)
-    sprintf(transform, " transform='scale(1,-1) translate(0,-%zu)'", height);
-  PRN("<svg width='%zu' height='%zu'%s><g>\n", width, height, transform);
-  return buf_len;
+    svgt_text(t, " transform='scale(1,-1) translate(0,-%zu)'", height);
+  svgt_text(t, "><g>\n");
+}
+
+// Bar length in whole pixels, so the SVG only changes when the picture does.
+static inline size_t svg_px(float percentage, size_t height) {
+  if (percentage <= 0)
+    return 0;
+  if (percentage >= 100)
+    return height;
+  return (size_t)(percentage * height / 100.0f + 0.5f);
 }
 
-static inline size_t print_svg_rects(char *buf, size_t buf_len) {
+// Busiest disk, as a percent of the time it had I/O in flight.
+static inline float disk_busy(const io_record *io) {
+  float busy = 0;
+  for (size_t i = 0; i < io->num_disks; i++)
+    busy = io->disk[i].busy > busy ? io->disk[i].busy : busy;
+  return busy;
+}
+
+// All interfaces' rx + tx on a log scale: 1 KiB/s is empty, 1 GiB/s full.
+static inline float net_level(const io_record *io) {
+  float bps = 0;
+  for (size_t i = 0; i < io->num_nets; i++)
+    bps += io->net[i].rx_bps + io->net[i].tx_bps;
+  float level = 0; // 5 per doubling, linear within one
+  for (bps /= 1024; bps >= 2; bps /= 2)
+    level += 5;
+  return bps > 1 ? level + (bps - 1) * 5 : level;
+}
+
+// One bar column at x, percentage of height px tall.
+static inline void print_svg_bar(struct svg_template *t, size_t x,
+                                 size_t height, float percentage,
+                                 const char *color) {
+  svgt_text(t, "<rect width='3' height='");
+  svgt_uint(t, svgt_digits(height), svg_px(percentage, height));
+  svgt_text(t, "' x='%zu' y='0' fill='%s' />\n", x, color);
+}
 
-  size_t first_margin = 1;
-  size_t margin_col_width = 4;
-  size_t cols_printed = 0;
-  size_t num_cpus = info.cpu_info.num_cpus;
+// Bar columns from x = first_margin, height px tall. with_cpus 0 leaves out
+// the per-core bars (the heatmap draws those).
+static inline void print_svg_rects(struct svg_template *t, size_t height,
+                                   size_t first_margin, int with_cpus) {
+  size_t x = first_margin;
+  size_t num_cpus = with_cpus ? info.cpu_info.num_cpus : 0;
   size_t num_gpus = info.gpu_info.num_gpus;
 
   // CPU utilization
   const char *cpu_colors[] = {CPU_COLORS};
   const size_t num_cpu_colors = sizeof(cpu_colors) / sizeof(cpu_colors[0]);
-  for (size_t i = 0; i < num_cpus; i++) {
-    PRN("<rect width='3' height='%zu%%' x='%zu' y='0' fill='%s' />\n",
-        (size_t)utilization[i],
-        (margin_col_width * cols_printed + first_margin),
-        cpu_colors[i % num_cpu_colors]);
-    cols_printed++;
+  for (size_t i = 0; i < num_cpus; i++, x += 4) {
+    print_svg_bar(t, x, height, utilization[i], cpu_colors[i % num_cpu_colors]);
+    if (!burst_hz)
+      continue;
+    // Peak marker where a burst went above the interval average, 0 tall
+    // where none did.
+    size_t px = svg_px(utilization[i], height);
+    size_t peak = svg_px(burst_stats.max[i], height);
+    svgt_text(t, "<rect width='3' height='");
+    svgt_uint(t, 1, peak > px);
+    svgt_text(t, "' x='%zu' y='", x);
+    svgt_uint(t, svgt_digits(height), peak > px ? peak - 1 : 0);
+    svgt_text(t, "' fill='#FFFFFF' />\n");
   }
 
-  // Memory usage
-  PRN("<rect width='3' height='%zu%%' x='%zu' y='0' fill='%s' />\n",
-      (size_t)info.mem_info.mem_percentage,
-      (margin_col_width * cols_printed + first_margin), MEM_COLOR);
-  cols_printed++;
-
-  // Swap usage
-  PRN("<rect width='3' height='%zu%%' x='%zu' y='0' fill='%s' />\n",
-      (size_t)info.mem_info.swp_percentage,
-      (margin_col_width * cols_printed + first_margin), SWP_COLOR);
-  cols_printed++;
+  // Memory and swap usage
+  print_svg_bar(t, x, height, info.mem_info.mem_percentage, MEM_COLOR);
+  x += 4;
+  print_svg_bar(t, x, height, info.mem_info.swp_percentage, SWP_COLOR);
+  x += 4;
 
   // GPU utilization
   const char *gpu_colors[] = {GPU_COLORS};
   const size_t num_gpu_colors = sizeof(gpu_colors) / sizeof(gpu_colors[0]);
-  for (size_t i = 0; i < num_gpus; i++) {
-    PRN("<rect width='3' height='%zu%%' x='%zu' y='0' fill='%s' />\n",
-        (size_t)info.gpu_info.gpu[i].gpu_sm_utilization,
-        (margin_col_width * cols_printed + first_margin),
-        gpu_colors[i % num_gpu_colors]);
-    cols_printed++;
-  }
+  for (size_t i = 0; i < num_gpus; i++, x += 4)
+    print_svg_bar(t, x, height, info.gpu_info.gpu[i].gpu_sm_utilization,
+                  gpu_colors[i % num_gpu_colors]);
 
   // VRAM usage
-  for (size_t i = 0; i < num_gpus; i++) {
-    PRN("<rect width='3' height='%zu%%' x='%zu' y='0' fill='%s' />\n",
-        (size_t)info.gpu_info.gpu[i].gpu_mem_used_percentage,
-        (margin_col_width * cols_printed + first_margin), VRAM_COLOR);
-    cols_printed++;
+  for (size_t i = 0; i < num_gpus; i++, x += 4)
+    print_svg_bar(t, x, height, info.gpu_info.gpu[i].gpu_mem_used_percentage,
+                  VRAM_COLOR);
+
+  // Disk busy time
+  if (info.io_info.num_disks) {
+    print_svg_bar(t, x, height, disk_busy(&info.io_info), DISK_COLOR);
+    x += 4;
   }
 
-  return buf_len;
+  // Network throughput
+  if (info.io_info.num_nets)
+    print_svg_bar(t, x, height, net_level(&info.io_info), NET_COLOR);
 }
 
-static inline size_t print_svg_footer(char *buf, size_t buf_len) {
-  PRN("</g></svg>\n");
-  return buf_len;
+static inline void print_svg_footer(struct svg_template *t) {
+  svgt_text(t, "</g></svg>\n");
+}
+
+// SVG publication. Every tick renders the SVG, but tmp_svg is only replaced
+// when the rendering differs from what is already there, so on an idle
+// machine genmon finds the same file and has nothing to re-rasterize.
+
+#define SVG_STAMP_FORMAT "<!--fnv1a:%016" PRIx64 "-->\n"
+#define SVG_STAMP_LEN 30
+
+#define FNV1A_OFFSET 0xcbf29ce484222325ull
+
+static inline uint64_t fnv1a(uint64_t h, const char *p, size_t n) {
+  while (n--) {
+    h ^= (uint8_t)*p++;
+    h *= 0x100000001b3ull;
+  }
+  return h;
+}
+
+// Write the document in doc[0..n) (n at most 3, as from svgt_iov) to
+// tmp_svg unless the file already holds it. The fingerprint is a comment
+// leading the file, so checking it is one short pread. A new file is
+// written beside tmp_svg and renamed over it, so readers never see it
+// half-written.
+static inline void publish_svg(const struct iovec *doc, int n) {
+  struct prof_mark mark = prof_begin();
+  uint64_t hash = FNV1A_OFFSET;
+  ssize_t want = SVG_STAMP_LEN;
+  for (int i = 0; i < n; i++) {
+    hash = fnv1a(hash, doc[i].iov_base, doc[i].iov_len);
+    want += doc[i].iov_len;
+  }
+  char stamp[SVG_STAMP_LEN + 1];
+  snprintf(stamp, sizeof(stamp), SVG_STAMP_FORMAT, hash);
+
+  char current[SVG_STAMP_LEN + 1];
+  struct procfs_file f = PROCFS_FILE(tmp_svg);
+  ssize_t got = procfs_read_head(&f, current, sizeof(current));
+  procfs_close(&f);
+  if (got == SVG_STAMP_LEN && !memcmp(current, stamp, SVG_STAMP_LEN)) {
+    prof_end(PROF_SVG, mark);
+    return;
+  }
+
+  char tmp_path[sizeof(tmp_svg) + 16];
+  snprintf(tmp_path, sizeof(tmp_path), "%s.%d", tmp_svg, (int)getpid());
+  // Use O_NOFOLLOW to prevent symlink attacks, 0644 for reasonable permissions
+  int fd = open(tmp_path, O_CREAT | O_WRONLY | O_TRUNC | O_NOFOLLOW | O_CLOEXEC,
+                0644);
+  if (fd < 0) {
+    prof_end(PROF_SVG, mark);
+    return;
+  }
+  struct iovec iov[4] = {{.iov_base = stamp, .iov_len = SVG_STAMP_LEN}};
+  memcpy(iov + 1, doc, n * sizeof(*doc));
+  int ok = writev(fd, iov, n + 1) == want;
+  close(fd);
+  if (!ok || rename(tmp_path, tmp_svg))
+    unlink(tmp_path);
+  prof_end(PROF_SVG, mark);
+}
+
+// Heatmap (--heatmap): the cores as one scaled-up PNG, for hosts with more
+// cores than bars fit on a panel.
+
+static struct heatmap_options {
+  int enabled;
+  enum heatmap_group group;
+  uint32_t width, height; // Width 0: as wide as the grid needs
+} heatmap_opts = {.height = 28};
+
+static inline void png_put32(uint8_t *p, uint32_t v) {
+  p[0] = v >> 24, p[1] = v >> 16, p[2] = v >> 8, p[3] = v;
+}
+
+static inline uint32_t png_crc(const uint8_t *p, size_t n) {
+  static uint32_t table[256];
+  if (!table[1]) {
+    for (uint32_t i = 0; i < 256; i++) {
+      uint32_t c = i;
+      for (int k = 0; k < 8; k++)
+        c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+      table[i] = c;
+    }
+  }
+  uint32_t crc = 0xFFFFFFFFu;
+  while (n--)
+    crc = table[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+  return crc ^ 0xFFFFFFFFu;
+}
+
+// RGBA image as a PNG with stored (uncompressed) deflate blocks. The grid
+// is a few KB at most, so compressing it would cost more than it saves.
+// Returns a malloc'd file and its size in *len, or NULL.
+static inline uint8_t *png_encode_rgba(const uint8_t *rgba, uint32_t w,
+                                       uint32_t h, size_t *len) {
+  size_t row = 1 + (size_t)w * 4;
+  size_t raw = row * h;
+  // Stored blocks hold 65535 bytes each; no data still takes one.
+  size_t blocks = raw ? (raw + 65534) / 65535 : 1;
+  size_t idat = 2 + raw + blocks * 5 + 4;
+  size_t total = 8 + 25 + (12 + idat) + 12;
+  uint8_t *out = malloc(total);
+  if (!out)
+    return NULL;
+
+  uint8_t *p = out;
+  memcpy(p, "\x89PNG\r\n\x1a\n", 8);
+  p += 8;
+
+  png_put32(p, 13);
+  memcpy(p + 4, "IHDR", 4);
+  png_put32(p + 8, w);
+  png_put32(p + 12, h);
+  p[16] = 8; // bit depth
+  p[17] = 6; // RGBA
+  p[18] = p[19] = p[20] = 0;
+  png_put32(p + 21, png_crc(p + 4, 17));
+  p += 25;
+
+  memcpy(p + 4, "IDAT", 4);
+  uint8_t *d = p + 8;
+  *d++ = 0x78, *d++ = 0x01; // zlib header, no compression
+  uint32_t a = 1, b = 0;     // adler32
+  size_t block_left = 0;
+  if (!raw)
+    *d++ = 1, *d++ = 0, *d++ = 0, *d++ = 0xFF, *d++ = 0xFF;
+  for (size_t i = 0; i < raw; i++) {
+    if (!block_left) {
+      block_left = raw - i < 65535 ? raw - i : 65535;
+      *d++ = raw - i == block_left; // BFINAL, BTYPE 00
+      *d++ = block_left, *d++ = block_left >> 8;
+      *d++ = ~block_left, *d++ = ~block_left >> 8;
+    }
+    size_t x = i % row;
+    uint8_t byte = x ? rgba[(i / row) * w * 4 + x - 1] : 0; // filter: none
+    *d++ = byte;
+    a = (a + byte) % 65521;
+    b = (b + a) % 65521;
+    block_left--;
+  }
+  png_put32(d, b << 16 | a);
+  d += 4;
+  png_put32(p, d - (p + 8)); // What was written, not what was reserved
+  png_put32(d, png_crc(p + 4, d - (p + 4)));
+  p = d + 4;
+
+  png_put32(p, 0);
+  memcpy(p + 4, "IEND", 4);
+  png_put32(p + 8, png_crc(p + 4, 4));
+  p += 12;
+
+  *len = p - out;
+  return out;
+}
+
+// data as base64 at dst, which has room for (n + 2) / 3 * 4 bytes.
+// Returns the length.
+static inline size_t base64_encode(char *dst, const uint8_t *data, size_t n) {
+  static const char digits[] =
+      "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  char *p = dst;
+  for (size_t i = 0; i < n; i += 3) {
+    uint32_t v = data[i] << 16;
+    if (i + 1 < n)
+      v |= data[i + 1] << 8;
+    if (i + 2 < n)
+      v |= data[i + 2];
+    *p++ = digits[v >> 18 & 63];
+    *p++ = digits[v >> 12 & 63];
+    *p++ = i + 1 < n ? digits[v >> 6 & 63] : '=';
+    *p++ = i + 2 < n ? digits[v & 63] : '=';
+  }
+  return p - dst;
+}
+
+// Lay the cores out in a width x height area (see heatmap_layout).
+// Returns 0, or -1 if out of memory.
+static inline int layout_heatmap(struct heatmap *hm, enum heatmap_group by,
+                                 uint32_t width, uint32_t height,
+                                 uint32_t min_cell_px) {
+  size_t n = info.cpu_info.num_cpus;
+  uint32_t *group = malloc((n ? n : 1) * sizeof(*group));
+  if (!group)
+    return -1;
+  heatmap_groups(info.cpu_info.id, n, by, group);
+  int rc = heatmap_layout(hm, group, n, width, height, min_cell_px);
+  free(group);
+  return rc;
 }
 
-static inline void write_svg_file(char *buf, size_t buf_len, int topdown) {
+// The heatmap image element at x, y; the PNG itself is the template's blob.
+static inline void print_svg_heatmap(struct svg_template *t,
+                                     const struct heatmap *hm, size_t x,
+                                     size_t y) {
+  svgt_text(t, "<image x='%zu' y='%zu' width='%zu' height='%zu' "
+               "preserveAspectRatio='none' image-rendering='optimizeSpeed' "
+               "style='image-rendering:pixelated' "
+               "xlink:href='data:image/png;base64,",
+            x, y, (size_t)hm->grid_w * hm->cell_px,
+            (size_t)hm->grid_h * hm->cell_px);
+  svgt_blob(t);
+  svgt_text(t, "'/>\n");
+}
+
+// This tick's heatmap as a base64 PNG, in a buffer kept across ticks.
+// Returns its length, 0 if out of memory.
+static char *heatmap_b64;
+static size_t heatmap_b64_cap;
+
+static inline size_t encode_heatmap(const struct heatmap *hm) {
+  size_t px = (size_t)hm->grid_w * hm->grid_h * 4;
+  uint8_t *rgba = calloc(px ? px : 1, 1);
+  if (!rgba)
+    return 0;
+  for (size_t i = 0; i < hm->num_cells; i++) {
+    const uint8_t *c = heatmap_color(utilization[i]);
+    uint8_t *dst = rgba + ((size_t)hm->y[i] * hm->grid_w + hm->x[i]) * 4;
+    dst[0] = c[0], dst[1] = c[1], dst[2] = c[2], dst[3] = 0xFF;
+  }
+
+  size_t png_len;
+  uint8_t *png = png_encode_rgba(rgba, hm->grid_w, hm->grid_h, &png_len);
+  free(rgba);
+  if (!png)
+    return 0;
+
+  size_t len = 0, need = (png_len + 2) / 3 * 4;
+  if (need > heatmap_b64_cap) {
+    char *b64 = realloc(heatmap_b64, need);
+    if (b64)
+      heatmap_b64 = b64, heatmap_b64_cap = need;
+  }
+  if (need <= heatmap_b64_cap)
+    len = base64_encode(heatmap_b64, png, png_len);
+  free(png);
+  return len;
+}
 
+// The bars document, compiled into bars_svg or patched there.
+static inline int render_bars_svg(int compile, int topdown) {
   size_t width = 1; // start margin and 3px plus 1px margin for each rect
-  width += info.cpu_info.num_cpus * 4; // cpu utilization
   width += 4;                          // mem
   width += 4;                          // swap
   width += info.gpu_info.num_gpus * 4; // gpu utilization
   width += info.gpu_info.num_gpus * 4; // vram
+  width += info.io_info.num_disks ? 4 : 0; // disk busy
+  width += info.io_info.num_nets ? 4 : 0;  // network
 
   size_t height = 28;
 
-  buf_len = print_svg_header(buf, buf_len, width, height, topdown);
-  buf_len = print_svg_rects(buf, buf_len);
-  buf_len = print_svg_footer(buf, buf_len);
+  svgt_begin(&bars_svg, compile);
+  if (bars_have_heatmap) {
+    size_t hm_width = (size_t)bars_heatmap.grid_w * bars_heatmap.cell_px;
+    size_t hm_height = (size_t)bars_heatmap.grid_h * bars_heatmap.cell_px;
+    width += hm_width;
+    height = hm_height > heatmap_opts.height ? hm_height : heatmap_opts.height;
+
+    print_svg_header(&bars_svg, width, height, topdown);
+    print_svg_heatmap(&bars_svg, &bars_heatmap, 0, 0);
+    print_svg_rects(&bars_svg, height, hm_width + 1, 0);
+    print_svg_footer(&bars_svg);
+  } else {
+    width += info.cpu_info.num_cpus * 4; // cpu utilization
 
-  // Use O_NOFOLLOW to prevent symlink attacks, 0644 for reasonable permissions
-  int fd = open(tmp_svg, O_CREAT | O_WRONLY | O_TRUNC | O_NOFOLLOW, 0644);
-  if (fd >= 0) {
-    (void)!write(fd, buf, buf_len);
-    close(fd);
+    print_svg_header(&bars_svg, width, height, topdown);
+    print_svg_rects(&bars_svg, height, 1, 1);
+    print_svg_footer(&bars_svg);
+  }
+  return svgt_end(&bars_svg);
+}
+
+// Patch this tick's values into the bars template, and publish it. A new
+// layout is looked up in bars_svgt first and compiled only if no earlier
+// run left it there.
+static inline void write_svg_file(int topdown) {
+  struct bars_layout layout;
+  memset(&layout, 0, sizeof(layout)); // Padding too, for the memcmp
+  layout.topdown = topdown;
+  layout.heatmap = heatmap_opts.enabled;
+  layout.peaks = burst_hz != 0;
+  layout.disks = info.io_info.num_disks != 0;
+  layout.nets = info.io_info.num_nets != 0;
+  layout.num_cpus = info.cpu_info.num_cpus;
+  layout.num_gpus = info.gpu_info.num_gpus;
+  int compile = !bars_svg.len || memcmp(&layout, &bars_layout, sizeof(layout));
+  if (compile) {
+    bars_layout = layout;
+    heatmap_free(&bars_heatmap);
+    bars_have_heatmap =
+        layout.heatmap &&
+        layout_heatmap(&bars_heatmap, heatmap_opts.group, heatmap_opts.width,
+                       heatmap_opts.height, 4) == 0;
+
+    // The file's key also has what sizes the picture, which is the same
+    // for the life of one process.
+    struct {
+      struct bars_layout layout;
+      uint32_t height, grid_w, grid_h, cell_px;
+    } key;
+    memset(&key, 0, sizeof(key));
+    key.layout = layout;
+    key.height = heatmap_opts.height;
+    if (bars_have_heatmap) {
+      key.grid_w = bars_heatmap.grid_w;
+      key.grid_h = bars_heatmap.grid_h;
+      key.cell_px = bars_heatmap.cell_px;
+    }
+    if (svgt_load(&bars_svg, bars_svgt, &key, sizeof(key)) ||
+        !render_bars_svg(0, topdown)) {
+      if (!render_bars_svg(1, topdown)) {
+        bars_svg.len = 0; // Out of memory: compile again next time
+        return;
+      }
+      svgt_save(&bars_svg, bars_svgt, &key, sizeof(key));
+    }
+  } else if (!render_bars_svg(0, topdown)) {
+    bars_svg.len = 0;
+    return;
   }
+
+  size_t blob_len = bars_have_heatmap ? encode_heatmap(&bars_heatmap) : 0;
+  struct iovec doc[3];
+  publish_svg(doc, svgt_iov(&bars_svg, heatmap_b64, blob_len, doc));
 }
 
 static inline size_t print_svg_img(char *buf, size_t buf_len) {
@@ -965,7 +2476,7 @@ static inline size_t print_svg_img(char *buf, size_t buf_len) {
 }
 
 static inline size_t print_svg(char *buf, size_t buf_len, int topdown) {
-  write_svg_file(buf, buf_len, topdown);
+  write_svg_file(topdown);
   buf_len = print_svg_img(buf, buf_len);
   buf_len = print_click_text(buf, buf_len, 1);
   buf_len = print_tooltip_text(buf, buf_len, 1);
@@ -995,15 +2506,35 @@ static inline size_t print_tui(char *buf, size_t buf_len) {
   // CPU Utilization
   PRN(ANSI_COLOR_BLUE "CPU Utilization: " ANSI_COLOR_RESET "%.2f%%\n",
       avg_utilization);
+  if (have_history()) {
+    static const char *const spans[HISTORY_TIERS] = {"2m", "1h", "1d"};
+    for (size_t k = 0; k < HISTORY_TIERS; k++) {
+      PRN("  %-3s ", spans[k]);
+      buf_len = print_sparkline(buf, buf_len, k, 0, 60);
+      PRN("\n");
+    }
+  }
   if (info.cpu_info.num_cpus < 32) {
     for (size_t i = 0; i < info.cpu_info.num_cpus; i++) {
-      PRN("  CPU %2zu: ", i);
+      char c = core_class(info.cpu_info.id[i]);
+      PRN(c ? "  CPU %2" PRIu32 " %c: " : "  CPU %2" PRIu32 ": ",
+          info.cpu_info.id[i], c);
       buf_len = print_bar(buf, buf_len, 50, utilization[i] / 2);
-      PRN(" %.2f%%\n", utilization[i]);
+      PRN(" %6.2f%%", utilization[i]);
+      buf_len = print_cpu_freq(buf, buf_len, i);
+      buf_len = print_cpu_burst(buf, buf_len, i);
+      PRN("\n");
     }
   }
   PRN("\n");
 
+  // Cgroup quota and limit
+  if (info.cgroup_info.have_cpu || info.cgroup_info.have_mem) {
+    PRN(ANSI_COLOR_CYAN "Cgroup:" ANSI_COLOR_RESET "\n");
+    buf_len = print_cgroup_rows(&info.cgroup_info, buf, buf_len);
+    PRN("\n");
+  }
+
   // Memory Usage
   PRN(ANSI_COLOR_YELLOW "Memory Usage: " ANSI_COLOR_RESET "%.2f%%\n",
       info.mem_info.mem_percentage);
@@ -1044,134 +2575,307 @@ static inline size_t print_tui(char *buf, size_t buf_len) {
       PRN("\n");
     }
   }
+
+  // Pressure stall information
+  for (int s = 0; s < PSI_SCOPES; s++) {
+    if (!info.psi_info.have[s])
+      continue;
+    PRN(ANSI_COLOR_RED "%s" ANSI_COLOR_RESET "\n",
+        s ? "Pressure (this cgroup):" : "Pressure:");
+    buf_len = print_psi_rows(info.psi_info.scope[s], buf, buf_len);
+    PRN("\n");
+  }
+
+  // Disk and network
+  if (info.io_info.num_disks) {
+    PRN(ANSI_COLOR_CYAN "Disk I/O:" ANSI_COLOR_RESET "\n");
+    buf_len = print_disk_rows(&info.io_info, buf, buf_len);
+    PRN("\n");
+  }
+  if (info.io_info.num_nets) {
+    PRN(ANSI_COLOR_CYAN "Network:" ANSI_COLOR_RESET "\n");
+    buf_len = print_net_rows(&info.io_info, buf, buf_len);
+    PRN("\n");
+  }
+
+  // Top processes
+  if (info.proc_info.num_cpu) {
+    PRN(ANSI_COLOR_RED "Top CPU:" ANSI_COLOR_RESET "\n");
+    buf_len = print_top_list(buf, buf_len, info.proc_info.cpu,
+                             info.proc_info.num_cpu, NULL, 0);
+    PRN("\n");
+  }
+  if (info.proc_info.num_rss) {
+    PRN(ANSI_COLOR_YELLOW "Top Memory:" ANSI_COLOR_RESET "\n");
+    buf_len = print_top_list(buf, buf_len, info.proc_info.rss,
+                             info.proc_info.num_rss, NULL, 0);
+  }
+
+  // Top cgroups
+  if (info.cgtop_info.num_cpu) {
+    PRN("\n" ANSI_COLOR_RED "Top Cgroups by CPU:" ANSI_COLOR_RESET "\n");
+    buf_len = print_cgtop_list(buf, buf_len, info.cgtop_info.cpu,
+                               info.cgtop_info.num_cpu, NULL, 0);
+  }
+  if (info.cgtop_info.num_mem) {
+    PRN("\n" ANSI_COLOR_YELLOW "Top Cgroups by Memory:" ANSI_COLOR_RESET "\n");
+    buf_len = print_cgtop_list(buf, buf_len, info.cgtop_info.mem,
+                               info.cgtop_info.num_mem, NULL, 0);
+  }
   return buf_len;
 }
 
 // M1 Chip Architecture Diagram - Apple-style big.LITTLE visualization
-static inline size_t print_m1_chip_svg(char *buf, size_t buf_len) {
-  // Panel height is 69px, design for that
-  const size_t svg_height = 69;
-  const size_t svg_width = 240;  // Wide enough for 4 cores per row + margins
+// Core tile background: dark grey at low clocks warming to amber at the
+// core's max frequency, in tenths so the SVG only changes on a real step.
+static inline unsigned freq_tint(size_t i) {
+  static const uint8_t cold[3] = {0x1a, 0x1a, 0x1a}, hot[3] = {0x5c, 0x3a, 0x0a};
+  float f = cpufreq_fraction(&info.cpu_info, i);
+  int step = f < 0 ? 0 : (int)(f * 10 + 0.5f);
+  unsigned rgb = 0;
+  for (int c = 0; c < 3; c++)
+    rgb = rgb << 8 | (cold[c] * (10 - step) + hot[c] * step) / 10;
+  return rgb;
+}
+
+// The M1 diagram (--arch-diagram) is a template (svgtmpl.h) too, kept in
+// m1_svgt between runs. Its tiles come from the core topology (coremap.h),
+// laid out once. Cores too many for tiles of M1_MIN_TILE get one heatmap
+// cell each instead, as in the plugin.
+#define M1_WIDTH 240  // Panel height is 69px, design for that
+#define M1_HEIGHT 69
+#define M1_HEADER 10  // M1 rainbow gradient header
+#define M1_MARGIN 2
+#define M1_MIN_TILE 6 // Smallest tile with room for a fill inside the border
+
+static struct svg_template m1_svg;
+static struct coremap m1_map;
+static struct heatmap m1_heatmap;
+static struct m1_layout {
+  size_t num_cores;  // Tiles placed
+  int heatmap;       // m1_heatmap drawn instead of tiles
+  uint32_t topology; // Bumped when m1_map is rebuilt
+  int peaks, psi_scope; // psi_scope -1: no indicator
+} m1_layout;
+
+// Peak marker across an M1 core tile, where a burst went above the fill;
+// 0 tall where none did.
+static inline void print_m1_peak(struct svg_template *t, size_t i, size_t x,
+                                 size_t y, size_t core_height,
+                                 size_t core_width, size_t fill_height) {
+  if (!burst_hz)
+    return;
+  size_t peak = (core_height - 4) * burst_stats.max[i] / 100;
+  svgt_text(t, "<rect x='%zu' y='", x + 2);
+  svgt_uint(t, 3, peak > fill_height ? y + core_height - 2 - peak : y);
+  svgt_text(t, "' width='%zu' height='", core_width - 4);
+  svgt_uint(t, 1, peak > fill_height);
+  svgt_text(t, "' fill='#FFFFFF' opacity='0.8'/>\n");
+}
 
-  const size_t header_height = 10;  // M1 rainbow gradient header
-  const size_t p_core_height = 30;  // Performance cores (larger)
-  const size_t e_core_height = 20;  // Efficiency cores (smaller)
-  const size_t margin = 2;
+// Pressure indicator at the right of the header: CPU, memory and IO, each
+// green, amber or red by its some avg10 (psi_level). System-wide, or our
+// cgroup's where /proc/pressure is hidden.
+static inline void print_m1_pressure(struct svg_template *t, int s,
+                                     size_t svg_width, size_t header_height) {
+  static const uint32_t colors[3] = {0x2ECC71, 0xF39C12, 0xE74C3C};
+  if (s < 0)
+    return;
+  for (int k = 0; k < PSI_RESOURCES; k++) {
+    svgt_text(t, "<rect x='%zu' y='2' width='6' height='%zu' fill='#",
+              svg_width - 2 - (PSI_RESOURCES - k) * 8, header_height - 4);
+    svgt_hex(t, 6, colors[psi_level(&info.psi_info.scope[s][k])]);
+    svgt_text(t, "' stroke='#000000' stroke-width='0.5'/>\n");
+  }
+}
+
+// One core tile: outline tinted by clock, utilization fill, peak marker,
+// then the static detail bars and label.
+static inline void print_m1_core(struct svg_template *t, size_t i, size_t x,
+                                 size_t y, size_t core_width,
+                                 size_t core_height, const char *fill) {
+  svgt_text(t, "<rect x='%zu' y='%zu' width='%zu' height='%zu' fill='#",
+            x, y, core_width, core_height);
+  svgt_hex(t, 6, freq_tint(i));
+  svgt_text(t, "' stroke='#404040' stroke-width='1'/>\n");
+
+  // Opacity 0.3-1.0 with utilization
+  size_t fill_height = (core_height - 4) * utilization[i] / 100.0;
+  svgt_text(t, "<rect x='%zu' y='", x + 2);
+  svgt_uint(t, 3, y + core_height - 2 - fill_height);
+  svgt_text(t, "' width='%zu' height='", core_width - 4);
+  svgt_uint(t, 3, fill_height);
+  svgt_text(t, "' fill='%s' opacity='", fill);
+  svgt_fixed2(t, 30 + 70 * fill_height / (core_height - 4));
+  svgt_text(t, "'/>\n");
+
+  print_m1_peak(t, i, x, y, core_height, core_width, fill_height);
+}
 
-  const size_t core_width = 55;  // Width of each core block
-  const size_t core_spacing = 60;  // Spacing between cores
+static inline void print_m1_chip(struct svg_template *t) {
+  const size_t svg_height = M1_HEIGHT;
+  const size_t svg_width = M1_WIDTH;
+  const size_t header_height = M1_HEADER;
 
   // Start SVG
-  PRN("<svg width='%zu' height='%zu' viewBox='0 0 %zu %zu'>\n",
-      svg_width, svg_height, svg_width, svg_height);
+  svgt_text(t, "<svg xmlns='http://www.w3.org/2000/svg' "
+               "xmlns:xlink='http://www.w3.org/1999/xlink' "
+               "width='%zu' height='%zu' viewBox='0 0 %zu %zu'>\n",
+            svg_width, svg_height, svg_width, svg_height);
 
   // Background
-  PRN("<rect width='%zu' height='%zu' fill='#000000'/>\n", svg_width, svg_height);
+  svgt_text(t, "<rect width='%zu' height='%zu' fill='#000000'/>\n", svg_width,
+            svg_height);
 
   // M1 Rainbow Gradient Header
-  PRN("<defs>\n");
-  PRN("  <linearGradient id='m1rainbow' x1='0%%' y1='0%%' x2='100%%' y2='0%%'>\n");
-  PRN("    <stop offset='0%%' style='stop-color:#FF0000'/>\n");    // Red
-  PRN("    <stop offset='17%%' style='stop-color:#FF7F00'/>\n");   // Orange
-  PRN("    <stop offset='33%%' style='stop-color:#FFFF00'/>\n");   // Yellow
-  PRN("    <stop offset='50%%' style='stop-color:#00FF00'/>\n");   // Green
-  PRN("    <stop offset='67%%' style='stop-color:#0000FF'/>\n");   // Blue
-  PRN("    <stop offset='83%%' style='stop-color:#4B0082'/>\n");   // Indigo
-  PRN("    <stop offset='100%%' style='stop-color:#9400D3'/>\n");  // Violet
-  PRN("  </linearGradient>\n");
-  PRN("</defs>\n");
+  svgt_text(t,
+            "<defs>\n"
+            "  <linearGradient id='m1rainbow' x1='0%%' y1='0%%' x2='100%%' y2='0%%'>\n"
+            "    <stop offset='0%%' style='stop-color:#FF0000'/>\n"   // Red
+            "    <stop offset='17%%' style='stop-color:#FF7F00'/>\n"  // Orange
+            "    <stop offset='33%%' style='stop-color:#FFFF00'/>\n"  // Yellow
+            "    <stop offset='50%%' style='stop-color:#00FF00'/>\n"  // Green
+            "    <stop offset='67%%' style='stop-color:#0000FF'/>\n"  // Blue
+            "    <stop offset='83%%' style='stop-color:#4B0082'/>\n"  // Indigo
+            "    <stop offset='100%%' style='stop-color:#9400D3'/>\n" // Violet
+            "  </linearGradient>\n"
+            "</defs>\n");
 
   // Rainbow header bar
-  PRN("<rect x='0' y='0' width='%zu' height='%zu' fill='url(#m1rainbow)'/>\n",
-      svg_width, header_height);
+  svgt_text(t, "<rect x='0' y='0' width='%zu' height='%zu' fill='url(#m1rainbow)'/>\n",
+            svg_width, header_height);
 
   // M1 text on header (white)
-  PRN("<text x='%zu' y='%zu' font-family='Arial,sans-serif' font-size='8' font-weight='bold' fill='#FFFFFF' text-anchor='middle'>M1</text>\n",
-      svg_width / 2, header_height - 2);
-
-  size_t y_offset = header_height + margin;
-
-  // Performance Cores (Top Row) - Cores 0-3 (Firestorm)
-  for (size_t i = 0; i < 4 && i < info.cpu_info.num_cpus; i++) {
-    size_t x = margin + (i * core_spacing);
-    float util = utilization[i];
-
-    // Core outline (dark gray)
-    PRN("<rect x='%zu' y='%zu' width='%zu' height='%zu' fill='#1a1a1a' stroke='#404040' stroke-width='1'/>\n",
-        x, y_offset, core_width, p_core_height);
-
-    // Utilization fill (blue gradient based on usage)
-    size_t fill_height = (p_core_height - 4) * util / 100.0;
-    if (fill_height > 0) {
-      PRN("<rect x='%zu' y='%zu' width='%zu' height='%zu' fill='#3498DB' opacity='%.2f'/>\n",
-          x + 2, y_offset + p_core_height - 2 - fill_height,
-          core_width - 4, fill_height,
-          0.3 + (util / 100.0 * 0.7));  // Opacity 0.3-1.0 based on util
+  svgt_text(t, "<text x='%zu' y='%zu' font-family='Arial,sans-serif' font-size='8' font-weight='bold' fill='#FFFFFF' text-anchor='middle'>M1</text>\n",
+            svg_width / 2, header_height - 2);
+
+  print_m1_pressure(t, m1_layout.psi_scope, svg_width, header_height);
+
+  if (m1_layout.heatmap)
+    print_svg_heatmap(t, &m1_heatmap, M1_MARGIN, header_height + M1_MARGIN);
+
+  // Core tiles, biggest tier on top; P/E by measured capacity, not index
+  for (size_t k = 0; k < m1_layout.num_cores; k++) {
+    const struct coremap_tile *c = &m1_map.tile[k];
+    int efficiency = c->cls == 'E';
+    print_m1_core(t, c->core, c->x, c->y, c->w, c->h,
+                  efficiency ? "#5DADE2" : "#3498DB");
+
+    // Core internal details (simplified microarchitecture representation),
+    // simpler for E-cores; left out on tiles too small for them
+    if (c->h >= 16 && c->w >= 24) {
+      for (unsigned j = efficiency; j < 3; j++)
+        svgt_text(t, "<rect x='%u' y='%u' width='%u' height='2' fill='#%s'/>\n",
+                  c->x + 10, efficiency ? c->y + c->h * 3 * j / 10
+                                        : c->y + c->h * (4 + 3 * j) / 15,
+                  c->w - 20, efficiency ? "505050" : "606060");
     }
 
-    // Core internal details (simplified microarchitecture representation)
-    PRN("<rect x='%zu' y='%zu' width='%zu' height='2' fill='#606060'/>\n",
-        x + 10, y_offset + 8, core_width - 20);
-    PRN("<rect x='%zu' y='%zu' width='%zu' height='2' fill='#606060'/>\n",
-        x + 10, y_offset + 14, core_width - 20);
-    PRN("<rect x='%zu' y='%zu' width='%zu' height='2' fill='#606060'/>\n",
-        x + 10, y_offset + 20, core_width - 20);
-
     // Core label
-    PRN("<text x='%zu' y='%zu' font-family='monospace' font-size='7' fill='#FFFFFF' text-anchor='middle'>P%zu</text>\n",
-        x + core_width / 2, y_offset + p_core_height - 4, i);
+    if (c->h >= 14 && c->w >= 16)
+      svgt_text(t, "<text x='%u' y='%u' font-family='monospace' font-size='%d' fill='#%s' text-anchor='middle'>%s</text>\n",
+                c->x + c->w / 2, c->y + c->h - (efficiency ? 3 : 4),
+                efficiency ? 6 : 7, efficiency ? "CCCCCC" : "FFFFFF", c->label);
   }
 
-  y_offset += p_core_height + margin;
-
-  // Efficiency Cores (Bottom Row) - Cores 4-7 (Icestorm)
-  for (size_t i = 4; i < 8 && i < info.cpu_info.num_cpus; i++) {
-    size_t x = margin + ((i - 4) * core_spacing);
-    float util = utilization[i];
-
-    // Core outline (dark gray, smaller)
-    PRN("<rect x='%zu' y='%zu' width='%zu' height='%zu' fill='#1a1a1a' stroke='#404040' stroke-width='1'/>\n",
-        x, y_offset, core_width, e_core_height);
+  svgt_text(t, "</svg>\n");
+}
 
-    // Utilization fill (lighter blue for E-cores)
-    size_t fill_height = (e_core_height - 4) * util / 100.0;
-    if (fill_height > 0) {
-      PRN("<rect x='%zu' y='%zu' width='%zu' height='%zu' fill='#5DADE2' opacity='%.2f'/>\n",
-          x + 2, y_offset + e_core_height - 2 - fill_height,
-          core_width - 4, fill_height,
-          0.3 + (util / 100.0 * 0.7));
-    }
+// Tiles for the cores in info.cpu_info, classified again only when that
+// set changes (hotplug, a new cpuset). Returns 1 if it did.
+static inline int update_m1_map(void) {
+  static uint32_t *ids;
+  size_t n = info.cpu_info.num_cpus;
+  if (ids && m1_map.num_tiles == n &&
+      !memcmp(ids, info.cpu_info.id, n * sizeof(*ids)))
+    return 0;
+
+  struct coremap_core *cores = malloc((n ? n : 1) * sizeof(*cores));
+  free(ids);
+  ids = malloc((n ? n : 1) * sizeof(*ids));
+  if (!cores || !ids)
+    puts("Out of memory."), exit(1);
+  memcpy(ids, info.cpu_info.id, n * sizeof(*ids));
+  for (size_t i = 0; i < n; i++)
+    cores[i] = core_topology(ids[i]);
+  if (coremap_build(&m1_map, cores, n))
+    puts("Out of memory."), exit(1);
+  free(cores);
+  return 1;
+}
 
-    // Core internal details (simpler for E-cores)
-    PRN("<rect x='%zu' y='%zu' width='%zu' height='2' fill='#505050'/>\n",
-        x + 10, y_offset + 6, core_width - 20);
-    PRN("<rect x='%zu' y='%zu' width='%zu' height='2' fill='#505050'/>\n",
-        x + 10, y_offset + 12, core_width - 20);
+static inline int render_m1_svg(int compile) {
+  svgt_begin(&m1_svg, compile);
+  print_m1_chip(&m1_svg);
+  return svgt_end(&m1_svg);
+}
 
-    // Core label
-    PRN("<text x='%zu' y='%zu' font-family='monospace' font-size='6' fill='#CCCCCC' text-anchor='middle'>E%zu</text>\n",
-        x + core_width / 2, y_offset + e_core_height - 3, i - 4);
+// Patch this tick's values into the M1 template, and return 1 if m1_svg
+// holds the diagram. A new layout is looked up in m1_svgt first and
+// compiled only if no earlier run left it there.
+static inline int print_m1_chip_svg(void) {
+  struct m1_layout layout;
+  memset(&layout, 0, sizeof(layout)); // Padding too, for the memcmp
+  layout.topology = m1_layout.topology + update_m1_map();
+  if (coremap_layout(&m1_map, M1_WIDTH, M1_HEIGHT, M1_HEADER, M1_MARGIN,
+                     M1_MIN_TILE) == 0)
+    layout.num_cores = m1_map.num_placed;
+  else
+    layout.heatmap = 1;
+  layout.peaks = burst_hz != 0;
+  layout.psi_scope = info.psi_info.have[0] ? 0 : info.psi_info.have[1] ? 1 : -1;
+  int compile = !m1_svg.len || memcmp(&layout, &m1_layout, sizeof(layout));
+  m1_layout = layout;
+  if (compile) {
+    heatmap_free(&m1_heatmap);
+    if (layout.heatmap &&
+        layout_heatmap(&m1_heatmap, HEATMAP_GROUP_PACKAGE,
+                       M1_WIDTH - 2 * M1_MARGIN,
+                       M1_HEIGHT - M1_HEADER - 2 * M1_MARGIN, 1))
+      m1_layout.heatmap = layout.heatmap = 0; // Out of memory: header only
+  } else {
+    if (render_m1_svg(0))
+      return 1;
+    m1_svg.len = 0; // Out of memory: compile again next time
+    return 0;
   }
 
-  PRN("</svg>\n");
-  return buf_len;
+  // topology only counts rebuilds in this process; the file is keyed by
+  // the tiles themselves.
+  struct {
+    struct m1_layout layout;
+    uint64_t tiles;
+    uint32_t grid_w, grid_h, cell_px;
+  } key;
+  memset(&key, 0, sizeof(key));
+  key.layout = layout;
+  key.layout.topology = 0;
+  key.tiles = fnv1a(FNV1A_OFFSET, (const char *)m1_map.tile,
+                    layout.num_cores * sizeof(*m1_map.tile));
+  if (layout.heatmap) {
+    key.grid_w = m1_heatmap.grid_w;
+    key.grid_h = m1_heatmap.grid_h;
+    key.cell_px = m1_heatmap.cell_px;
+  }
+  if (!svgt_load(&m1_svg, m1_svgt, &key, sizeof(key)) && render_m1_svg(0))
+    return 1;
+  if (!render_m1_svg(1)) {
+    m1_svg.len = 0;
+    return 0;
+  }
+  svgt_save(&m1_svg, m1_svgt, &key, sizeof(key));
+  return 1;
 }
 
 // Write M1 arch diagram to SVG file and return genmon output
 static inline size_t print_m1_arch_mode(char *buf, size_t buf_len) {
-  // Generate M1 chip SVG
-  buf_len = print_m1_chip_svg(buf, buf_len);
-
-  // Write to temp file
-  int fd = open(tmp_svg, O_CREAT | O_WRONLY | O_TRUNC | O_NOFOLLOW, 0644);
-  if (fd >= 0) {
-    (void)!write(fd, buf, buf_len);
-    close(fd);
+  // Replace the SVG file if the picture changed
+  if (print_m1_chip_svg()) {
+    size_t blob_len = m1_layout.heatmap ? encode_heatmap(&m1_heatmap) : 0;
+    struct iovec doc[3];
+    publish_svg(doc, svgt_iov(&m1_svg, heatmap_b64, blob_len, doc));
   }
 
-  // Reset buffer for genmon output
-  buf_len = 0;
-
   // Output ONLY the image tag - no text, no (genmon), no XXX
   PRN("<img>%s</img>\n", tmp_svg);
   buf_len = print_click_text(buf, buf_len, 1);
@@ -1180,23 +2884,471 @@ static inline size_t print_m1_arch_mode(char *buf, size_t buf_len) {
   return buf_len;
 }
 
+// Self-profile report
+
+// A duration in the unit that keeps it readable.
+static inline size_t print_duration(char *buf, size_t buf_len, uint64_t ns) {
+  if (ns < 10000)
+    PRN("%7" PRIu64 " ns", ns);
+  else if (ns < 10000000)
+    PRN("%7.1f us", ns / 1e3);
+  else
+    PRN("%7.1f ms", ns / 1e6);
+  return buf_len;
+}
+
+static inline size_t print_profile_hist(char *buf, size_t buf_len,
+                                        const struct prof_hist *h, int time) {
+  uint64_t p50 = prof_quantile(h, 0.5), p99 = prof_quantile(h, 0.99);
+  if (!h->count) {
+    PRN("  %10s %10s", "-", "-");
+  } else if (time) {
+    PRN("  ");
+    buf_len = print_duration(buf, buf_len, p50);
+    PRN(" ");
+    buf_len = print_duration(buf, buf_len, p99);
+  } else {
+    PRN("  %10" PRIu64 " %10" PRIu64, p50, p99);
+  }
+  return buf_len;
+}
+
+// p50/p99 per stage for today and the previous day. Stages only show once
+// a --self-profile run recorded them.
+static inline size_t print_profile_report(char *buf, size_t buf_len) {
+  static const char *const days[2] = {"Today", "Previous day"};
+  if (!prof)
+    return buf_len;
+  prof_rollover(prof);
+  for (int d = 0; d < 2; d++) {
+    const struct prof_hist *h = prof->hist[d];
+    PRN("%s: %" PRIu64 " ticks\n", days[d], h[PROF_WALL(PROF_TICK)].count);
+    if (!h[PROF_WALL(PROF_TICK)].count) {
+      PRN("\n");
+      continue;
+    }
+    PRN("  %-12s %6s  %10s %10s  %10s %10s\n", "stage", "runs", "wall p50",
+        "p99", "cpu p50", "p99");
+    for (int k = 0; k < PROF_STAGES; k++) {
+      const struct prof_hist *wall = &h[PROF_WALL(k)];
+      if (!wall->count)
+        continue;
+      PRN("  %-12s %6" PRIu64, prof_stage_names[k], wall->count);
+      buf_len = print_profile_hist(buf, buf_len, wall, 1);
+      buf_len = print_profile_hist(buf, buf_len, &h[PROF_CPU(k)], 1);
+      PRN("\n");
+    }
+    if (h[PROF_SYSCALLS].count) {
+      PRN("  %-12s %6" PRIu64, "syscalls", h[PROF_SYSCALLS].count);
+      buf_len = print_profile_hist(buf, buf_len, &h[PROF_SYSCALLS], 0);
+      PRN("  (read/write family, per tick)\n");
+      PRN("  %-12s %6" PRIu64, "bytes out", h[PROF_WRITTEN].count);
+      buf_len = print_profile_hist(buf, buf_len, &h[PROF_WRITTEN], 0);
+      PRN("  (per tick)\n");
+    }
+    PRN("\n");
+  }
+  return buf_len;
+}
+
 #define MODE_PRINT 0
 #define MODE_SVG 1
 #define MODE_TUI 2
 #define MODE_M1_ARCH 3
+#define MODE_DAEMON 4
+#define MODE_PROFILE_REPORT 5
+
+// Sample log (--record / --replay)
+//
+// A log is SAMPLE_LOG_MAGIC followed by records:
+//   kind ('K' keyframe or 'D' delta), varint payload length, payload
+// A keyframe holds every value as a varint, led by the CLOCK_MONOTONIC
+// timestamp, the CPU and GPU counts and the GPU names. A delta holds the
+// nanoseconds since the previous record and each value as a zigzag varint
+// difference from the previous record, which keeps the steadily growing
+// /proc/stat counters at a byte or two each. Every process starts with a
+// keyframe, and so does any change in CPU or GPU layout. Only the CPU,
+// memory and GPU records are logged; the rest replay empty.
+
+#define SAMPLE_LOG_MAGIC "SGMLOG2\n"
+#define SAMPLE_LOG_MAGIC_LEN 8
+#define SAMPLE_LOG_KEYFRAME_EVERY 256
+#define VARINT_MAX 10
+
+// mem_record and the numeric part of gpu_instance are logged as 32-bit
+// words (uint32_t and float bits alike).
+#define MEM_WORDS (sizeof(struct mem_record) / sizeof(uint32_t))
+#define GPU_WORDS_OFFSET offsetof(struct gpu_instance, gpu_sm_utilization)
+#define GPU_WORDS \
+  ((sizeof(struct gpu_instance) - GPU_WORDS_OFFSET) / sizeof(uint32_t))
+_Static_assert(sizeof(struct mem_record) % sizeof(uint32_t) == 0,
+               "mem_record is logged as 32-bit words");
+_Static_assert((sizeof(struct gpu_instance) - GPU_WORDS_OFFSET) %
+                       sizeof(uint32_t) == 0,
+               "gpu_instance is logged as 32-bit words");
+
+static inline uint8_t *put_varint(uint8_t *p, uint64_t v) {
+  while (v >= 0x80) {
+    *p++ = (uint8_t)v | 0x80;
+    v >>= 7;
+  }
+  *p++ = (uint8_t)v;
+  return p;
+}
+
+static inline uint64_t get_varint(const uint8_t **pp, const uint8_t *end,
+                                  int *err) {
+  uint64_t v = 0;
+  for (int shift = 0; shift < 64 && *pp < end; shift += 7) {
+    uint8_t b = *(*pp)++;
+    v |= (uint64_t)(b & 0x7F) << shift;
+    if (!(b & 0x80))
+      return v;
+  }
+  *err = 1;
+  return 0;
+}
+
+static inline uint64_t zigzag(int64_t v) {
+  return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static inline int64_t unzigzag(uint64_t v) {
+  return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+// A value as itself (keyframe) or as the difference from prev (delta).
+static inline uint8_t *put_value(uint8_t *p, int key, uint64_t v,
+                                 uint64_t prev) {
+  return put_varint(p, key ? v : zigzag((int64_t)(v - prev)));
+}
+
+static inline uint64_t get_value(const uint8_t **pp, const uint8_t *end,
+                                 int key, uint64_t prev, int *err) {
+  uint64_t v = get_varint(pp, end, err);
+  return key ? v : prev + (uint64_t)unzigzag(v);
+}
+
+static inline void cpu_counters(struct cpu_record *cpu,
+                                uint64_t *fields[CPUSTAT_NUM_COUNTERS]) {
+  fields[0] = cpu->user, fields[1] = cpu->system, fields[2] = cpu->idle;
+  fields[3] = cpu->iowait, fields[4] = cpu->irq, fields[5] = cpu->softirq;
+  fields[6] = cpu->steal, fields[7] = cpu->guest;
+}
+
+static inline void mem_words(const struct mem_record *mem, uint32_t *w) {
+  memcpy(w, mem, MEM_WORDS * sizeof(uint32_t));
+}
+
+static inline void gpu_words(const struct gpu_instance *g, uint32_t *w) {
+  memcpy(w, (const char *)g + GPU_WORDS_OFFSET, GPU_WORDS * sizeof(uint32_t));
+}
+
+static struct sample_recorder {
+  int fd; // -1 unless --record
+  uint8_t *buf;
+  size_t buf_cap;
+  int have_prev;
+  unsigned since_keyframe;
+  uint64_t prev_ns;
+  struct cpu_record prev_cpu;
+  struct mem_record prev_mem;
+  struct gpu_record prev_gpu;
+} recorder = {.fd = -1};
+
+static inline void record_open(const char *path) {
+  int fd = open(path, O_CREAT | O_RDWR | O_APPEND | O_NOFOLLOW | O_CLOEXEC, 0644);
+  if (fd < 0)
+    puts("Failed to open the sample log."), exit(1);
+
+  char magic[SAMPLE_LOG_MAGIC_LEN];
+  ssize_t got = pread(fd, magic, sizeof(magic), 0);
+  if (got == 0) {
+    if (write(fd, SAMPLE_LOG_MAGIC, SAMPLE_LOG_MAGIC_LEN) != SAMPLE_LOG_MAGIC_LEN)
+      puts("Failed to write the sample log."), exit(1);
+  } else if (got != SAMPLE_LOG_MAGIC_LEN ||
+             memcmp(magic, SAMPLE_LOG_MAGIC, SAMPLE_LOG_MAGIC_LEN)) {
+    puts("Not a sample log."), exit(1);
+  }
+
+  recorder.fd = fd;
+  recorder.buf_cap = 4 * VARINT_MAX + MAX_NUM_GPUS * (VARINT_MAX + 256) +
+                     num_cpu_slots * (3 + CPUSTAT_NUM_COUNTERS) * VARINT_MAX +
+                     (MEM_WORDS + MAX_NUM_GPUS * GPU_WORDS) * VARINT_MAX;
+  recorder.buf = malloc(1 + VARINT_MAX + recorder.buf_cap);
+  if (!recorder.buf || cpustat_alloc(&recorder.prev_cpu, num_cpu_slots))
+    puts("Out of memory."), exit(1);
+}
+
+// Append the sample in info. One write() per record, so processes
+// appending to the same log don't interleave.
+static inline void record_sample(void) {
+  struct cpu_record *cpu = &info.cpu_info;
+  struct gpu_record *gpu = &info.gpu_info;
+  uint64_t now = monotonic_ns();
+
+  int key = !recorder.have_prev ||
+            recorder.since_keyframe >= SAMPLE_LOG_KEYFRAME_EVERY ||
+            cpu->num_cpus != recorder.prev_cpu.num_cpus ||
+            gpu->num_gpus != recorder.prev_gpu.num_gpus;
+  for (size_t g = 0; !key && g < gpu->num_gpus; g++)
+    key = strcmp(gpu->gpu[g].gpu_name, recorder.prev_gpu.gpu[g].gpu_name) != 0;
+
+  // Payload goes after room for the kind and its length.
+  uint8_t *start = recorder.buf + 1 + VARINT_MAX;
+  uint8_t *p = start;
+  if (key) {
+    p = put_varint(p, now);
+    p = put_varint(p, cpu->num_cpus);
+    p = put_varint(p, gpu->num_gpus);
+    for (size_t g = 0; g < gpu->num_gpus; g++) {
+      size_t len = strnlen(gpu->gpu[g].gpu_name, sizeof(gpu->gpu[g].gpu_name) - 1);
+      p = put_varint(p, len);
+      memcpy(p, gpu->gpu[g].gpu_name, len);
+      p += len;
+    }
+  } else {
+    p = put_varint(p, now - recorder.prev_ns);
+  }
+
+  uint64_t *cur[CPUSTAT_NUM_COUNTERS], *prev[CPUSTAT_NUM_COUNTERS];
+  cpu_counters(cpu, cur);
+  cpu_counters(&recorder.prev_cpu, prev);
+  for (size_t i = 0; i < cpu->num_cpus; i++) {
+    p = put_value(p, key, cpu->id[i], recorder.prev_cpu.id[i]);
+    for (size_t k = 0; k < CPUSTAT_NUM_COUNTERS; k++)
+      p = put_value(p, key, cur[k][i], prev[k][i]);
+    p = put_value(p, key, cpu->freq_khz[i], recorder.prev_cpu.freq_khz[i]);
+    p = put_value(p, key, cpu->freq_max_khz[i], recorder.prev_cpu.freq_max_khz[i]);
+  }
+
+  uint32_t w[GPU_WORDS > MEM_WORDS ? GPU_WORDS : MEM_WORDS];
+  uint32_t pw[GPU_WORDS > MEM_WORDS ? GPU_WORDS : MEM_WORDS];
+  mem_words(&info.mem_info, w);
+  mem_words(&recorder.prev_mem, pw);
+  for (size_t k = 0; k < MEM_WORDS; k++)
+    p = put_value(p, key, w[k], pw[k]);
+  for (size_t g = 0; g < gpu->num_gpus; g++) {
+    gpu_words(&gpu->gpu[g], w);
+    gpu_words(&recorder.prev_gpu.gpu[g], pw);
+    for (size_t k = 0; k < GPU_WORDS; k++)
+      p = put_value(p, key, w[k], pw[k]);
+  }
+
+  // Kind and length, placed right before the payload.
+  uint8_t head[1 + VARINT_MAX];
+  head[0] = key ? 'K' : 'D';
+  size_t head_len = put_varint(head + 1, p - start) - head;
+  memcpy(start - head_len, head, head_len);
+  ssize_t len = p - (start - head_len);
+  if (write(recorder.fd, start - head_len, len) != len)
+    puts("Failed to write the sample log."), exit(1);
+
+  cpustat_copy(&recorder.prev_cpu, cpu);
+  recorder.prev_mem = info.mem_info;
+  recorder.prev_gpu = *gpu;
+  recorder.prev_ns = now;
+  recorder.since_keyframe = key ? 1 : recorder.since_keyframe + 1;
+  recorder.have_prev = 1;
+}
+
+// Walk one record of a loaded log. Returns its payload, or NULL at the end
+// (or at a truncated record, e.g. one still being written).
+static inline const uint8_t *next_record(const uint8_t **pp, const uint8_t *end,
+                                         int *key, const uint8_t **payload_end) {
+  const uint8_t *p = *pp;
+  if (end - p < 2 || (*p != 'K' && *p != 'D'))
+    return NULL;
+  *key = *p++ == 'K';
+  int err = 0;
+  uint64_t len = get_varint(&p, end, &err);
+  if (err || len > (uint64_t)(end - p))
+    return NULL;
+  *payload_end = p + len;
+  *pp = p + len;
+  return p;
+}
+
+// Decode a record into info, on top of the previous one for deltas.
+// Returns the record's timestamp, or 0 if it is malformed.
+static inline uint64_t decode_sample(const uint8_t *p, const uint8_t *end,
+                                     int key, uint64_t prev_ns) {
+  struct cpu_record *cpu = &info.cpu_info;
+  struct gpu_record *gpu = &info.gpu_info;
+  int err = 0;
+
+  uint64_t ts;
+  if (key) {
+    ts = get_varint(&p, end, &err);
+    uint64_t num_cpus = get_varint(&p, end, &err);
+    uint64_t num_gpus = get_varint(&p, end, &err);
+    if (num_cpus > cpu->capacity || num_gpus > MAX_NUM_GPUS)
+      return 0;
+    cpu->num_cpus = num_cpus;
+    gpu->num_gpus = num_gpus;
+    for (size_t g = 0; g < gpu->num_gpus; g++) {
+      uint64_t len = get_varint(&p, end, &err);
+      if (len >= sizeof(gpu->gpu[g].gpu_name) || len > (uint64_t)(end - p))
+        return 0;
+      memcpy(gpu->gpu[g].gpu_name, p, len);
+      gpu->gpu[g].gpu_name[len] = '\0';
+      p += len;
+    }
+  } else {
+    ts = prev_ns + get_varint(&p, end, &err);
+  }
+
+  uint64_t *fields[CPUSTAT_NUM_COUNTERS];
+  cpu_counters(cpu, fields);
+  for (size_t i = 0; i < cpu->num_cpus; i++) {
+    cpu->id[i] = get_value(&p, end, key, cpu->id[i], &err);
+    for (size_t k = 0; k < CPUSTAT_NUM_COUNTERS; k++)
+      fields[k][i] = get_value(&p, end, key, fields[k][i], &err);
+    cpu->freq_khz[i] = get_value(&p, end, key, cpu->freq_khz[i], &err);
+    cpu->freq_max_khz[i] = get_value(&p, end, key, cpu->freq_max_khz[i], &err);
+  }
+
+  uint32_t w[GPU_WORDS > MEM_WORDS ? GPU_WORDS : MEM_WORDS];
+  mem_words(&info.mem_info, w);
+  for (size_t k = 0; k < MEM_WORDS; k++)
+    w[k] = get_value(&p, end, key, w[k], &err);
+  memcpy(&info.mem_info, w, MEM_WORDS * sizeof(uint32_t));
+  for (size_t g = 0; g < gpu->num_gpus; g++) {
+    gpu_words(&gpu->gpu[g], w);
+    for (size_t k = 0; k < GPU_WORDS; k++)
+      w[k] = get_value(&p, end, key, w[k], &err);
+    memcpy((char *)&gpu->gpu[g] + GPU_WORDS_OFFSET, w, GPU_WORDS * sizeof(uint32_t));
+  }
+
+  return err || p != end ? 0 : (ts ? ts : 1);
+}
+
+// Feed every sample of a log through the formatter for mode, paced by the
+// recorded timestamps divided by speed (0: as fast as possible).
+static inline void run_replay(const char *path, int mode, int topdown,
+                              float speed) {
+  struct procfs_file f = PROCFS_FILE(path);
+  struct procfs_buf log = {0};
+  ssize_t n = procfs_read(&f, &log);
+  procfs_close(&f);
+  if (n < SAMPLE_LOG_MAGIC_LEN ||
+      memcmp(log.data, SAMPLE_LOG_MAGIC, SAMPLE_LOG_MAGIC_LEN))
+    puts("Not a sample log."), exit(1);
+  const uint8_t *begin = (const uint8_t *)log.data + SAMPLE_LOG_MAGIC_LEN;
+  const uint8_t *end = (const uint8_t *)log.data + n;
+
+  // Size the per-core state for the widest keyframe.
+  size_t max_cpus = 1;
+  int key;
+  const uint8_t *p = begin, *payload, *payload_end;
+  while ((payload = next_record(&p, end, &key, &payload_end))) {
+    int err = 0;
+    if (!key)
+      continue;
+    get_varint(&payload, payload_end, &err); // timestamp
+    uint64_t num_cpus = get_varint(&payload, payload_end, &err);
+    if (!err && num_cpus > max_cpus && num_cpus <= UINT32_MAX)
+      max_cpus = num_cpus;
+  }
+  init_cpu_storage(max_cpus);
+  struct cpu_record prev;
+  if (cpustat_alloc(&prev, max_cpus))
+    puts("Out of memory."), exit(1);
+
+  buf_cap = BUF_SIZE + num_cpu_slots * BUF_SIZE_PER_CPU;
+  char *buf = malloc(buf_cap);
+  if (!buf)
+    puts("Out of memory."), exit(1);
+
+  uint64_t prev_ns = 0, start_ns = monotonic_ns(), shown_ns = 0;
+  int have_keyframe = 0;
+  p = begin;
+  while ((payload = next_record(&p, end, &key, &payload_end))) {
+    if (!key && !have_keyframe)
+      continue; // Deltas need a keyframe first
+    cpustat_copy(&prev, &info.cpu_info);
+    uint64_t ts = decode_sample(payload, payload_end, key, prev_ns);
+    if (!ts)
+      puts("Corrupt sample log."), exit(1);
+    have_keyframe = 1;
+
+    // Gaps between runs are replayed too; a clock that went backwards
+    // (a log spanning a reboot) doesn't wait.
+    if (speed > 0 && prev_ns && ts > prev_ns) {
+      shown_ns += (uint64_t)((ts - prev_ns) / speed);
+      struct timespec wake = {
+          .tv_sec = (start_ns + shown_ns) / 1000000000ull,
+          .tv_nsec = (start_ns + shown_ns) % 1000000000ull,
+      };
+      clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, NULL);
+    }
+    prev_ns = ts;
+
+    // A change in core count starts that stretch from zero.
+    if (prev.num_cpus != info.cpu_info.num_cpus)
+      cpustat_copy(&prev, &info.cpu_info);
+    if (info.cpu_info.num_cpus)
+      calculate_cpu_utilization(&prev, &info.cpu_info);
+
+    size_t buf_len = buf[0] = 0;
+    switch (mode) {
+    case MODE_SVG:
+      buf_len = print_svg(buf, buf_len, topdown);
+      break;
+    case MODE_TUI:
+      buf_len = print_tui(buf, buf_len);
+      break;
+    case MODE_M1_ARCH:
+      buf_len = print_m1_arch_mode(buf, buf_len);
+      break;
+    default:
+      buf_len = print_genmon(buf, buf_len);
+      break;
+    }
+    (void)!write(STDOUT_FILENO, buf, buf_len);
+  }
+
+  free(buf);
+  cpustat_free(&prev);
+  procfs_buf_free(&log);
+}
 
 typedef struct {
   int mode;
   int upsidedown;
+  uint32_t interval_ms;
+  const char *record;
+  const char *replay;
+  float speed;
+  uint32_t burst_hz;
+  const char *disks;
+  const char *nets;
+  const char *consumer;
+  int cgroup;
 } Args;
 
 static inline Args argparse(int argc, char **argv) {
   Args args = {0};
+  args.interval_ms = 1000;
+  args.speed = 1.0f;
+  args.disks = IOSTAT_DEFAULT_DISKS;
+  args.nets = IOSTAT_DEFAULT_NETS;
   for (int i = 1; i < argc; i++) {
     if (!strcmp(argv[i], "-h") || !strcmp(argv[i], "--help")) {
       puts("Usage: sys-genmon [-h,--help] "
            "[-s,--svg] [-u,--upsidedown] "
-           "[-a,--arch-diagram] [-c,--clear-shm] [-t,--tui]"),
+           "[-a,--arch-diagram] [-c,--clear-shm] [-t,--tui] "
+           "[-d,--daemon] [-i,--interval MS] "
+           "[-m,--heatmap] [--group none|package|cluster|numa] "
+           "[--size WxH] [--record FILE] "
+           "[--replay FILE [--speed X]] "
+           "[--burst HZ [--burst-threshold PCT]] "
+           "[--disks LIST] [--nets LIST] [--cgroup] [--cgroup-depth N] "
+           "[--self-profile] [--profile-report] [--consumer NAME]\n"
+           "Only one --daemon runs per user (one more with --cgroup); "
+           "a second one exits.\n"
+           "--record and --replay cover CPU, memory and GPU only; disks, "
+           "network, pressure, processes and cgroups replay empty."),
           exit(0);
     } else if (!strcmp(argv[i], "-s") || !strcmp(argv[i], "--svg")) {
       args.mode = MODE_SVG;
@@ -1206,9 +3358,102 @@ static inline Args argparse(int argc, char **argv) {
       args.upsidedown = 1;
     } else if (!strcmp(argv[i], "-t") || !strcmp(argv[i], "--tui")) {
       args.mode = MODE_TUI;
+    } else if (!strcmp(argv[i], "-d") || !strcmp(argv[i], "--daemon")) {
+      args.mode = MODE_DAEMON;
+    } else if (!strcmp(argv[i], "-i") || !strcmp(argv[i], "--interval")) {
+      int err = 0;
+      if (i + 1 < argc)
+        args.interval_ms = str_to_u32(argv[++i], &err);
+      else
+        err = 1;
+      if (err || !args.interval_ms)
+        puts("Invalid interval."), exit(1);
+    } else if (!strcmp(argv[i], "-m") || !strcmp(argv[i], "--heatmap")) {
+      heatmap_opts.enabled = 1;
+    } else if (!strcmp(argv[i], "--group")) {
+      if (i + 1 >= argc || heatmap_parse_group(argv[++i], &heatmap_opts.group))
+        puts("Invalid group."), exit(1);
+    } else if (!strcmp(argv[i], "--size")) {
+      // WxH in pixels; W 0 lets the heatmap take the width it needs.
+      char *x = i + 1 < argc ? strchr(argv[++i], 'x') : NULL;
+      int err = !x;
+      if (x) {
+        *x = '\0';
+        heatmap_opts.width = str_to_u32(argv[i], &err);
+        heatmap_opts.height = str_to_u32(x + 1, &err);
+      }
+      if (err || !heatmap_opts.height)
+        puts("Invalid size."), exit(1);
+    } else if (!strcmp(argv[i], "--record")) {
+      if (i + 1 >= argc)
+        puts("Missing sample log."), exit(1);
+      args.record = argv[++i];
+    } else if (!strcmp(argv[i], "--replay")) {
+      if (i + 1 >= argc)
+        puts("Missing sample log."), exit(1);
+      args.replay = argv[++i];
+    } else if (!strcmp(argv[i], "--speed")) {
+      // 0 replays as fast as the formatter runs.
+      char *end = NULL;
+      if (i + 1 < argc)
+        args.speed = strtof(argv[++i], &end);
+      if (!end || *end || !(args.speed >= 0))
+        puts("Invalid speed."), exit(1);
+    } else if (!strcmp(argv[i], "--burst")) {
+      // Sub-sampling rate for --daemon and --tui.
+      int err = i + 1 >= argc;
+      if (!err)
+        args.burst_hz = str_to_u32(argv[++i], &err);
+      if (err || args.burst_hz < 10 || args.burst_hz > 100)
+        puts("Invalid burst rate, expected 10-100 Hz."), exit(1);
+    } else if (!strcmp(argv[i], "--burst-threshold")) {
+      char *end = NULL;
+      if (i + 1 < argc)
+        burst_threshold = strtof(argv[++i], &end);
+      if (!end || *end || !(burst_threshold > 0 && burst_threshold <= 100))
+        puts("Invalid burst threshold."), exit(1);
+    } else if (!strcmp(argv[i], "--disks") || !strcmp(argv[i], "--nets")) {
+      // Device filters, e.g. "nvme*,sda" or "!loop*"; see iostat.h.
+      if (i + 1 >= argc)
+        puts("Missing device list."), exit(1);
+      if (argv[i][2] == 'd')
+        args.disks = argv[++i];
+      else
+        args.nets = argv[++i];
+    } else if (!strcmp(argv[i], "--self-profile")) {
+      self_profile = 1;
+    } else if (!strcmp(argv[i], "--profile-report")) {
+      args.mode = MODE_PROFILE_REPORT;
+    } else if (!strcmp(argv[i], "--consumer")) {
+      // Baseline slot name, for two instances of one mode side by side.
+      if (i + 1 >= argc || !argv[i + 1][0] ||
+          strlen(argv[i + 1]) >= SHM_CONSUMER_NAME)
+        puts("Invalid consumer name."), exit(1);
+      args.consumer = argv[++i];
+    } else if (!strcmp(argv[i], "--cgroup")) {
+      args.cgroup = 1;
+    } else if (!strcmp(argv[i], "--cgroup-depth")) {
+      // How deep the top cgroups are looked for; 0 turns them off.
+      int err = 0;
+      if (i + 1 < argc)
+        cgroup_depth = str_to_u32(argv[++i], &err);
+      else
+        err = 1;
+      if (err || cgroup_depth > CGSCAN_MAX_DEPTH)
+        puts("Invalid cgroup depth, expected 0-8."), exit(1);
     } else if (!strcmp(argv[i], "-c") || !strcmp(argv[i], "--clear-shm")) {
-      if (shm_unlink(shm_name) && errno != ENOENT)
-        puts("Failed to close the shared memory object."), exit(1);
+      for (int cg = 0; cg < 2; cg++) {
+        if (shm_unlink(shm_name) && errno != ENOENT)
+          puts("Failed to close the shared memory object."), exit(1);
+        if (shm_unlink(snap_name) && errno != ENOENT)
+          puts("Failed to close the snapshot object."), exit(1);
+        use_cgroup_paths();
+      }
+      if (unlink(caps_path) && errno != ENOENT)
+        puts("Failed to remove the hardware cache."), exit(1);
+      if ((unlink(bars_svgt) && errno != ENOENT) ||
+          (unlink(m1_svgt) && errno != ENOENT))
+        puts("Failed to remove the SVG templates."), exit(1);
       exit(0);
     } else {
       printf("Unknown argument: %s\n", argv[i]), exit(1);
@@ -1217,52 +3462,264 @@ static inline Args argparse(int argc, char **argv) {
   return args;
 }
 
-static inline void calculate_utilizations(void) {
-  get_prev_cpu_info();
+static inline void sample_utilizations(void) {
+  // The GPU, process, PSI and cpufreq readers parse as they go; they count
+  // as reads.
+  struct prof_mark mark = prof_begin();
   get_gpu_info(&info.gpu_info);
+  prof_end(PROF_READ, mark);
   get_mem_info(&info.mem_info);
+  mark = prof_begin();
+  get_proc_info(&info.proc_info);
+  get_cgtop_info(&info.cgtop_info);
+  prof_end(PROF_READ, mark);
+  get_io_info(&info.io_info);
+  mark = prof_begin();
+  get_psi_info(&info.psi_info);
+  prof_end(PROF_READ, mark);
   get_cpu_info(&info.cpu_info);
+  mark = prof_begin();
+  get_cgroup_info(&info.cgroup_info, &info.mem_info);
+  prof_end(PROF_READ, mark);
+  if (freq_enabled) {
+    mark = prof_begin();
+    cpufreq_read(&cpu_freq, &info.cpu_info);
+    prof_end(PROF_READ, mark);
+  } else {
+    memset(info.cpu_info.freq_khz, 0, num_cpu_slots * sizeof(uint32_t));
+    memset(info.cpu_info.freq_max_khz, 0, num_cpu_slots * sizeof(uint32_t));
+  }
+
+  mark = prof_begin();
+  uint64_t now_ns = monotonic_ns();
+  sample_interval_ns = prev_sample_ns ? now_ns - prev_sample_ns : 0;
   calculate_cpu_utilization(prev_cpu_info, &info.cpu_info);
-  save_cpu_shm(&info.cpu_info);
+  save_cpu_shm(&info.cpu_info, now_ns);
+  history_push(&history, now_ns, avg_utilization, utilization,
+               info.cpu_info.num_cpus);
+  if (burst.capacity &&
+      !burst_take(&burst, &burst_stats, info.cpu_info.num_cpus)) {
+    // No sub-sample fitted in the interval; the average is all there is.
+    for (size_t i = 0; i < info.cpu_info.num_cpus; i++) {
+      burst_stats.max[i] = burst_stats.p95[i] = (uint32_t)(utilization[i] + 0.5f);
+      burst_stats.above_ms[i] = 0;
+    }
+  }
+  prof_end(PROF_MATH, mark);
+  if (recorder.fd >= 0)
+    record_sample();
+}
+
+static inline void calculate_utilizations(void) {
+  get_prev_cpu_info();
+  sample_utilizations();
+}
+
+static volatile sig_atomic_t daemon_stop = 0;
+
+static inline void enable_bursts(uint32_t hz) {
+  const struct cpustat_mask *mask = burst.mask;
+  if (burst_init(&burst, num_cpu_slots, burst_threshold))
+    puts("Out of memory."), exit(1);
+  burst.mask = mask;
+  burst_hz = hz;
+}
+
+// Sleep until deadline_ns (CLOCK_MONOTONIC), taking burst sub-samples on
+// a grid that ends at the deadline, so each window covers the interval.
+static inline void wait_until(uint64_t deadline_ns) {
+  uint64_t step = burst_hz ? 1000000000ull / burst_hz : 0;
+  while (!daemon_stop) {
+    uint64_t now = monotonic_ns();
+    if (now >= deadline_ns)
+      break;
+    uint64_t wake = step ? deadline_ns - (deadline_ns - now - 1) / step * step
+                         : deadline_ns;
+    struct timespec ts = {.tv_sec = wake / 1000000000ull,
+                          .tv_nsec = wake % 1000000000ull};
+    if (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+      continue;
+    if (step)
+      burst_sample(&burst, &proc_stat, &stat_buf, monotonic_ns());
+  }
+}
+
+static void on_daemon_signal(int sig) {
+  (void)sig;
+  daemon_stop = 1;
+}
+
+static inline void run_daemon(uint32_t interval_ms) {
+  struct sigaction sa = {0};
+  sa.sa_handler = on_daemon_signal;
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+
+  struct prof_mark mark = prof_begin();
+  struct snapshot *snap = map_snapshot();
+  get_prev_cpu_info();
+  enable_cpu_freq();
+  enable_gpu_streaming(interval_ms);
+  enable_proc_scan();
+  enable_cgroup_scan();
+  prof_end(PROF_SHM, mark);
+
+  uint64_t next = monotonic_ns();
+  while (!daemon_stop) {
+    sample_utilizations();
+    mark = prof_begin();
+    publish_snapshot(snap, interval_ms);
+    prof_end(PROF_FORMAT, mark);
+    prof_tick_end();
+
+    next += interval_ms * 1000000ull;
+    wait_until(next);
+    prof_tick_begin();
+  }
+
+  // Readers fall back to sampling /proc themselves.
+  shm_unlink(snap_name);
+  nvsmi_stream_stop();
+  drmscan_free(&drm);
+  psi_free(&psi);
+  burst_free(&burst);
+  procscan_free(&procs);
+  cgscan_free(&cgs);
 }
 
+// bench.c includes this file for its collectors and formatters.
+#ifndef SYS_GENMON_NO_MAIN
 int main(int argc, char **argv) {
 
   // Initialize secure paths before anything else
   init_secure_paths();
 
   Args args = argparse(argc, argv);
+  prof_tick_begin();
+
+  static const char *const mode_consumers[] = {
+      [MODE_PRINT] = "genmon", [MODE_SVG] = "svg",       [MODE_TUI] = "tui",
+      [MODE_M1_ARCH] = "arch", [MODE_DAEMON] = "daemon", [MODE_PROFILE_REPORT] = "report",
+  };
+  snprintf(consumer_name, sizeof(consumer_name), "%s",
+           args.consumer ? args.consumer : mode_consumers[args.mode]);
+
+  if (args.burst_hz && args.mode != MODE_DAEMON && args.mode != MODE_TUI)
+    puts("--burst needs --daemon or --tui."), exit(1);
+  if (iostat_filter_parse(&disk_filter, args.disks))
+    puts("Invalid disk list."), exit(1);
+  if (iostat_filter_parse(&net_filter, args.nets))
+    puts("Invalid network interface list."), exit(1);
+
+  if (args.cgroup) {
+    if (args.replay)
+      puts("--cgroup can't be combined with --replay."), exit(1);
+    use_cgroup_paths();
+  }
+
+  if (args.replay) {
+    if (args.record || args.mode == MODE_DAEMON)
+      puts("--replay can't be combined with --record or --daemon."), exit(1);
+    // Replayed pictures go beside the live one, not over it, so a panel
+    // showing tmp_svg doesn't start showing the replay.
+    size_t len = strlen(tmp_svg) - strlen(".svg");
+    snprintf(tmp_svg + len, sizeof(tmp_svg) - len, ".replay.svg");
+    run_replay(args.replay, args.mode, args.upsidedown, args.speed);
+    return 0;
+  }
 
-  char buf[BUF_SIZE];
+  // One-shot modes format from the daemon's snapshot when one is running,
+  // unless they are recording their own samples.
+  struct prof_mark mark = prof_begin();
+  int from_daemon = (args.mode == MODE_PRINT || args.mode == MODE_SVG ||
+                     args.mode == MODE_M1_ARCH) &&
+                    !args.record && read_snapshot();
+  // The daemon's snapshot already holds its cgroup; only sampling here
+  // needs the cgroup and the cores it may use.
+  if (args.cgroup && !from_daemon && args.mode != MODE_PROFILE_REPORT)
+    enable_cgroup_view();
+  if (!from_daemon)
+    init_cpu_storage(0);
+  else if (args.mode == MODE_M1_ARCH)
+    hw_caps(); // The tiles follow the core topology
+  if (args.mode == MODE_PROFILE_REPORT) {
+    // Reads only the profile block: no consumer slot, no /proc/stat
+    if (map_shm(1))
+      puts("No profile recorded yet."), exit(0);
+  } else if (from_daemon) {
+    map_shm(1); // Only for the history in the tooltip and the profile
+  } else {
+    get_prev_cpu_info();
+  }
+  prof_end(PROF_SHM, mark);
+  if (args.record)
+    record_open(args.record);
+
+  buf_cap = BUF_SIZE + num_cpu_slots * BUF_SIZE_PER_CPU;
+  char *buf = malloc(buf_cap);
+  if (!buf)
+    puts("Out of memory."), exit(1);
   size_t buf_len = buf[0] = 0;
   switch (args.mode) {
   case MODE_PRINT: // Print genmon in (() ()) format
-    calculate_utilizations();
+    if (!from_daemon)
+      calculate_utilizations();
+    mark = prof_begin();
     buf_len = print_genmon(buf, buf_len);
+    prof_end(PROF_FORMAT, mark);
     (void)!write(STDOUT_FILENO, buf, buf_len);
+    prof_tick_end();
     break;
   case MODE_SVG: // Print genmon in SVG format
-    calculate_utilizations();
+    if (!from_daemon)
+      calculate_utilizations();
+    mark = prof_begin();
     buf_len = print_svg(buf, buf_len, args.upsidedown);
+    prof_end(PROF_FORMAT, mark);
     (void)!write(STDOUT_FILENO, buf, buf_len);
+    prof_tick_end();
     break;
   case MODE_TUI: // TUI mode, for display in terminal
-    while (1) {
+    enable_cpu_freq();
+    enable_gpu_streaming(1000);
+    enable_proc_scan();
+    enable_cgroup_scan();
+    if (args.burst_hz)
+      enable_bursts(args.burst_hz);
+    for (uint64_t next = monotonic_ns();; wait_until(next += 1000000000ull)) {
       calculate_utilizations();
+      mark = prof_begin();
       buf_len = print_tui(buf, buf_len);
+      prof_end(PROF_FORMAT, mark);
       (void)!write(STDOUT_FILENO, buf, buf_len);
       buf_len = 0;
-      sleep(1);
+      prof_tick_end();
+      prof_tick_begin();
     }
     break;
   case MODE_M1_ARCH: // M1 chip architecture diagram for panel
-    calculate_utilizations();
+    if (!from_daemon)
+      calculate_utilizations();
+    mark = prof_begin();
     buf_len = print_m1_arch_mode(buf, buf_len);
+    prof_end(PROF_FORMAT, mark);
+    (void)!write(STDOUT_FILENO, buf, buf_len);
+    prof_tick_end();
+    break;
+  case MODE_DAEMON: // Resident sampler, publishes snapshots for the modes above
+    if (args.burst_hz)
+      enable_bursts(args.burst_hz);
+    run_daemon(args.interval_ms);
+    break;
+  case MODE_PROFILE_REPORT: // What the runs so far cost, from the shm block
+    buf_len = print_profile_report(buf, buf_len);
     (void)!write(STDOUT_FILENO, buf, buf_len);
     break;
   default:
     puts("Invalid mode."), exit(1);
   }
 
+  free(buf);
   return 0;
 }
+#endif // SYS_GENMON_NO_MAIN
@@ -0,0 +1,249 @@
+// Integer fields and delimiters in procfs text, many bytes at a time.
+// Shared by sys-genmon and the Raccoon Monitor plugin.
+//
+// Collectors mostly read short runs of digits split by single spaces, so
+// per-field overhead dominates: strtoul() with its errno dance, and a
+// compare per byte to find where a token ends. Here a field is one 8-byte
+// load. A mask of its non-digit bytes says where the run stops, and up to
+// eight digits fold into an integer with three multiplies (SWAR, SIMD
+// within a register). Longer runs continue eight bytes at a time, and a
+// value past UINT64_MAX sets TOK_ERR_OVERFLOW rather than wrapping.
+// Delimiter searches use the same load-and-mask, which beats memchr() on
+// the short distances between fields.
+//
+// One field at a time, each load waits for the previous field's end to be
+// known. tok_u64s() takes a row of fields instead (a /proc/stat cpu line):
+// 64 bytes are classified at once into digit and blank bitmaps (SSE2 where
+// there is one), every field start comes out of the bitmap, and the fields
+// are folded independently of each other.
+//
+// Loads never reach past end; the last few bytes of a buffer take the
+// bytewise path, as does everything on big-endian machines.
+
+#ifndef TOKENIZE_H
+#define TOKENIZE_H
+
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define TOK_ERR_EMPTY 1    // No digits where a number should be
+#define TOK_ERR_OVERFLOW 2 // Too large for the type
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define TOK_SWAR 1
+#else
+#define TOK_SWAR 0
+#endif
+
+#define TOK_ONES 0x0101010101010101ull
+#define TOK_HIGHS 0x8080808080808080ull
+#define TOK_WINDOW 64 // Bytes tok_u64s() classifies at once
+
+static const uint64_t tok_pow10[9] = {1,      10,      100,      1000,     10000,
+                                      100000, 1000000, 10000000, 100000000};
+
+static inline uint64_t tok_load(const char *p) {
+  uint64_t w;
+  memcpy(&w, p, sizeof(w));
+  return w;
+}
+
+// High bit set in every byte of w that isn't an ASCII digit.
+static inline uint64_t tok_nondigits(uint64_t w) {
+  uint64_t t = w ^ (0x30 * TOK_ONES); // '0'-'9' become 0-9
+  return (((t & ~TOK_HIGHS) + 0x76 * TOK_ONES) | t) & TOK_HIGHS;
+}
+
+// High bit set in the first byte of w equal to c (bytes after it may be
+// flagged too, which is fine for finding the first).
+static inline uint64_t tok_matches(uint64_t w, char c) {
+  uint64_t x = w ^ ((unsigned char)c * TOK_ONES);
+  return (x - TOK_ONES) & ~x & TOK_HIGHS;
+}
+
+// High bit set in every byte of w equal to c, exactly.
+static inline uint64_t tok_equal(uint64_t w, char c) {
+  uint64_t x = w ^ ((unsigned char)c * TOK_ONES);
+  return ~(((x & ~TOK_HIGHS) + ~TOK_HIGHS) | x) & TOK_HIGHS;
+}
+
+// Bit k of the result from the high bit of byte k.
+static inline uint64_t tok_gather(uint64_t highs) {
+  return ((highs >> 7) * 0x0102040810204080ull) >> 56;
+}
+
+// Bit i of *digits set if p[i] is a digit, of *blanks if a space or tab,
+// for the TOK_WINDOW bytes at p.
+static inline void tok_classify(const char *p, uint64_t *digits,
+                                uint64_t *blanks) {
+  *digits = *blanks = 0;
+#ifdef __SSE2__
+  const __m128i below = _mm_set1_epi8('0' - 1), above = _mm_set1_epi8('9' + 1);
+  const __m128i space = _mm_set1_epi8(' '), tab = _mm_set1_epi8('\t');
+  for (int k = 0; k < TOK_WINDOW / 16; k++) {
+    __m128i x = _mm_loadu_si128((const __m128i *)(p + 16 * k));
+    __m128i d = _mm_and_si128(_mm_cmpgt_epi8(x, below), _mm_cmpgt_epi8(above, x));
+    __m128i b = _mm_or_si128(_mm_cmpeq_epi8(x, space), _mm_cmpeq_epi8(x, tab));
+    *digits |= (uint64_t)(uint16_t)_mm_movemask_epi8(d) << (16 * k);
+    *blanks |= (uint64_t)(uint16_t)_mm_movemask_epi8(b) << (16 * k);
+  }
+#else
+  for (int k = 0; k < TOK_WINDOW / 8; k++) {
+    uint64_t w = tok_load(p + 8 * k);
+    *digits |= tok_gather(~tok_nondigits(w) & TOK_HIGHS) << (8 * k);
+    *blanks |= tok_gather(tok_equal(w, ' ') | tok_equal(w, '\t')) << (8 * k);
+  }
+#endif
+}
+
+// Value of the n (1-8) digits in the low bytes of w, first digit lowest.
+static inline uint64_t tok_fold8(uint64_t w, unsigned n) {
+  // Digits to the top, so the missing ones read as leading zeros. Bytes
+  // past the run can borrow in the subtraction, but only upwards, and
+  // they are shifted out.
+  w = (w - 0x30 * TOK_ONES) << (8 * (8 - n));
+  w = (w * 10 + (w >> 8)) & 0x00FF00FF00FF00FFull;
+  w = (w * 100 + (w >> 16)) & 0x0000FFFF0000FFFFull;
+  return (w * 10000 + (w >> 32)) & 0xFFFFFFFFull;
+}
+
+static inline const char *tok_skip_blanks(const char *p, const char *end) {
+  while (p < end && (*p == ' ' || *p == '\t'))
+    p++;
+  return p;
+}
+
+// First c in [p, end), or end.
+static inline const char *tok_find(const char *p, const char *end, char c) {
+#if TOK_SWAR
+  for (; end - p >= 8; p += 8) {
+    uint64_t m = tok_matches(tok_load(p), c);
+    if (m)
+      return p + __builtin_ctzll(m) / 8;
+  }
+#endif
+  while (p < end && *p != c)
+    p++;
+  return p;
+}
+
+// First a or b in [p, end), or end.
+static inline const char *tok_find2(const char *p, const char *end, char a,
+                                    char b) {
+#if TOK_SWAR
+  for (; end - p >= 8; p += 8) {
+    uint64_t w = tok_load(p);
+    uint64_t m = tok_matches(w, a) | tok_matches(w, b);
+    if (m)
+      return p + __builtin_ctzll(m) / 8;
+  }
+#endif
+  while (p < end && *p != a && *p != b)
+    p++;
+  return p;
+}
+
+// Start of the line after p's, or end.
+static inline const char *tok_next_line(const char *p, const char *end) {
+  p = tok_find(p, end, '\n');
+  return p < end ? p + 1 : end;
+}
+
+// Parse the unsigned decimal at *pp after any blanks, and leave *pp on
+// the byte after it. Problems are or-ed into err as TOK_ERR_*; the value
+// is then 0 (no digits) or wrapped (overflow).
+static inline uint64_t tok_u64(const char **pp, const char *end, int *err) {
+  const char *p = tok_skip_blanks(*pp, end);
+  const char *start = p;
+  uint64_t v = 0;
+  int more = 1;
+#if TOK_SWAR
+  while (more && end - p >= 8) {
+    uint64_t w = tok_load(p);
+    uint64_t stop = tok_nondigits(w);
+    unsigned n = stop ? (unsigned)__builtin_ctzll(stop) / 8 : 8;
+    if (n) {
+      if (__builtin_mul_overflow(v, tok_pow10[n], &v) ||
+          __builtin_add_overflow(v, tok_fold8(w, n), &v))
+        *err |= TOK_ERR_OVERFLOW;
+      p += n;
+    }
+    more = n == 8;
+  }
+#endif
+  for (; more && p < end && *p >= '0' && *p <= '9'; p++)
+    if (__builtin_mul_overflow(v, 10, &v) ||
+        __builtin_add_overflow(v, (uint64_t)(*p - '0'), &v))
+      *err |= TOK_ERR_OVERFLOW;
+  if (p == start)
+    *err |= TOK_ERR_EMPTY;
+  *pp = p;
+  return v;
+}
+
+static inline uint32_t tok_u32(const char **pp, const char *end, int *err) {
+  uint64_t v = tok_u64(pp, end, err);
+  if (v > UINT32_MAX)
+    *err |= TOK_ERR_OVERFLOW;
+  return (uint32_t)v;
+}
+
+// n calls of tok_u64() into out, the same results and errors, for a row
+// of blank-separated fields.
+static inline void tok_u64s(const char **pp, const char *end, uint64_t *out,
+                            size_t n, int *err) {
+  const char *p = *pp;
+  size_t i = 0;
+#if TOK_SWAR
+  // 8 spare bytes, so a field at the end of the window can be loaded whole.
+  while (i < n && end - p >= TOK_WINDOW + 8) {
+    uint64_t digits, blanks;
+    tok_classify(p, &digits, &blanks);
+
+    // Fields end at the first byte that is neither, and the last run may
+    // go on past the window; it is left for the next one.
+    uint64_t stop = ~(digits | blanks);
+    uint64_t starts = digits & ~(digits << 1);
+    unsigned stop_at = stop ? (unsigned)__builtin_ctzll(stop) : TOK_WINDOW;
+    unsigned run_at = digits >> 63 ? 63 - (unsigned)__builtin_clzll(starts) : TOK_WINDOW;
+    unsigned limit = stop_at < run_at ? stop_at : run_at;
+    if (limit < TOK_WINDOW)
+      starts &= (1ull << limit) - 1;
+
+    unsigned next = 0;
+    for (; starts && i < n; starts &= starts - 1, i++) {
+      unsigned at = (unsigned)__builtin_ctzll(starts);
+      unsigned len = (unsigned)__builtin_ctzll(~(digits >> at));
+      if (len <= 8) {
+        out[i] = tok_fold8(tok_load(p + at), len);
+      } else {
+        const char *q = p + at;
+        out[i] = tok_u64(&q, end, err);
+      }
+      next = at + len;
+    }
+    if (i == n) {
+      p += next;
+      break;
+    }
+    p += limit;
+    if (stop_at < run_at || !limit)
+      break; // Not a field next, or one longer than the window
+  }
+#endif
+  for (; i < n; i++)
+    out[i] = tok_u64(&p, end, err);
+  *pp = p;
+}
+
+// For short NUL-terminated values, such as a sysfs file or a "key: value"
+// copied out of a line.
+static inline uint64_t tok_str_u64(const char *s, int *err) {
+  return tok_u64(&s, s + strlen(s), err);
+}
+
+#endif // TOKENIZE_H